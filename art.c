@@ -14,9 +14,26 @@
 #include <math.h>
 
 #include "resampler.h"
+#include "halfband.h"
 #include "biquad.h"
+#include "formats.h"
 #include "art_stream.h"
 
+#include <time.h>
+
+#ifndef ART_STREAM_NO_THREADS
+#include <pthread.h>
+#endif
+
+#if !defined (_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#include <fcntl.h>
+#endif
 
 #define IS_BIG_ENDIAN (*(uint16_t *)"\0\xff" < 0x0100)
 
@@ -25,7 +42,8 @@ static const char *sign_on = "\n"
 " Copyright (c) 2006 - 2023 David Bryant.\n\n";
 
 static const char *usage =
-" Usage:     ART [-options] infile.wav outfile.wav\n\n"
+" Usage:     ART [-options] infile.wav outfile.wav\n"
+"            ART -i<list|dir> [-options] [outdir]\n\n"
 " Options:  -1|2|3|4    = quality presets, default = 3\n"
 "           -r<Hz>      = resample to specified rate\n"
 "           -g<dB>      = apply gain (default = 0 dB)\n"
@@ -36,20 +54,40 @@ static const char *usage =
 "           -o<bits>    = change output file bitdepth (4-24 or 32)\n"
 "           -n          = use nearest filter (don't interpolate)\n"
 "           -b          = Blackman-Harris windowing (best stopband)\n"
+"           -d<file>    = dump the sinc filter bank to file (.h or .c for C source)\n"
 "           -h          = Hann windowing (fastest transition)\n"
+"           -i<path>    = batch mode: resample the files in a list file or directory\n"
+"           -a          = asynchronous I/O (separate reader and writer threads)\n"
+"           -j<num>     = use num worker threads (results are identical)\n"
+"                         (in batch mode, process num files at once)\n"
+"           -k<frames>  = frames per processing block (default = 441)\n"
+"           -m          = use memory-mapped file I/O\n"
+"           -c          = with -j, split the work by channels (not time segments)\n"
 "           -p          = pre/post filtering (cascaded biquads)\n"
 "           -q          = quiet mode (display errors only)\n"
 "           -v          = verbose (display lots of info)\n"
-"           -y          = overwrite outfile if it exists\n\n"
+"           -y          = overwrite outfile if it exists\n"
+"           -z          = minimum-phase filters (low latency, not linear phase)\n\n"
+" Either filename may be \"-\" for stdin or stdout (the output header then has unknown sizes).\n\n"
 " Web:       Visit www.github.com/dbry/audio-resampler for latest version and info\n\n";
 
 static int wav_process (char *infilename, char *outfilename);
+static int batch_process (const char *source, const char *outdir);
 
 process_context_t process_context={};
+static uint32_t wav_channel_mask;
+static int use_mmap;
 
 int main (argc, argv) int argc; char **argv;
 {
-    char *infilename = NULL, *outfilename = NULL;
+    char *infilename = NULL, *outfilename = NULL, *batch_source = NULL;
+
+    // defaults (quality preset 3, unity gain, interpolated filters, generated only as they're needed)
+
+    process_context.config.num_filters = process_context.config.num_taps = 256;
+    process_context.config.interpolate = 1;
+    process_context.config.lazy_filters = 1;
+    process_context.config.gain = 1.0;
 
     // loop through command-line arguments
 
@@ -63,42 +101,42 @@ int main (argc, argv) int argc; char **argv;
                 switch (**argv) {
 
 			case '1':
-				process_context.num_filters = process_context.num_taps = 16;
+				process_context.config.num_filters = process_context.config.num_taps = 16;
 			break;
 
 		    case '2':
-		    	process_context.num_filters = process_context.num_taps = 64;
+		    	process_context.config.num_filters = process_context.config.num_taps = 64;
 			break;
 
 		    case '3':
-		    	process_context.num_filters = process_context.num_taps = 256;
+		    	process_context.config.num_filters = process_context.config.num_taps = 256;
 			break;
 
 		    case '4':
-		    	process_context.num_filters = process_context.num_taps = 1024;
+		    	process_context.config.num_filters = process_context.config.num_taps = 1024;
 			break;
 
                     case 'P': case 'p':
-                    	process_context.pre_post_filter = 1;
+                    	process_context.config.pre_post_filter = 1;
                         break;
 
                     case 'Q': case 'q':
-                    	process_context.verbosity = -1;
+                    	process_context.config.verbosity = -1;
                         break;
 
                     case 'V': case 'v':
-                    	process_context.verbosity = 1;
+                    	process_context.config.verbosity = 1;
                         break;
 
 		    case 'R': case 'r':
-		    	process_context.resample_rate = strtod (++*argv, argv);
+		    	process_context.config.resample_rate = strtod (++*argv, argv);
 			--*argv;
 			break;
 
 		    case 'S': case 's':
-		    	process_context.phase_shift = strtod (++*argv, argv) / 360.0;
+		    	process_context.config.phase_shift = strtod (++*argv, argv) / 360.0;
 
-                        if (process_context.phase_shift <= -1.0 || process_context.phase_shift >= 1.0) {
+                        if (process_context.config.phase_shift <= -1.0 || process_context.config.phase_shift >= 1.0) {
                             fprintf (stderr, "\nphase shift must be less than +/- 1 sample!\n");
                             return 1;
                         }
@@ -107,19 +145,19 @@ int main (argc, argv) int argc; char **argv;
 			break;
 
 		    case 'G': case 'g':
-		    	process_context.gain = pow (10.0, strtod (++*argv, argv) / 20.0);
+		    	process_context.config.gain = pow (10.0, strtod (++*argv, argv) / 20.0);
 			--*argv;
 			break;
 
 		    case 'L': case 'l':
-		    	process_context.lowpass_freq = strtod (++*argv, argv);
+		    	process_context.config.lowpass_freq = strtod (++*argv, argv);
 			--*argv;
 			break;
 
 		    case 'F': case 'f':
-		    	process_context.num_filters = strtod (++*argv, argv);
+		    	process_context.config.num_filters = strtod (++*argv, argv);
 
-                        if (process_context.num_filters < 2 || process_context.num_filters > 1024) {
+                        if (process_context.config.num_filters < 2 || process_context.config.num_filters > 1024) {
                             fprintf (stderr, "\nnum of filters must be 2 - 1024!\n");
                             return 1;
                         }
@@ -131,9 +169,9 @@ int main (argc, argv) int argc; char **argv;
 			break;
 
 		    case 'T': case 't':
-		    	process_context.num_taps = strtod (++*argv, argv);
+		    	process_context.config.num_taps = strtod (++*argv, argv);
 
-                        if ((process_context.num_taps & 3) || process_context.num_taps < 4 || process_context.num_taps > 1024) {
+                        if ((process_context.config.num_taps & 3) || process_context.config.num_taps < 4 || process_context.config.num_taps > 1024) {
                             fprintf (stderr, "\nnum of taps must be 4 - 1024 and a multiple of 4!\n");
                             return 1;
                         }
@@ -141,16 +179,85 @@ int main (argc, argv) int argc; char **argv;
 			--*argv;
 			break;
 
+		    case 'O': case 'o':
+		    	process_context.config.outbits = strtod (++*argv, argv);
+
+                        if ((process_context.config.outbits != 32 && process_context.config.outbits > 24) || process_context.config.outbits < 4) {
+                            fprintf (stderr, "\noutput bitdepth must be 4 - 24 (integer) or 32 (float)!\n");
+                            return 1;
+                        }
+
+			--*argv;
+			break;
+
 		    case 'N': case 'n':
-		    	process_context.interpolate = 0;
+		    	process_context.config.interpolate = 0;
 			break;
 
 		    case 'B': case 'b':
-		    	process_context.bh4_window = 1;
+		    	process_context.config.bh4_window = 1;
+			break;
+
+		    case 'D': case 'd':
+		    	if (!*++*argv) {
+                            fprintf (stderr, "\nfilter bank dump needs a filename!\n");
+                            return 1;
+                        }
+
+		    	process_context.bank_filename = *argv;
+		    	*argv += strlen (*argv) - 1;
+			break;
+
+		    case 'I': case 'i':
+		    	if (!*++*argv) {
+                            fprintf (stderr, "\nbatch mode needs a list file or directory!\n");
+                            return 1;
+                        }
+
+		    	batch_source = *argv;
+		    	*argv += strlen (*argv) - 1;
 			break;
 
 		    case 'H': case 'h':
-		    	process_context.hann_window = 1;
+		    	process_context.config.hann_window = 1;
+			break;
+
+		    case 'J': case 'j':
+		    	process_context.num_threads = strtod (++*argv, argv);
+
+                        if (process_context.num_threads < 1 || process_context.num_threads > 256) {
+                            fprintf (stderr, "\nnum of threads must be 1 - 256!\n");
+                            return 1;
+                        }
+
+			--*argv;
+			break;
+
+		    case 'C': case 'c':
+		    	process_context.channel_parallel = 1;
+			break;
+
+		    case 'A': case 'a':
+		    	process_context.pipelined = 1;
+			break;
+
+		    case 'K': case 'k':
+		    	process_context.config.block_frames = strtod (++*argv, argv);
+
+                        if (process_context.config.block_frames < 16 || process_context.config.block_frames > 1048576) {
+                            fprintf (stderr, "\nblock size must be 16 - 1048576 frames!\n");
+                            return 1;
+                        }
+
+			--*argv;
+			break;
+
+		    case 'Z': case 'z':
+		    	process_context.config.minimum_phase = 1;
+			break;
+
+		    case 'M': case 'm':
+		    	use_mmap = 1;
 			break;
 
                     default:
@@ -171,15 +278,29 @@ int main (argc, argv) int argc; char **argv;
         }
     }
 
-    if (process_context.verbosity >= 0)
+    if (process_context.config.verbosity >= 0)
         fprintf (stderr, "%s", sign_on);
 
+    // in batch mode, the one filename is the output directory (which a list with all the outputs doesn't need)
+
+    if (batch_source) {
+        if (outfilename) {
+            fprintf (stderr, "batch mode takes just an output directory!\n");
+            return 1;
+        }
+
+        int res = batch_process (batch_source, infilename);
+
+        free (infilename);
+        return res;
+    }
+
     if (!outfilename) {
         printf ("%s", usage);
         return 0;
     }
 
-    if (!strcmp (infilename, outfilename)) {
+    if (strcmp (infilename, "-") && !strcmp (infilename, outfilename)) {
         fprintf (stderr, "can't overwrite input file (specify different/new output file name)\n");
         return -1;
     }
@@ -205,6 +326,23 @@ typedef struct {
 
 #define ChunkHeaderFormat "4L"
 
+// RF64 (and BW64) files have the 64-bit sizes in a "ds64" chunk right after the header, with 0xffffffff
+// in the 32-bit size fields. Files we write that might grow past 4 GB get a "JUNK" chunk of the same size
+// there instead, which becomes the "ds64" if it's needed.
+
+typedef struct {
+    uint32_t riffSizeLow, riffSizeHigh, dataSizeLow, dataSizeHigh, sampleCountLow, sampleCountHigh, tableLength;
+} DS64Chunk;
+
+#define DS64ChunkFormat "LLLLLLL"
+
+#define WAV_HEADER_RIFF         0       // plain RIFF header
+#define WAV_HEADER_RIFF_JUNK    1       // plain RIFF with room reserved for a ds64 chunk
+#define WAV_HEADER_RF64         2       // RF64 with a ds64 chunk
+
+#define WAV_UNKNOWN_SIZE        ((uint64_t) -1)     // for headers written to pipes (all sizes 0xffffffff)
+#define WAV_RIFF_MAX_BYTES      0xffffffffULL        // larger files (from the RIFF header on) need RF64
+
 typedef struct {
     uint16_t FormatTag, NumChannels;
     uint32_t SampleRate, BytesPerSecond;
@@ -226,40 +364,81 @@ typedef struct {
 #define WAVE_FORMAT_IEEE_FLOAT  0x3
 #define WAVE_FORMAT_EXTENSIBLE  0xfffe
 
-static int write_pcm_wav_header (FILE *outfile, int bps, int num_channels, unsigned long num_samples, unsigned long sample_rate, uint32_t channel_mask);
+#define WAV_HEADER_MAX_BYTES (sizeof (RiffChunkHeader) + sizeof (ChunkHeader) * 3 + sizeof (DS64Chunk) + sizeof (WaveHeader))
+
+// What we need to know about an input file (from read_wav_header()). With unknown_length, num_samples is
+// just an upper limit and the data is read to the end of the file (or stream).
+
+typedef struct {
+    uint16_t num_channels, bits;
+    uint32_t sample_rate, channel_mask;
+    uint64_t num_samples;
+    uint8_t unknown_length;
+} WavInfo;
+
+static int write_pcm_wav_header (FILE *outfile, int bps, int num_channels, uint64_t num_samples, unsigned long sample_rate, uint32_t channel_mask, int layout);
+static int build_pcm_wav_header (unsigned char *header, int bps, int num_channels, uint64_t num_samples, unsigned long sample_rate, uint32_t channel_mask, int layout);
+static int output_header_layout (const art_stream_config_t *config, uint64_t num_samples, int unknown_length);
+static int rewrite_wav_header (FILE *outfile, const art_stream_config_t *config, uint64_t num_samples, uint32_t channel_mask, int layout);
+static int map_input_file (const char *infilename);
+static uint8_t *map_output_file (uint64_t num_frames);
+static void unmap_files (uint64_t num_frames);
 static void little_endian_to_native (void *data, char *format);
 static void native_to_little_endian (void *data, char *format);
 
-static int wav_process (char *infilename, char *outfilename)
+// Close the files (but not stdin or stdout).
+
+static void close_files (void)
 {
-    int format = 0, res = 0;
-    uint32_t channel_mask = 0;
+    if (process_context.out_stream != stdout)
+        fclose (process_context.out_stream);
+    else
+        fflush (stdout);
 
-    RiffChunkHeader riff_chunk_header;
-    ChunkHeader chunk_header;
-    WaveHeader WaveHeader;
+    if (process_context.in_stream != stdin)
+        fclose (process_context.in_stream);
+}
 
-    // open both input and output files
+// Return the size of a regular file (which can be seeked and mapped), or -1 for a pipe or terminal.
 
-    if (!(process_context.in_stream = fopen (infilename, "rb"))) {
-        fprintf (stderr, "can't open file \"%s\" for reading!\n", infilename);
-        return -1;
-    }
+static int64_t regular_file_size (FILE *file)
+{
+#if !defined (_WIN32)
+    struct stat info;
 
-    if (!(process_context.out_stream = fopen (outfilename, "wb"))) {
-        fprintf (stderr, "can't open file \"%s\" for writing!\n", outfilename);
-        fclose (process_context.in_stream);
-        return -1;
+    if (!fstat (fileno (file), &info) && S_ISREG (info.st_mode))
+        return info.st_size;
+#else
+    if (file != stdin && file != stdout && !_fseeki64 (file, 0, SEEK_END)) {
+        int64_t size = _ftelli64 (file);
+
+        rewind (file);
+        return size;
     }
+#endif
+    return -1;
+}
+
+// Parse the .WAV header of "infile" (up to the start of the data chunk) into "info", making sure it's a
+// format we can handle (and displaying why not if it isn't). Returns 0 on success and -1 on failure.
+
+static int read_wav_header (FILE *infile, const char *infilename, int verbosity, WavInfo *info)
+{
+    RiffChunkHeader riff_chunk_header;
+    ChunkHeader chunk_header;
+    WaveHeader WaveHeader;
+    uint64_t ds64_data_bytes = 0;
+    int format = 0, rf64 = 0;
+
+    memset (&WaveHeader, 0, sizeof (WaveHeader));
+    memset (info, 0, sizeof (WavInfo));
 
-    // read (and write) initial RIFF form header
+    // read initial RIFF form header
 
-    if (!fread (&riff_chunk_header, sizeof (RiffChunkHeader), 1, process_context.in_stream) ||
-        strncmp (riff_chunk_header.ckID, "RIFF", 4) ||
-        strncmp (riff_chunk_header.formType, "WAVE", 4)) {
+    if (!fread (&riff_chunk_header, sizeof (RiffChunkHeader), 1, infile) ||
+        (strncmp (riff_chunk_header.ckID, "RIFF", 4) && !(rf64 = !strncmp (riff_chunk_header.ckID, "RF64", 4) ||
+        !strncmp (riff_chunk_header.ckID, "BW64", 4))) || strncmp (riff_chunk_header.formType, "WAVE", 4)) {
             fprintf (stderr, "\"%s\" is not a valid .WAV file!\n", infilename);
-            fclose (process_context.out_stream);
-            fclose (process_context.in_stream);
             return -1;
     }
 
@@ -267,10 +446,8 @@ static int wav_process (char *infilename, char *outfilename)
 
     while (1) {
 
-        if (!fread (&chunk_header, sizeof (ChunkHeader), 1, process_context.in_stream)) {
+        if (!fread (&chunk_header, sizeof (ChunkHeader), 1, infile)) {
             fprintf (stderr, "\"%s\" is not a valid .WAV file!\n", infilename);
-            fclose (process_context.out_stream);
-            fclose (process_context.in_stream);
             return -1;
         }
 
@@ -283,10 +460,8 @@ static int wav_process (char *infilename, char *outfilename)
             int supported = 1;
 
             if (chunk_header.ckSize < 16 || chunk_header.ckSize > sizeof (WaveHeader) ||
-                !fread (&WaveHeader, chunk_header.ckSize, 1, process_context.in_stream)) {
+                !fread (&WaveHeader, chunk_header.ckSize, 1, infile)) {
                     fprintf (stderr, "\"%s\" is not a valid .WAV file!\n", infilename);
-                    fclose (process_context.out_stream);
-                    fclose (process_context.in_stream);
                     return -1;
             }
 
@@ -295,25 +470,25 @@ static int wav_process (char *infilename, char *outfilename)
             format = (WaveHeader.FormatTag == WAVE_FORMAT_EXTENSIBLE && chunk_header.ckSize == 40) ?
                 WaveHeader.SubFormat : WaveHeader.FormatTag;
 
-            channel_mask = (WaveHeader.FormatTag == WAVE_FORMAT_EXTENSIBLE && chunk_header.ckSize == 40) ?
+            info->channel_mask = (WaveHeader.FormatTag == WAVE_FORMAT_EXTENSIBLE && chunk_header.ckSize == 40) ?
                 WaveHeader.ChannelMask : 0;
 
-            process_context.inbits = (chunk_header.ckSize == 40 && WaveHeader.Samples.ValidBitsPerSample) ?
+            info->bits = (chunk_header.ckSize == 40 && WaveHeader.Samples.ValidBitsPerSample) ?
                 WaveHeader.Samples.ValidBitsPerSample : WaveHeader.BitsPerSample;
 
             if (WaveHeader.NumChannels < 1 || WaveHeader.NumChannels > 32)
                 supported = 0;
             else if (format == WAVE_FORMAT_PCM) {
 
-                if (process_context.inbits < 4 || process_context.inbits > 24)
+                if (info->bits < 4 || info->bits > 24)
                     supported = 0;
 
-                if (WaveHeader.BlockAlign != WaveHeader.NumChannels * ((process_context.inbits + 7) / 8))
+                if (WaveHeader.BlockAlign != WaveHeader.NumChannels * ((info->bits + 7) / 8))
                     supported = 0;
             }
             else if (format == WAVE_FORMAT_IEEE_FLOAT) {
 
-                if (process_context.inbits != 32)
+                if (info->bits != 32)
                     supported = 0;
 
                 if (WaveHeader.BlockAlign != WaveHeader.NumChannels * 4)
@@ -324,12 +499,10 @@ static int wav_process (char *infilename, char *outfilename)
 
             if (!supported) {
                 fprintf (stderr, "\"%s\" is an unsupported .WAV format!\n", infilename);
-                fclose (process_context.out_stream);
-                fclose (process_context.in_stream);
                 return -1;
             }
 
-            if (process_context.verbosity > 0) {
+            if (verbosity > 0) {
                 fprintf (stderr, "format tag size = %d\n", chunk_header.ckSize);
                 fprintf (stderr, "FormatTag = 0x%x, NumChannels = %u, BitsPerSample = %u\n",
                     WaveHeader.FormatTag, WaveHeader.NumChannels, WaveHeader.BitsPerSample);
@@ -345,51 +518,85 @@ static int wav_process (char *infilename, char *outfilename)
                         WaveHeader.ChannelMask, WaveHeader.SubFormat);
             }
         }
+        else if (!strncmp (chunk_header.ckID, "ds64", 4) && rf64) {
+            DS64Chunk ds64_chunk;
+
+            if (chunk_header.ckSize < sizeof (DS64Chunk) ||
+                !fread (&ds64_chunk, sizeof (DS64Chunk), 1, infile)) {
+                    fprintf (stderr, "\"%s\" is not a valid .WAV file!\n", infilename);
+                    return -1;
+            }
+
+            little_endian_to_native (&ds64_chunk, DS64ChunkFormat);
+            ds64_data_bytes = ((uint64_t) ds64_chunk.dataSizeHigh << 32) | ds64_chunk.dataSizeLow;
+
+            // skip the table (and anything else) after the sizes
+
+            for (chunk_header.ckSize = (chunk_header.ckSize + 1 - sizeof (DS64Chunk)) & ~1U; chunk_header.ckSize; chunk_header.ckSize--)
+                if (fgetc (infile) == EOF) {
+                    fprintf (stderr, "\"%s\" is not a valid .WAV file!\n", infilename);
+                    return -1;
+                }
+        }
         else if (!strncmp (chunk_header.ckID, "data", 4)) {
+            uint64_t data_bytes = chunk_header.ckSize;
+            int64_t file_size;
 
             // on the data chunk, get size and exit parsing loop
 
             if (!WaveHeader.NumChannels) {      // make sure we saw a "fmt" chunk...
                 fprintf (stderr, "\"%s\" is not a valid .WAV file!\n", infilename);
-                fclose (process_context.out_stream);
-                fclose (process_context.in_stream);
                 return -1;
             }
 
-            if (!chunk_header.ckSize) {
+            // RF64 has the size in the ds64 chunk, and a size of 0xffffffff (or zero from a pipe) means it
+            // wasn't known when the file was written, so the data runs to the end of the file (or stream)
+
+            if (rf64 && chunk_header.ckSize == 0xffffffff && ds64_data_bytes)
+                data_bytes = ds64_data_bytes;
+            else if (chunk_header.ckSize == 0xffffffff || (!chunk_header.ckSize && (rf64 || infile == stdin))) {
+                if ((file_size = regular_file_size (infile)) >= 0) {
+                    data_bytes = file_size - ftell (infile);
+                    data_bytes -= data_bytes % WaveHeader.BlockAlign;
+                }
+                else {
+                    info->unknown_length = 1;
+                    data_bytes = (uint64_t) WaveHeader.BlockAlign << 48;
+                }
+            }
+
+            if (!data_bytes) {
                 fprintf (stderr, "this .WAV file has no audio samples, probably is corrupt!\n");
-                fclose (process_context.out_stream);
-                fclose (process_context.in_stream);
                 return -1;
             }
 
-            if (chunk_header.ckSize % WaveHeader.BlockAlign) {
+            if (data_bytes % WaveHeader.BlockAlign) {
                 fprintf (stderr, "\"%s\" is not a valid .WAV file!\n", infilename);
-                fclose (process_context.out_stream);
-                fclose (process_context.in_stream);
                 return -1;
             }
 
-            process_context.num_samples = chunk_header.ckSize / WaveHeader.BlockAlign;
+            info->num_samples = data_bytes / WaveHeader.BlockAlign;
 
-            if (!process_context.num_samples) {
+            if (!info->num_samples) {
                 fprintf (stderr, "this .WAV file has no audio samples, probably is corrupt!\n");
-                fclose (process_context.out_stream);
-                fclose (process_context.in_stream);
                 return -1;
             }
 
-            if (process_context.verbosity > 0)
-                fprintf (stderr, "num samples = %u\n", process_context.num_samples);
+            if (verbosity > 0) {
+                if (info->unknown_length)
+                    fprintf (stderr, "num samples = unknown (reading to end of stream)\n");
+                else
+                    fprintf (stderr, "num samples = %llu\n", (unsigned long long) info->num_samples);
+            }
 
-            process_context.num_channels = WaveHeader.NumChannels;
-            process_context.sample_rate = WaveHeader.SampleRate;
+            info->num_channels = WaveHeader.NumChannels;
+            info->sample_rate = WaveHeader.SampleRate;
             break;
         }
         else {          // just ignore/copy unknown chunks
             unsigned int bytes_to_copy = (chunk_header.ckSize + 1) & ~1L;
 
-            if (process_context.verbosity > 0)
+            if (verbosity > 0)
                 fprintf (stderr, "extra unknown chunk \"%c%c%c%c\" of %u bytes\n",
                     chunk_header.ckID [0], chunk_header.ckID [1], chunk_header.ckID [2],
                     chunk_header.ckID [3], bytes_to_copy);
@@ -401,12 +608,10 @@ static int wav_process (char *infilename, char *outfilename)
                 if (bytes_to_read > sizeof (temp_buffer))
                     bytes_to_read = sizeof (temp_buffer);
 
-                bytes_read = fread (temp_buffer, 1, bytes_to_read, process_context.in_stream);
+                bytes_read = fread (temp_buffer, 1, bytes_to_read, infile);
 
                 if (bytes_read != bytes_to_read) {
                     fprintf (stderr, "\"%s\" is not a valid .WAV file!\n", infilename);
-                    fclose (process_context.out_stream);
-                    fclose (process_context.in_stream);
                     return -1;
                 }
 
@@ -415,56 +620,127 @@ static int wav_process (char *infilename, char *outfilename)
         }
     }
 
-    if (!process_context.num_channels || !process_context.sample_rate || !process_context.inbits || !process_context.num_samples) {
+    if (!info->num_channels || !info->sample_rate || !info->bits || !info->num_samples) {
         fprintf (stderr, "\"%s\" is not a valid .WAV file!\n", infilename);
-        fclose (process_context.out_stream);
-        fclose (process_context.in_stream);
         return -1;
     }
 
-    // if not specified, preserve sample rate and bitdepth of input
+    return 0;
+}
 
-    if (!process_context.resample_rate)
-    	process_context.resample_rate = process_context.sample_rate;
+static int wav_process (char *infilename, char *outfilename)
+{
+    int res = 0, layout = WAV_HEADER_RIFF, to_pipe;
+    uint32_t channel_mask;
+    int64_t out_file_size;
+    WavInfo info;
 
-    if (process_context.verbosity >= 0)
-        fprintf (stderr, "resampling %d-channel file \"%s\" (%db/%dk) to \"%s\" (%db/%dk)...\n",
-        		process_context.num_channels, infilename, process_context.inbits, (int)((process_context.sample_rate + 500) / 1000),
-            outfilename, process_context.outbits, (int)((process_context.resample_rate + 500) / 1000));
+    // open both input and output files ("-" is stdin or stdout)
 
-    if (!write_pcm_wav_header (process_context.out_stream, process_context.outbits, process_context.num_channels, process_context.num_samples, process_context.resample_rate, channel_mask)) {
-        fprintf (stderr, "can't write to file \"%s\"!\n", outfilename);
-        fclose (process_context.out_stream);
-        fclose (process_context.in_stream);
+    if (!strcmp (infilename, "-")) {
+        process_context.in_stream = stdin;
+#if defined (_WIN32)
+        _setmode (_fileno (stdin), _O_BINARY);
+#endif
+    }
+    else if (!(process_context.in_stream = fopen (infilename, "rb"))) {
+        fprintf (stderr, "can't open file \"%s\" for reading!\n", infilename);
         return -1;
     }
 
-    unsigned int output_samples = art_resample_process_audio(process_context.num_samples);
+    if (!strcmp (outfilename, "-")) {
+        process_context.out_stream = stdout;
+#if defined (_WIN32)
+        _setmode (_fileno (stdout), _O_BINARY);
+#endif
+    }
+    else if (!(process_context.out_stream = fopen (outfilename, use_mmap ? "w+b" : "wb"))) {
+        fprintf (stderr, "can't open file \"%s\" for writing!\n", outfilename);
+
+        if (process_context.in_stream != stdin)
+            fclose (process_context.in_stream);
 
-    rewind (process_context.out_stream);
+        return -1;
+    }
 
-    if (!write_pcm_wav_header (process_context.out_stream, process_context.outbits, process_context.num_channels, output_samples, process_context.resample_rate, channel_mask)) {
-        fprintf (stderr, "can't write to file \"%s\"!\n", outfilename);
-        fclose (process_context.out_stream);
-        fclose (process_context.in_stream);
+    if (read_wav_header (process_context.in_stream, infilename, process_context.config.verbosity, &info)) {
+        close_files ();
         return -1;
     }
 
-    fclose (process_context.out_stream);
-    fclose (process_context.in_stream);
+    process_context.config.num_channels = info.num_channels;
+    process_context.config.sample_rate = info.sample_rate;
+    process_context.config.inbits = info.bits;
+    process_context.num_samples = info.num_samples;
+    process_context.unknown_length = info.unknown_length;
+    channel_mask = info.channel_mask;
+
+    // if not specified, preserve sample rate and bitdepth of input
+
+    if (!process_context.config.resample_rate)
+    	process_context.config.resample_rate = process_context.config.sample_rate;
+
+    if (!process_context.config.outbits)
+    	process_context.config.outbits = process_context.config.inbits;
+
+    if (process_context.config.verbosity >= 0)
+        fprintf (stderr, "resampling %d-channel file \"%s\" (%db/%dk) to \"%s\" (%db/%dk)...\n",
+        		process_context.config.num_channels, infilename, process_context.config.inbits, (int)((process_context.config.sample_rate + 500) / 1000),
+            outfilename, process_context.config.outbits, (int)((process_context.config.resample_rate + 500) / 1000));
+
+    // A pipe gets a header with unknown sizes (since it can't be rewritten at the end). A file gets room
+    // for a ds64 chunk if it might end up over 4 GB.
+
+    out_file_size = regular_file_size (process_context.out_stream);
+    to_pipe = out_file_size < 0;
+
+    if (!to_pipe)
+        layout = output_header_layout (&process_context.config, process_context.num_samples, process_context.unknown_length);
+
+    // with memory-mapped I/O, the output file is mapped (and its header written) once the resampler
+    // knows how many frames it will generate
+
+    if (use_mmap && !to_pipe && !process_context.unknown_length && map_input_file (infilename)) {
+        wav_channel_mask = channel_mask;
+        process_context.map_output = map_output_file;
+    }
+    else if (!write_pcm_wav_header (process_context.out_stream, process_context.config.outbits, process_context.config.num_channels,
+        to_pipe ? WAV_UNKNOWN_SIZE : process_context.num_samples, process_context.config.resample_rate, channel_mask, layout)) {
+            fprintf (stderr, "can't write to file \"%s\"!\n", outfilename);
+            close_files ();
+            return -1;
+    }
+
+    uint64_t output_samples = art_resample_process_audio();
+
+    if (process_context.in_map || process_context.out_map)
+        unmap_files (output_samples);
+
+    if (!process_context.out_map && !to_pipe &&
+        !rewrite_wav_header (process_context.out_stream, &process_context.config, output_samples, channel_mask, layout)) {
+            fprintf (stderr, "can't write to file \"%s\"!\n", outfilename);
+            close_files ();
+            return -1;
+    }
+
+    close_files ();
     return res;
 }
 
-static int write_pcm_wav_header (FILE *outfile, int bps, int num_channels, unsigned long num_samples, unsigned long sample_rate, uint32_t channel_mask)
+// Build a header for the given layout (WAV_HEADER_*) with num_samples frames of data (or WAV_UNKNOWN_SIZE).
+// The header has the same size for the same layout, whatever the count.
+
+static int build_pcm_wav_header (unsigned char *header, int bps, int num_channels, uint64_t num_samples, unsigned long sample_rate, uint32_t channel_mask, int layout)
 {
     RiffChunkHeader riffhdr;
-    ChunkHeader datahdr, fmthdr;
+    ChunkHeader datahdr, fmthdr, ds64hdr;
     WaveHeader wavhdr;
+    DS64Chunk ds64;
 
-    int wavhdrsize = 16;
+    int wavhdrsize = 16, ds64size = layout == WAV_HEADER_RIFF ? 0 : sizeof (ds64hdr) + sizeof (ds64);
     int bytes_per_sample = (bps + 7) / 8;
     int format = (bps == 32) ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
-    uint32_t total_data_bytes = num_samples * bytes_per_sample * num_channels;
+    uint64_t total_data_bytes = num_samples * bytes_per_sample * num_channels, riff_bytes;
 
     memset (&wavhdr, 0, sizeof (wavhdr));
 
@@ -491,28 +767,630 @@ static int write_pcm_wav_header (FILE *outfile, int bps, int num_channels, unsig
         wavhdr.GUID [13] = 0x71;
     }
 
-    memcpy (riffhdr.ckID, "RIFF", sizeof (riffhdr.ckID));
+    riff_bytes = sizeof (riffhdr) + ds64size + sizeof (fmthdr) + wavhdrsize + sizeof (datahdr) + total_data_bytes;
+
+    memcpy (riffhdr.ckID, layout == WAV_HEADER_RF64 ? "RF64" : "RIFF", sizeof (riffhdr.ckID));
     memcpy (riffhdr.formType, "WAVE", sizeof (riffhdr.formType));
-    riffhdr.ckSize = sizeof (riffhdr) + wavhdrsize + sizeof (datahdr) + total_data_bytes;
     memcpy (fmthdr.ckID, "fmt ", sizeof (fmthdr.ckID));
     fmthdr.ckSize = wavhdrsize;
-
     memcpy (datahdr.ckID, "data", sizeof (datahdr.ckID));
-    datahdr.ckSize = total_data_bytes;
 
-    // write the RIFF chunks up to just before the data starts
+    if (num_samples == WAV_UNKNOWN_SIZE || layout == WAV_HEADER_RF64)
+        riffhdr.ckSize = datahdr.ckSize = 0xffffffff;
+    else {
+        riffhdr.ckSize = (uint32_t) (riff_bytes - 8);
+        datahdr.ckSize = (uint32_t) total_data_bytes;
+    }
+
+    memset (&ds64, 0, sizeof (ds64));
+    memcpy (ds64hdr.ckID, layout == WAV_HEADER_RF64 ? "ds64" : "JUNK", sizeof (ds64hdr.ckID));
+    ds64hdr.ckSize = sizeof (ds64);
+
+    if (layout == WAV_HEADER_RF64) {
+        ds64.riffSizeLow = (uint32_t) (riff_bytes - 8);
+        ds64.riffSizeHigh = (uint32_t) ((riff_bytes - 8) >> 32);
+        ds64.dataSizeLow = (uint32_t) total_data_bytes;
+        ds64.dataSizeHigh = (uint32_t) (total_data_bytes >> 32);
+        ds64.sampleCountLow = (uint32_t) num_samples;
+        ds64.sampleCountHigh = (uint32_t) (num_samples >> 32);
+    }
+
+    // build the RIFF chunks up to just before the data starts
 
     native_to_little_endian (&riffhdr, ChunkHeaderFormat);
+    native_to_little_endian (&ds64hdr, ChunkHeaderFormat);
+    native_to_little_endian (&ds64, DS64ChunkFormat);
     native_to_little_endian (&fmthdr, ChunkHeaderFormat);
     native_to_little_endian (&wavhdr, WaveHeaderFormat);
     native_to_little_endian (&datahdr, ChunkHeaderFormat);
 
-    return fwrite (&riffhdr, sizeof (riffhdr), 1, outfile) &&
-        fwrite (&fmthdr, sizeof (fmthdr), 1, outfile) &&
-        fwrite (&wavhdr, wavhdrsize, 1, outfile) &&
-        fwrite (&datahdr, sizeof (datahdr), 1, outfile);
+    memcpy (header, &riffhdr, sizeof (riffhdr));
+
+    if (ds64size) {
+        memcpy (header + sizeof (riffhdr), &ds64hdr, sizeof (ds64hdr));
+        memcpy (header + sizeof (riffhdr) + sizeof (ds64hdr), &ds64, sizeof (ds64));
+    }
+
+    memcpy (header + sizeof (riffhdr) + ds64size, &fmthdr, sizeof (fmthdr));
+    memcpy (header + sizeof (riffhdr) + ds64size + sizeof (fmthdr), &wavhdr, wavhdrsize);
+    memcpy (header + sizeof (riffhdr) + ds64size + sizeof (fmthdr) + wavhdrsize, &datahdr, sizeof (datahdr));
+
+    return sizeof (riffhdr) + ds64size + sizeof (fmthdr) + wavhdrsize + sizeof (datahdr);
+}
+
+static int write_pcm_wav_header (FILE *outfile, int bps, int num_channels, uint64_t num_samples, unsigned long sample_rate, uint32_t channel_mask, int layout)
+{
+    unsigned char header [WAV_HEADER_MAX_BYTES];
+    int header_bytes = build_pcm_wav_header (header, bps, num_channels, num_samples, sample_rate, channel_mask, layout);
+
+    return fwrite (header, header_bytes, 1, outfile);
+}
+
+// Batch mode (-i): many files in one process. The jobs come from a list file (with "infile<TAB>outfile" or
+// just "infile" on each line, the output of the latter going to the output directory) or are all of the
+// .wav files in a directory, and a pool of worker threads (-j) takes them in turn. Each worker keeps the
+// streams for the last ART_BATCH_STREAMS formats it has seen and just resets one when another file has
+// the same format, and since the resampler shares its filter banks between all the instances with the
+// same parameters, the bank for each rate pair is generated only once for the whole batch.
+
+#define ART_BATCH_STREAMS       4
+#define ART_BATCH_MAX_LINE      4096
+
+typedef struct {
+    char *infilename, *outfilename;
+} BatchJob;
+
+typedef struct {
+    art_stream_t *streams [ART_BATCH_STREAMS];
+    uint32_t last_used [ART_BATCH_STREAMS], use_count;
+    uint8_t *readbuffer, *writebuffer;
+    size_t read_bytes, write_bytes;
+    uint64_t files, failures, input_frames, output_bytes, streams_created;
+    double audio_seconds;
+#ifndef ART_STREAM_NO_THREADS
+    pthread_t thread;
+#endif
+} BatchWorker;
+
+static BatchJob *batch_jobs;
+static int batch_num_jobs, batch_next_job;
+
+#ifndef ART_STREAM_NO_THREADS
+static pthread_mutex_t batch_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define BATCH_LOCK() pthread_mutex_lock (&batch_mutex)
+#define BATCH_UNLOCK() pthread_mutex_unlock (&batch_mutex)
+#else
+#define BATCH_LOCK()
+#define BATCH_UNLOCK()
+#endif
+
+static double batch_clock (void)
+{
+#if defined (CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+    return (double) clock () / CLOCKS_PER_SEC;
+#endif
+}
+
+// Return true if the two names are the same file (or obviously would be, if the second doesn't exist yet).
+
+static int same_file (const char *name1, const char *name2)
+{
+#if !defined (_WIN32)
+    struct stat info1, info2;
+
+    if (!stat (name1, &info1) && !stat (name2, &info2))
+        return info1.st_dev == info2.st_dev && info1.st_ino == info2.st_ino;
+#endif
+    return !strcmp (name1, name2);
+}
+
+static void batch_add_job (const char *infilename, const char *outfilename)
+{
+    if (!(batch_num_jobs & (batch_num_jobs - 1)))
+        batch_jobs = realloc (batch_jobs, (batch_num_jobs ? batch_num_jobs * 2 : 1) * sizeof (BatchJob));
+
+    batch_jobs [batch_num_jobs].infilename = strdup (infilename);
+    batch_jobs [batch_num_jobs++].outfilename = strdup (outfilename);
+}
+
+// Add a job for "infilename" with its output of the same name in "outdir".
+
+static int batch_add_job_to_dir (const char *infilename, const char *outdir)
+{
+    const char *basename = infilename, *cp;
+    char *outfilename;
+
+    if (!outdir) {
+        fprintf (stderr, "no output file or directory for \"%s\"!\n", infilename);
+        return 0;
+    }
+
+    for (cp = infilename; *cp; cp++)
+#if defined (_WIN32)
+        if (*cp == '/' || *cp == '\\' || *cp == ':')
+#else
+        if (*cp == '/')
+#endif
+            basename = cp + 1;
+
+    outfilename = malloc (strlen (outdir) + strlen (basename) + 2);
+    sprintf (outfilename, "%s/%s", outdir, basename);
+    batch_add_job (infilename, outfilename);
+    free (outfilename);
+    return 1;
+}
+
+static int compare_jobs (const void *a, const void *b)
+{
+    return strcmp (((const BatchJob *) a)->infilename, ((const BatchJob *) b)->infilename);
+}
+
+// Make the job list from a list file or from the .wav files in a directory (sorted by name, so that the
+// order doesn't depend on the filesystem). Returns the number of jobs, or -1 on an error.
+
+static int batch_read_jobs (const char *source, const char *outdir)
+{
+    char line [ART_BATCH_MAX_LINE];
+    FILE *list;
+#if !defined (_WIN32)
+    struct stat info;
+
+    if (!stat (source, &info) && S_ISDIR (info.st_mode)) {
+        struct dirent *entry;
+        DIR *dir;
+
+        if (!outdir) {
+            fprintf (stderr, "a directory batch needs an output directory!\n");
+            return -1;
+        }
+
+        if (same_file (source, outdir)) {
+            fprintf (stderr, "can't overwrite input files (specify a different output directory)\n");
+            return -1;
+        }
+
+        if (!(dir = opendir (source))) {
+            fprintf (stderr, "can't open directory \"%s\"!\n", source);
+            return -1;
+        }
+
+        while ((entry = readdir (dir))) {
+            size_t length = strlen (entry->d_name);
+
+            if (length > 4 && entry->d_name [length - 4] == '.' && tolower ((unsigned char) entry->d_name [length - 3]) == 'w' &&
+                tolower ((unsigned char) entry->d_name [length - 2]) == 'a' && tolower ((unsigned char) entry->d_name [length - 1]) == 'v') {
+                    char *infilename = malloc (strlen (source) + length + 2);
+
+                    sprintf (infilename, "%s/%s", source, entry->d_name);
+                    batch_add_job_to_dir (infilename, outdir);
+                    free (infilename);
+            }
+        }
+
+        closedir (dir);
+        qsort (batch_jobs, batch_num_jobs, sizeof (BatchJob), compare_jobs);
+        return batch_num_jobs;
+    }
+#endif
+
+    if (!(list = fopen (source, "r"))) {
+        fprintf (stderr, "can't open batch list \"%s\"!\n", source);
+        return -1;
+    }
+
+    // one job per line (ignoring blank lines and comments), with an optional tab and output filename
+
+    while (fgets (line, sizeof (line), list)) {
+        char *tab, *end = line + strlen (line);
+
+        while (end > line && (end [-1] == '\n' || end [-1] == '\r'))
+            *--end = 0;
+
+        if (!*line || *line == '#')
+            continue;
+
+        if ((tab = strchr (line, '\t'))) {
+            *tab++ = 0;
+            batch_add_job (line, tab);
+        }
+        else if (!batch_add_job_to_dir (line, outdir)) {
+            fclose (list);
+            return -1;
+        }
+    }
+
+    fclose (list);
+    return batch_num_jobs;
+}
+
+// Get a stream for "config" from the worker's streams, resetting a matching one or (if there's none) making
+// a new one in place of the one that's been unused the longest. Only the file's format can differ from the
+// options (which are the same for all the files).
+
+static art_stream_t *batch_get_stream (BatchWorker *worker, const art_stream_config_t *config)
+{
+    int i, oldest = 0;
+
+    for (i = 0; i < ART_BATCH_STREAMS; ++i) {
+        art_stream_t *stream = worker->streams [i];
+
+        if (stream && stream->config.sample_rate == config->sample_rate && stream->config.resample_rate == config->resample_rate &&
+            stream->config.num_channels == config->num_channels && stream->config.inbits == config->inbits &&
+            stream->config.outbits == config->outbits) {
+                worker->last_used [i] = ++worker->use_count;
+                art_stream_reset (stream);
+                return stream;
+        }
+
+        if (!stream || (worker->streams [oldest] && worker->last_used [i] < worker->last_used [oldest]))
+            oldest = i;
+    }
+
+    art_stream_destroy (worker->streams [oldest]);
+
+    if ((worker->streams [oldest] = art_stream_create (config))) {
+        worker->last_used [oldest] = ++worker->use_count;
+        worker->streams_created++;
+    }
+
+    return worker->streams [oldest];
+}
+
+// Resample one file of the batch with one of the worker's streams. Returns 0 on success and -1 on failure.
+
+static int batch_process_file (BatchWorker *worker, const BatchJob *job)
+{
+    art_stream_config_t config = process_context.config;
+    uint64_t remaining, output_frames;
+    size_t read_frame_bytes, write_frame_bytes;
+    uint32_t max_output, generated;
+    FILE *infile, *outfile;
+    art_stream_t *stream;
+    int layout, res = 0;
+    WavInfo info;
+
+    if (!strcmp (job->infilename, "-") || !strcmp (job->outfilename, "-")) {
+        fprintf (stderr, "stdin and stdout can't be used in a batch!\n");
+        return -1;
+    }
+
+    if (same_file (job->infilename, job->outfilename)) {
+        fprintf (stderr, "can't overwrite input file \"%s\"!\n", job->infilename);
+        return -1;
+    }
+
+    if (!(infile = fopen (job->infilename, "rb"))) {
+        fprintf (stderr, "can't open file \"%s\" for reading!\n", job->infilename);
+        return -1;
+    }
+
+    if (read_wav_header (infile, job->infilename, config.verbosity, &info)) {
+        fclose (infile);
+        return -1;
+    }
+
+    config.num_channels = info.num_channels;
+    config.sample_rate = info.sample_rate;
+    config.inbits = info.bits;
+
+    if (!config.resample_rate)
+        config.resample_rate = config.sample_rate;
+
+    if (!config.outbits)
+        config.outbits = config.inbits;
+
+    if (!(stream = batch_get_stream (worker, &config))) {
+        fclose (infile);
+        return -1;
+    }
+
+    // the buffers are for one block of input and its output (or the whole flush), and are only ever grown
+
+    read_frame_bytes = config.num_channels * ((config.inbits + 7) / 8);
+    write_frame_bytes = config.num_channels * ((config.outbits + 7) / 8);
+    max_output = art_stream_get_max_output (stream, stream->samples_to_append > stream->block_frames ? stream->samples_to_append : stream->block_frames);
+
+    if (worker->read_bytes < stream->block_frames * read_frame_bytes)
+        worker->readbuffer = realloc (worker->readbuffer, worker->read_bytes = stream->block_frames * read_frame_bytes);
+
+    if (worker->write_bytes < max_output * write_frame_bytes)
+        worker->writebuffer = realloc (worker->writebuffer, worker->write_bytes = max_output * write_frame_bytes);
+
+    if (!(outfile = fopen (job->outfilename, "wb"))) {
+        fprintf (stderr, "can't open file \"%s\" for writing!\n", job->outfilename);
+        fclose (infile);
+        return -1;
+    }
+
+    layout = output_header_layout (&config, info.num_samples, info.unknown_length);
+
+    if (!write_pcm_wav_header (outfile, config.outbits, config.num_channels, info.num_samples, config.resample_rate, info.channel_mask, layout))
+        res = -1;
+
+    for (remaining = info.num_samples; remaining && !res;) {
+        uint32_t frames = remaining < stream->block_frames ? remaining : stream->block_frames;
+        uint32_t frames_read = fread (worker->readbuffer, read_frame_bytes, frames, infile);
+
+        generated = art_stream_process (stream, worker->readbuffer, frames_read, worker->writebuffer);
+
+        if (generated && fwrite (worker->writebuffer, write_frame_bytes, generated, outfile) != generated)
+            res = -1;
+
+        worker->input_frames += frames_read;
+        remaining -= frames_read;
+
+        if (frames_read < frames) {
+            if (!info.unknown_length)
+                fprintf (stderr, "warning: file \"%s\" terminated early!\n", job->infilename);
+
+            break;
+        }
+    }
+
+    generated = art_stream_flush (stream, worker->writebuffer);
+
+    if (!res && generated && fwrite (worker->writebuffer, write_frame_bytes, generated, outfile) != generated)
+        res = -1;
+
+    output_frames = stream->output_samples;
+
+    if (!res && !rewrite_wav_header (outfile, &config, output_frames, info.channel_mask, layout))
+        res = -1;
+
+    if (fclose (outfile))
+        res = -1;
+
+    fclose (infile);
+
+    if (res) {
+        fprintf (stderr, "can't write to file \"%s\"!\n", job->outfilename);
+        return -1;
+    }
+
+#ifdef ART_STREAM_CLIP_CHECK
+    if (stream->quantizer && stream->quantizer->clipped)
+        fprintf (stderr, "warning: %u samples of \"%s\" were clipped, suggest reducing gain!\n", stream->quantizer->clipped, job->infilename);
+#endif
+
+    worker->audio_seconds += (double) (info.num_samples - remaining) / config.sample_rate;
+    worker->output_bytes += output_frames * write_frame_bytes;
+
+    if (config.verbosity >= 0) {
+        BATCH_LOCK();
+        fprintf (stderr, "resampled %d-channel file \"%s\" (%db/%dk) to \"%s\" (%db/%dk)\n",
+            config.num_channels, job->infilename, config.inbits, (int)((config.sample_rate + 500) / 1000),
+            job->outfilename, config.outbits, (int)((config.resample_rate + 500) / 1000));
+        BATCH_UNLOCK();
+    }
+
+    return 0;
+}
+
+static void *batch_worker (void *arg)
+{
+    BatchWorker *worker = arg;
+
+    while (1) {
+        int job;
+
+        BATCH_LOCK();
+        job = batch_next_job < batch_num_jobs ? batch_next_job++ : -1;
+        BATCH_UNLOCK();
+
+        if (job < 0)
+            break;
+
+        worker->files++;
+
+        if (batch_process_file (worker, batch_jobs + job))
+            worker->failures++;
+    }
+
+    return NULL;
+}
+
+// Run the batch from "source" (a list file or a directory) and display the aggregate throughput at the end.
+
+static int batch_process (const char *source, const char *outdir)
+{
+    int num_workers = process_context.num_threads ? process_context.num_threads : 1, i, j;
+    BatchWorker *workers, total;
+    double start_time, seconds;
+
+    if (process_context.pipelined || process_context.channel_parallel || use_mmap || process_context.bank_filename)
+        fprintf (stderr, "warning: -a, -c, -d and -m are ignored in batch mode\n");
+
+    if (batch_read_jobs (source, outdir) <= 0) {
+        if (!batch_num_jobs)
+            fprintf (stderr, "no files to process!\n");
+
+        return -1;
+    }
+
+    if (num_workers > batch_num_jobs)
+        num_workers = batch_num_jobs;
+
+    workers = calloc (num_workers, sizeof (BatchWorker));
+    start_time = batch_clock ();
+
+#ifndef ART_STREAM_NO_THREADS
+    for (i = 1; i < num_workers; ++i)
+        pthread_create (&workers [i].thread, NULL, batch_worker, workers + i);
+
+    batch_worker (workers);
+
+    for (i = 1; i < num_workers; ++i)
+        pthread_join (workers [i].thread, NULL);
+#else
+    for (i = 0; i < num_workers; ++i)
+        batch_worker (workers + i);
+#endif
+
+    seconds = batch_clock () - start_time;
+    memset (&total, 0, sizeof (total));
+
+    for (i = 0; i < num_workers; ++i) {
+        total.files += workers [i].files;
+        total.failures += workers [i].failures;
+        total.input_frames += workers [i].input_frames;
+        total.output_bytes += workers [i].output_bytes;
+        total.streams_created += workers [i].streams_created;
+        total.audio_seconds += workers [i].audio_seconds;
+
+        for (j = 0; j < ART_BATCH_STREAMS; ++j)
+            art_stream_destroy (workers [i].streams [j]);
+
+        free (workers [i].readbuffer);
+        free (workers [i].writebuffer);
+    }
+
+    if (process_context.config.verbosity >= 0) {
+        fprintf (stderr, "batch: %llu files (%llu failed) with %d workers and %llu streams, %llu frames in %.2f seconds\n",
+            (unsigned long long) total.files, (unsigned long long) total.failures, num_workers,
+            (unsigned long long) total.streams_created, (unsigned long long) total.input_frames, seconds);
+
+        if (seconds > 0.0)
+            fprintf (stderr, "throughput: %.1f seconds of audio per second (%.1f files/s), %.2f MB/s written\n",
+                total.audio_seconds / seconds, total.files / seconds, total.output_bytes / seconds / 1e6);
+    }
+
+    for (i = 0; i < batch_num_jobs; ++i) {
+        free (batch_jobs [i].infilename);
+        free (batch_jobs [i].outfilename);
+    }
+
+    free (batch_jobs);
+    free (workers);
+
+    return total.failures ? -1 : 0;
 }
 
+// The header layout for an output file (not a pipe) of the given configuration: one with room for a ds64
+// chunk if it might end up over 4 GB (with a generous allowance for the filter tail).
+
+static int output_header_layout (const art_stream_config_t *config, uint64_t num_samples, int unknown_length)
+{
+    if (unknown_length || (num_samples * ((double) config->resample_rate / config->sample_rate) + 65536.0) *
+        config->num_channels * ((config->outbits + 7) / 8) + WAV_HEADER_MAX_BYTES > WAV_RIFF_MAX_BYTES)
+            return WAV_HEADER_RIFF_JUNK;
+
+    return WAV_HEADER_RIFF;
+}
+
+// Rewrite the header of an output file at the end, with the actual frame count (and as RF64 if the data
+// turned out to need it and there's room).
+
+static int rewrite_wav_header (FILE *outfile, const art_stream_config_t *config, uint64_t num_samples, uint32_t channel_mask, int layout)
+{
+    uint64_t data_bytes = num_samples * config->num_channels * ((config->outbits + 7) / 8);
+
+    if (data_bytes + WAV_HEADER_MAX_BYTES > WAV_RIFF_MAX_BYTES) {
+        if (layout == WAV_HEADER_RIFF_JUNK)
+            layout = WAV_HEADER_RF64;
+        else
+            fprintf (stderr, "warning: output is over 4 GB but there's no room for an RF64 header!\n");
+    }
+
+    rewind (outfile);
+    return write_pcm_wav_header (outfile, config->outbits, config->num_channels, num_samples, config->resample_rate, channel_mask, layout);
+}
+
+// Memory-mapped I/O. The input file is mapped whole and the data chunk is used right where it is. The output
+// file is created at its final size (the header plus the expected frames) and mapped, and at the end its
+// header is rewritten in place (only if the frame count turned out different) and the file is trimmed.
+
+#if !defined (_WIN32)
+
+static void *in_map_base, *out_map_base;
+static size_t in_map_bytes, out_map_bytes;
+static int out_header_bytes, out_header_layout;
+static int map_input_file (const char *infilename)
+{
+    size_t data_offset = ftell (process_context.in_stream);
+    size_t data_bytes = (size_t) process_context.num_samples * process_context.config.num_channels * ((process_context.config.inbits + 7) / 8);
+    struct stat info;
+
+    if (fstat (fileno (process_context.in_stream), &info) || (size_t) info.st_size < data_offset + data_bytes) {
+        fprintf (stderr, "can't map \"%s\" (file truncated?), using regular file I/O\n", infilename);
+        return 0;
+    }
+
+    in_map_bytes = data_offset + data_bytes;
+    in_map_base = mmap (NULL, in_map_bytes, PROT_READ, MAP_PRIVATE, fileno (process_context.in_stream), 0);
+
+    if (in_map_base == MAP_FAILED) {
+        fprintf (stderr, "can't map \"%s\", using regular file I/O\n", infilename);
+        in_map_base = NULL;
+        return 0;
+    }
+
+    madvise (in_map_base, in_map_bytes, MADV_SEQUENTIAL);
+    process_context.in_map = (const uint8_t *) in_map_base + data_offset;
+    process_context.in_map_index = 0;
+    return 1;
+}
+
+static uint8_t *map_output_file (uint64_t num_frames)
+{
+    unsigned char header [WAV_HEADER_MAX_BYTES];
+    int fd = fileno (process_context.out_stream);
+    size_t data_bytes = (size_t) num_frames * process_context.config.num_channels * ((process_context.config.outbits + 7) / 8);
+
+    out_header_layout = data_bytes + WAV_HEADER_MAX_BYTES > WAV_RIFF_MAX_BYTES ? WAV_HEADER_RF64 : WAV_HEADER_RIFF;
+    out_header_bytes = build_pcm_wav_header (header, process_context.config.outbits, process_context.config.num_channels, num_frames, process_context.config.resample_rate, wav_channel_mask, out_header_layout);
+    out_map_bytes = out_header_bytes + data_bytes;
+
+    if (ftruncate (fd, out_map_bytes) || (out_map_base = mmap (NULL, out_map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        fprintf (stderr, "can't map output file, using regular file I/O\n");
+        out_map_base = NULL;
+
+        if (ftruncate (fd, 0))
+            fprintf (stderr, "can't trim output file!\n");
+
+        fwrite (header, out_header_bytes, 1, process_context.out_stream);
+        return NULL;
+    }
+
+    memcpy (out_map_base, header, out_header_bytes);
+    return (uint8_t *) out_map_base + out_header_bytes;
+}
+
+static void unmap_files (uint64_t num_frames)
+{
+    if (in_map_base)
+        munmap (in_map_base, in_map_bytes);
+
+    if (out_map_base) {
+        size_t data_bytes = (size_t) num_frames * process_context.config.num_channels * ((process_context.config.outbits + 7) / 8);
+
+        if (out_header_bytes + data_bytes != out_map_bytes)
+            build_pcm_wav_header (out_map_base, process_context.config.outbits, process_context.config.num_channels, num_frames, process_context.config.resample_rate, wav_channel_mask, out_header_layout);
+
+        munmap (out_map_base, out_map_bytes);
+
+        if (out_header_bytes + data_bytes != out_map_bytes && ftruncate (fileno (process_context.out_stream), out_header_bytes + data_bytes))
+            fprintf (stderr, "can't trim output file!\n");
+    }
+}
+
+#else
+
+static int map_input_file (const char *infilename)
+{
+    fprintf (stderr, "memory-mapped I/O is not available, using regular file I/O\n");
+    return 0;
+}
+
+static uint8_t *map_output_file (uint64_t num_frames) { return NULL; }
+static void unmap_files (uint64_t num_frames) { }
+
+#endif
+
 static void little_endian_to_native (void *data, char *format)
 {
     unsigned char *cp = (unsigned char *) data;
@@ -521,7 +1399,7 @@ static void little_endian_to_native (void *data, char *format)
     while (*format) {
         switch (*format) {
             case 'L':
-                temp = cp [0] + ((int32_t) cp [1] << 8) + ((int32_t) cp [2] << 16) + ((int32_t) cp [3] << 24);
+                temp = (int32_t) (cp [0] + ((uint32_t) cp [1] << 8) + ((uint32_t) cp [2] << 16) + ((uint32_t) cp [3] << 24));
                 * (int32_t *) cp = temp;
                 cp += 4;
                 break;
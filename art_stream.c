@@ -14,398 +14,1404 @@
 #include <math.h>
 
 #include "resampler.h"
+#include "halfband.h"
 #include "biquad.h"
+#include "formats.h"
 
 #include "art_stream.h"
 
+#include <time.h>
+
+#ifndef ART_STREAM_NO_THREADS
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sched.h>
+#endif
+
 extern process_context_t process_context;
 
-// Return a tpdf random value in the range: -1.0 <= n < 1.0
-// type: -1: negative intersample correlation (HF boost)
-//        0: no correlation (independent samples, flat spectrum)
-//        1: positive intersample correlation (LF boost)
-// Note: not thread-safe on the same channel
+// The stage timing (see art_stage_stats_t). ART_STATS_START() declares the start time and ART_STATS_STOP()
+// records the block's time in the given stage's statistics; both disappear with ART_STREAM_NO_STATS.
 
-static uint32_t *tpdf_generators;
+#ifndef ART_STREAM_NO_STATS
 
-static void tpdf_dither_init (int num_channels)
+static uint64_t art_stats_clock (void)
 {
-    int generator_bytes = num_channels * sizeof (uint32_t);
-    unsigned char *seed = malloc (generator_bytes);
-    uint32_t random = 0x31415926;
+#if defined (CLOCK_MONOTONIC)
+	struct timespec ts;
 
-    tpdf_generators = (uint32_t *) seed;
-
-    while (generator_bytes--) {
-        *seed++ = random >> 24;
-        random = ((random << 4) - random) ^ 1;
-        random = ((random << 4) - random) ^ 1;
-        random = ((random << 4) - random) ^ 1;
-    }
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+	return (uint64_t) clock () * (1000000000 / CLOCKS_PER_SEC);
+#endif
 }
 
-static inline double tpdf_dither (int channel, int type)
+static void art_stats_record (art_stage_stats_t *stats, uint64_t start, uint32_t frames)
 {
-    uint32_t random = tpdf_generators [channel];
-    random = ((random << 4) - random) ^ 1;
-    random = ((random << 4) - random) ^ 1;
-    uint32_t first = type ? tpdf_generators [channel] ^ ((int32_t) type >> 31) : ~random;
-    random = ((random << 4) - random) ^ 1;
-    random = ((random << 4) - random) ^ 1;
-    random = ((random << 4) - random) ^ 1;
-    tpdf_generators [channel] = random;
-    return (((first >> 1) + (random >> 1)) / 2147483648.0) - 1.0;
-}
+	uint64_t ns = art_stats_clock () - start, us = ns / 1000;
+	int bucket = 0;
 
-static void tpdf_dither_free (void)
-{
-    free (tpdf_generators);
+	while (us && bucket < ART_STREAM_STATS_BUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+
+	if (!stats->blocks || ns < stats->min_ns)
+		stats->min_ns = ns;
+
+	if (ns > stats->max_ns)
+		stats->max_ns = ns;
+
+	stats->blocks++;
+	stats->frames += frames;
+	stats->total_ns += ns;
+	stats->histogram [bucket]++;
 }
 
+#define ART_STATS_START(start) uint64_t start = art_stats_clock ()
+#define ART_STATS_STOP(stats,start,frames) art_stats_record ((stats), (start), (frames))
+
+#else
+
+#define ART_STATS_START(start)
+#define ART_STATS_STOP(stats,start,frames)
+
+#endif
+
+// With memory-mapped I/O (-m) these just copy from the mapped data chunk (which holds all of the input)
+// and into the mapped output, which is sized for out_map_frames; anything beyond that is dropped.
+
 static size_t fread_stream(void * buffer, size_t size, size_t count)
 {
-	return fread(buffer,size,count,process_context.in_stream);
+	ART_STATS_START (start);
+
+	if (process_context.in_map) {
+		memcpy (buffer, process_context.in_map + process_context.in_map_index, size * count);
+		process_context.in_map_index += size * count;
+	}
+	else
+		count = fread(buffer,size,count,process_context.in_stream);
+
+	ART_STATS_STOP (&process_context.stream->stats [ART_STAGE_READ], start, count);
+	return count;
 }
 
 static size_t fwrite_stream(void * buffer, size_t size, size_t count)
 {
-	return fwrite(buffer,size,count,process_context.out_stream);
+	ART_STATS_START (start);
+
+	if (process_context.out_map) {
+		size_t limit = (size_t) process_context.out_map_frames * size - process_context.out_map_index;
+
+		if (size * count > limit) {
+			fprintf (stderr, "warning: output overflows mapped file, truncating!\n");
+			count = limit / size;
+		}
+
+		memcpy (process_context.out_map + process_context.out_map_index, buffer, size * count);
+		process_context.out_map_index += size * count;
+	}
+	else
+		count = fwrite(buffer,size,count,process_context.out_stream);
+
+	ART_STATS_STOP (&process_context.stream->stats [ART_STAGE_WRITE], start, count);
+	return count;
 }
 
-uint16_t art_resample_init()
+// For ratios beyond 2x either way, use a cascade of half-band stages (plus a short fractional stage) if
+// the planner thinks it's cheaper. Otherwise, if the two sample rates reduce to a manageable fraction, use
+// the exact polyphase resampler (one filter per phase, no interpolation), or the general-purpose
+// interpolating one. A cascade leaves the returned resampler NULL (and stream->cascade set).
+
+#define ART_STREAM_MAX_RATIONAL_FILTERS 1024
+
+static Resample *art_resampler_create (art_stream_t *stream, double lowpass_ratio, int flags)
 {
-	process_context.interpolate = 1;
+	const art_stream_config_t *config = &stream->config;
+	uint32_t a = config->resample_rate, b = config->sample_rate;
+
+	stream->resampler_lowpass = lowpass_ratio;     // so the worker threads can make identical ones
+	stream->resampler_flags = flags;
+
+	if (stream->sample_ratio < 0.5 || stream->sample_ratio > 2.0) {
+		ResampleCascade *cascade = resampleCascadeInit (config->num_channels, stream->sample_ratio,
+			config->num_taps, config->num_filters, lowpass_ratio, flags);
+
+		if (cascade && cascade->numStages) {
+			if (config->verbosity > 0)
+				fprintf (stderr, "using %d half-band stages (estimated cost %.1f vs %.1f MACs per output)\n",
+					cascade->numStages, cascade->cascadeCost, cascade->singleStageCost);
 
-	process_context.verbosity=1;
+			stream->cascade = cascade;
+			return NULL;
+		}
 
-	process_context.BUFFER_SAMPLES = 441;
+		if (cascade)
+			resampleCascadeFree (cascade);
+	}
 
-	process_context.num_channels=ART_STREAM_NUM_CHANNELS;
-	process_context.outbits=16;
-	process_context.inbits=16;
+	while (b) {
+		uint32_t t = a % b;
+		a = b;
+		b = t;
+	}
 
+	if (a && config->resample_rate / a <= ART_STREAM_MAX_RATIONAL_FILTERS) {
+		int up = config->resample_rate / a, down = config->sample_rate / a;
 
-	process_context.num_taps=4;
-	process_context.num_filters=2;
-	process_context.gain=1.0;
+		if (config->verbosity > 0)
+			fprintf (stderr, "using exact %d/%d polyphase filters\n", up, down);
 
-	process_context.sample_ratio = (double) process_context.resample_rate / (double)process_context.sample_rate;
-	process_context.lowpass_ratio = 1.0;
+		return resampleInitRational (config->num_channels, config->num_taps, up, down, lowpass_ratio, flags);
+	}
 
-	process_context.outbuffer_samples = (int) floor (process_context.BUFFER_SAMPLES * process_context.sample_ratio * 1.1 + 100.0);
-	process_context.remaining_samples = process_context.num_samples;
-	process_context.output_samples = 0;
-#ifdef ART_STREAM_CLIP_CHECK
-	process_context.clipped_samples = 0;
-#endif
+	return resampleInit (config->num_channels, config->num_taps, config->num_filters, lowpass_ratio, flags);
+}
+
+// This takes care of the filter delay and any user-specified phase shift (on a new or reset resampler).
+
+static void art_stream_position (art_stream_t *stream)
+{
+    if (stream->cascade) {
+        resampleCascadeAdvancePosition (stream->cascade, resampleCascadeGetDelay (stream->cascade) + stream->config.phase_shift);
+        stream->samples_to_append = resampleCascadeGetLatency (stream->cascade);
+    }
+    else {
+        resampleAdvancePosition (stream->resampler, resampleGetGroupDelay (stream->resampler) + stream->config.phase_shift);
+        stream->samples_to_append = (int) ceil (resampleGetGroupDelay (stream->resampler));
+    }
+}
 
-	process_context.outbuffer = malloc (process_context.outbuffer_samples * process_context.num_channels * sizeof (float));
-	process_context.inbuffer = malloc (process_context.BUFFER_SAMPLES * process_context.num_channels * sizeof (float));
+// Create a stream for the given configuration (which is copied). This designs the lowpass and the filters
+// and positions the resampler for the filter delay and phase shift, so the first output frame lines up
+// with the first input frame. Returns NULL (after displaying why) if the configuration is invalid.
 
-	process_context.flags = process_context.interpolate ? SUBSAMPLE_INTERPOLATE : 0;
-    process_context.samples_to_append = process_context.num_taps / 2;
+art_stream_t *art_stream_create (const art_stream_config_t *config)
+{
+    art_stream_t *stream;
+
+    if (!config->num_channels || !config->sample_rate || !config->resample_rate ||
+        ((config->inbits < 4 || config->inbits > 24) && config->inbits != 32) ||
+        ((config->outbits < 4 || config->outbits > 24) && config->outbits != 32)) {
+            fprintf (stderr, "art_stream_create(): invalid stream configuration!\n");
+            return NULL;
+    }
 
-    process_context.pre_filter = 0;
-    process_context.post_filter = 0;
+    stream = calloc (1, sizeof (art_stream_t));
+    stream->config = *config;
+    config = &stream->config;
 
-    process_context.readbuffer = process_context.inbuffer;
+    stream->block_frames = config->block_frames ? config->block_frames : 441;
+    stream->sample_ratio = (double) config->resample_rate / (double) config->sample_rate;
+    stream->lowpass_ratio = 1.0;
 
-    if (process_context.sample_ratio < 1.0) {
-    	process_context.lowpass_ratio -= (10.24 / process_context.num_taps);
+    stream->outbuffer_samples = (int) floor (stream->block_frames * stream->sample_ratio * 1.1 + 100.0);
+    stream->outbuffer = malloc (stream->outbuffer_samples * config->num_channels * sizeof (float));
+    stream->inbuffer = malloc (stream->block_frames * config->num_channels * sizeof (float));
 
-        if (process_context.lowpass_ratio < 0.84)           // limit the lowpass for very short filters
-        	process_context.lowpass_ratio = 0.84;
+    stream->flags = config->interpolate ? SUBSAMPLE_INTERPOLATE : 0;
+    stream->in_format = format_from_bits (config->inbits);
+    stream->out_format = format_from_bits (config->outbits);
 
-        if (process_context.lowpass_ratio < process_context.sample_ratio)   // avoid discontinuities near unity sample ratios
-        	process_context.lowpass_ratio = process_context.sample_ratio;
+    if (stream->sample_ratio < 1.0) {
+        stream->lowpass_ratio -= (10.24 / config->num_taps);
+
+        if (stream->lowpass_ratio < 0.84)           // limit the lowpass for very short filters
+            stream->lowpass_ratio = 0.84;
+
+        if (stream->lowpass_ratio < stream->sample_ratio)   // avoid discontinuities near unity sample ratios
+            stream->lowpass_ratio = stream->sample_ratio;
     }
 
-    fprintf (stderr, "sample_ratio: %0.6f, (resample_rate %d / sample_rate %d)\n",process_context.sample_ratio, process_context.resample_rate, process_context.sample_rate);
+    if (config->verbosity > 0)
+        fprintf (stderr, "sample_ratio: %0.6f, (resample_rate %d / sample_rate %d)\n", stream->sample_ratio, config->resample_rate, config->sample_rate);
 
-    if (process_context.lowpass_freq) {
+    if (config->lowpass_freq) {
         double user_lowpass_ratio;
 
-        if (process_context.sample_ratio < 1.0)
-            user_lowpass_ratio = process_context.lowpass_freq / (process_context.resample_rate / 2.0);
+        if (stream->sample_ratio < 1.0)
+            user_lowpass_ratio = config->lowpass_freq / (config->resample_rate / 2.0);
         else
-            user_lowpass_ratio = process_context.lowpass_freq / (process_context.sample_rate / 2.0);
+            user_lowpass_ratio = config->lowpass_freq / (config->sample_rate / 2.0);
 
         if (user_lowpass_ratio >= 1.0)
             fprintf (stderr, "warning: ignoring invalid lowpass frequency specification (at or over Nyquist)\n");
         else
-        	process_context.lowpass_ratio = user_lowpass_ratio;
+            stream->lowpass_ratio = user_lowpass_ratio;
     }
 
-    if (process_context.bh4_window || !process_context.hann_window)
-    	process_context.flags |= BLACKMAN_HARRIS;
+    if (config->bh4_window || !config->hann_window)
+        stream->flags |= BLACKMAN_HARRIS;
+
+    if (config->minimum_phase)
+        stream->flags |= MINIMUM_PHASE;
 
-    if (process_context.lowpass_ratio * process_context.sample_ratio < 0.98 && process_context.pre_post_filter) {
-        double cutoff = process_context.lowpass_ratio * process_context.sample_ratio / 2.0;
-        biquad_lowpass (&process_context.lowpass_coeff, cutoff);
-        process_context.pre_filter = 1;
+    if (config->lazy_filters)
+        stream->flags |= LAZY_FILTERS;
 
-        if (process_context.verbosity > 0)
-            fprintf (stderr, "cascaded biquad pre-filter at %g Hz\n", process_context.sample_rate * cutoff);
+    if (stream->lowpass_ratio * stream->sample_ratio < 0.98 && config->pre_post_filter) {
+        double cutoff = stream->lowpass_ratio * stream->sample_ratio / 2.0;
+        biquad_lowpass (&stream->lowpass_coeff, cutoff);
+        stream->pre_filter = 1;
+
+        if (config->verbosity > 0)
+            fprintf (stderr, "cascaded biquad pre-filter at %g Hz\n", config->sample_rate * cutoff);
     }
 
-    if (process_context.sample_ratio < 1.0) {
-    	process_context.resampler = resampleInit (process_context.num_channels, process_context.num_taps, process_context.num_filters, process_context.sample_ratio * process_context.lowpass_ratio, process_context.flags | INCLUDE_LOWPASS);
+    if (stream->sample_ratio < 1.0) {
+        stream->resampler = art_resampler_create (stream, stream->sample_ratio * stream->lowpass_ratio, stream->flags | INCLUDE_LOWPASS);
 
-        if (process_context.verbosity > 0)
-            fprintf (stderr, "%d-tap sinc downsampler with lowpass at %g Hz\n", process_context.num_taps, process_context.sample_ratio * process_context.lowpass_ratio * process_context.sample_rate / 2.0);
+        if (config->verbosity > 0)
+            fprintf (stderr, "%d-tap sinc downsampler with lowpass at %g Hz\n", config->num_taps, stream->sample_ratio * stream->lowpass_ratio * config->sample_rate / 2.0);
     }
-    else if (process_context.lowpass_ratio < 1.0) {
-    	process_context.resampler = resampleInit (process_context.num_channels, process_context.num_taps, process_context.num_filters, process_context.lowpass_ratio, process_context.flags | INCLUDE_LOWPASS);
+    else if (stream->lowpass_ratio < 1.0) {
+        stream->resampler = art_resampler_create (stream, stream->lowpass_ratio, stream->flags | INCLUDE_LOWPASS);
 
-        if (process_context.verbosity > 0)
-            fprintf (stderr, "%d-tap sinc resampler with lowpass at %g Hz\n", process_context.num_taps, process_context.lowpass_ratio * process_context.sample_rate / 2.0);
+        if (config->verbosity > 0)
+            fprintf (stderr, "%d-tap sinc resampler with lowpass at %g Hz\n", config->num_taps, stream->lowpass_ratio * config->sample_rate / 2.0);
     }
     else {
-    	process_context.resampler = resampleInit (process_context.num_channels, process_context.num_taps, process_context.num_filters, 1.0, process_context.flags);
+        stream->resampler = art_resampler_create (stream, 1.0, stream->flags);
+
+        if (config->verbosity > 0)
+            fprintf (stderr, "%d-tap pure sinc resampler (no lowpass), %g Hz Nyquist\n", config->num_taps, config->sample_rate / 2.0);
+    }
 
-        if (process_context.verbosity > 0)
-            fprintf (stderr, "%d-tap pure sinc resampler (no lowpass), %g Hz Nyquist\n", process_context.num_taps, process_context.sample_rate / 2.0);
+    if (!stream->resampler && !stream->cascade) {
+        fprintf (stderr, "art_stream_create(): can't initialize resampler!\n");
+        art_stream_destroy (stream);
+        return NULL;
     }
 
-    if (process_context.lowpass_ratio / process_context.sample_ratio < 0.98 && process_context.pre_post_filter && !process_context.pre_filter) {
-        double cutoff = process_context.lowpass_ratio / process_context.sample_ratio / 2.0;
-        biquad_lowpass (&process_context.lowpass_coeff, cutoff);
-        process_context.post_filter = 1;
+    if (stream->lowpass_ratio / stream->sample_ratio < 0.98 && config->pre_post_filter && !stream->pre_filter) {
+        double cutoff = stream->lowpass_ratio / stream->sample_ratio / 2.0;
+        biquad_lowpass (&stream->lowpass_coeff, cutoff);
+        stream->post_filter = 1;
 
-        if (process_context.verbosity > 0)
-            fprintf (stderr, "cascaded biquad post-filter at %g Hz\n", process_context.resample_rate * cutoff);
+        if (config->verbosity > 0)
+            fprintf (stderr, "cascaded biquad post-filter at %g Hz\n", config->resample_rate * cutoff);
     }
 
-    if (process_context.pre_filter || process_context.post_filter)
-        for (int i = 0; i < process_context.num_channels; ++i) {
-            biquad_init (&process_context.lowpass [i] [0], &process_context.lowpass_coeff, 1.0);
-            biquad_init (&process_context.lowpass [i] [1], &process_context.lowpass_coeff, 1.0);
-        }
+    if (stream->pre_filter || stream->post_filter) {
+        BiquadCoefficients stages [2] = { stream->lowpass_coeff, stream->lowpass_coeff };
+        stream->lowpass = biquad_cascade_init (stages, 2, config->num_channels, ART_STREAM_BIQUAD_FORM, 1.0);
+    }
+
+    if (config->outbits != 32)
+        stream->quantizer = format_quantizer_init (config->num_channels, config->outbits, FORMAT_DITHER | FORMAT_NOISE_SHAPING);
+
+    art_stream_position (stream);
+
+    if (config->minimum_phase && config->verbosity > 0)
+        fprintf (stderr, "minimum-phase filters, group delay %.2f input frames\n",
+            stream->cascade ? resampleCascadeGetDelay (stream->cascade) : resampleGetGroupDelay (stream->resampler));
+
+    return stream;
+}
+
+// Return a stream to its just-created state, for another piece of audio with the same configuration. The
+// filters (and buffers) are kept, so this is much cheaper than a new stream; only the stage statistics
+// carry on accumulating.
+
+void art_stream_reset (art_stream_t *stream)
+{
+    if (stream->cascade)
+        resampleCascadeReset (stream->cascade);
+    else
+        resampleReset (stream->resampler);
 
-    if (process_context.outbits != 32) {
-        memset (process_context.error, 0, sizeof (process_context.error));
-        tpdf_dither_init (process_context.num_channels);
+    if (stream->lowpass)
+        biquad_cascade_reset (stream->lowpass);
+
+    if (stream->quantizer)
+        format_quantizer_reset (stream->quantizer);
+
+    stream->output_samples = 0;
+    art_stream_position (stream);
+}
+
+// Add the stage statistics in "source" (e.g., of a worker thread) to those in "dest".
+
+static void art_stats_merge (art_stage_stats_t *dest, const art_stage_stats_t *source)
+{
+    for (int i = 0; i < ART_STREAM_NUM_STAGES; ++i) {
+        if (!source [i].blocks)
+            continue;
+
+        if (!dest [i].blocks || source [i].min_ns < dest [i].min_ns)
+            dest [i].min_ns = source [i].min_ns;
+
+        if (source [i].max_ns > dest [i].max_ns)
+            dest [i].max_ns = source [i].max_ns;
+
+        dest [i].blocks += source [i].blocks;
+        dest [i].frames += source [i].frames;
+        dest [i].total_ns += source [i].total_ns;
+
+        for (int j = 0; j < ART_STREAM_STATS_BUCKETS; ++j)
+            dest [i].histogram [j] += source [i].histogram [j];
     }
+}
 
-    if (process_context.inbits != 32 || process_context.outbits != 32) {
-        int max_samples = process_context.BUFFER_SAMPLES, max_bytes = 2;
+// Display the stage statistics, the resampler's counters and the number of clipped samples.
 
-        if (process_context.outbuffer_samples > process_context.BUFFER_SAMPLES)
-            max_samples = process_context.outbuffer_samples;
+void art_stream_print_stats (art_stream_t *stream, FILE *file)
+{
+    Resample *resampler = stream->cascade ? stream->cascade->resampler : stream->resampler;
+    ResampleStats rstats;
+
+#ifndef ART_STREAM_NO_STATS
+    static const char *stage_names [ART_STREAM_NUM_STAGES] = { "read", "convert", "pre-filter", "resample", "post-filter", "dither/pack", "write" };
+
+    fprintf (file, "stage         blocks       frames    total ms   min us    avg us    max us\n");
+
+    for (int i = 0; i < ART_STREAM_NUM_STAGES; ++i) {
+        const art_stage_stats_t *stats = stream->stats + i;
+        int last = 0;
+
+        if (!stats->blocks)
+            continue;
+
+        fprintf (file, "%-11s %8llu %12llu %11.3f %8.1f %9.1f %9.1f\n", stage_names [i], (unsigned long long) stats->blocks,
+            (unsigned long long) stats->frames, stats->total_ns / 1e6, stats->min_ns / 1e3,
+            stats->total_ns / 1e3 / stats->blocks, stats->max_ns / 1e3);
 
-        if (process_context.inbits > 16 || process_context.outbits > 16)
-            max_bytes = 3;
+        for (int j = 0; j < ART_STREAM_STATS_BUCKETS; ++j)
+            if (stats->histogram [j])
+                last = j;
 
-        process_context.tmpbuffer = malloc (max_samples * process_context.num_channels * max_bytes);
+        fprintf (file, "            us:");
 
-        if (process_context.inbits != 32)
-        	process_context.readbuffer = process_context.tmpbuffer;
+        for (int j = 0; j <= last; ++j)
+            if (j == 0)
+                fprintf (file, " <1:%u", stats->histogram [j]);
+            else
+                fprintf (file, " %s%lu:%u", j == ART_STREAM_STATS_BUCKETS - 1 ? ">=" : "<", 1UL << j, stats->histogram [j]);
+
+        fprintf (file, "\n");
     }
+#endif
 
-    // this takes care of the filter delay and any user-specified phase shift
-    resampleAdvancePosition (process_context.resampler, process_context.num_taps / 2.0 + process_context.phase_shift);
+    if (resampler && resampleGetStats (resampler, &rstats)) {
+        rstats.processCalls += stream->worker_stats.processCalls;
+        rstats.inputFrames += stream->worker_stats.inputFrames;
+        rstats.outputFrames += stream->worker_stats.outputFrames;
+        rstats.historyShifts += stream->worker_stats.historyShifts;
+        rstats.passthroughOutputs += stream->worker_stats.passthroughOutputs;
+        rstats.exactPhaseOutputs += stream->worker_stats.exactPhaseOutputs;
+        rstats.nearestOutputs += stream->worker_stats.nearestOutputs;
+        rstats.interpolatedOutputs += stream->worker_stats.interpolatedOutputs;
+        rstats.lazyFilters += stream->worker_stats.lazyFilters;
+
+        fprintf (file, "resampler: %llu calls, %llu frames in, %llu frames out, %llu history shifts\n",
+            (unsigned long long) rstats.processCalls, (unsigned long long) rstats.inputFrames,
+            (unsigned long long) rstats.outputFrames, (unsigned long long) rstats.historyShifts);
+        fprintf (file, "resampler outputs: %llu passthrough, %llu exact phase, %llu nearest, %llu interpolated\n",
+            (unsigned long long) rstats.passthroughOutputs, (unsigned long long) rstats.exactPhaseOutputs,
+            (unsigned long long) rstats.nearestOutputs, (unsigned long long) rstats.interpolatedOutputs);
+
+        if (rstats.lazyFilters)
+            fprintf (file, "resampler filters: %llu of %d generated on demand\n",
+                (unsigned long long) rstats.lazyFilters, resampler->numStoredFilters);
+    }
+
+    if (stream->quantizer)
+        fprintf (file, "clipped samples: %u\n", stream->quantizer->clipped);
+}
+
+void art_stream_destroy (art_stream_t *stream)
+{
+    if (!stream)
+        return;
+
+    if (stream->cascade)
+        resampleCascadeFree (stream->cascade);
+    else if (stream->resampler)
+        resampleFree (stream->resampler);
+
+    format_quantizer_free (stream->quantizer);
+    biquad_cascade_free (stream->lowpass);
+    free (stream->inbuffer);
+    free (stream->outbuffer);
+    free (stream);
+}
+
+// Convert "frames" of raw input (in the stream's format) to 32-bit floats and apply the gain. For float
+// input the source may be the destination (it's read right into the float buffer).
+
+static void art_convert_input (art_stream_t *stream, const uint8_t *source, float *dest, uint32_t frames)
+{
+	ART_STATS_START (start);
+	format_unpack (source, dest, frames * stream->config.num_channels, stream->in_format, stream->config.gain);
+	ART_STATS_STOP (&stream->stats [ART_STAGE_CONVERT], start, frames);
+}
+
+// Convert "frames" of float output to the stream's integer format (with dither and noise shaping).
+// The dither generators and error feedback run sequentially per channel, so this must be called on the
+// output in order. There's nothing to do for 32-bit float output.
+
+static void art_convert_output (art_stream_t *stream, float *source, uint8_t *dest, uint32_t frames)
+{
+	if (stream->quantizer) {
+		ART_STATS_START (start);
+		format_quantize_pack (stream->quantizer, source, dest, frames, stream->out_format);
+		ART_STATS_STOP (&stream->stats [ART_STAGE_PACK], start, frames);
+	}
+}
+
+// Apply the cascaded biquads to "frames" of an interleaved buffer holding num_channels of the stream's
+// channels, starting at first_channel (so the channel-parallel workers can filter just their own). The
+// time is recorded in "stats" (the pre- or post-filter stage of the stream or worker).
+
+static void art_apply_lowpass (art_stream_t *stream, art_stage_stats_t *stats, float *buffer, uint32_t frames, int first_channel, int num_channels)
+{
+	ART_STATS_START (start);
+	biquad_cascade_apply (stream->lowpass, buffer, frames, first_channel, num_channels);
+	ART_STATS_STOP (stats, start, frames);
+}
+
+// Resample a block of (already converted and pre-filtered) float input and apply the post-filter.
+
+static uint32_t art_resample_floats (art_stream_t *stream, const float *input, uint32_t frames, float *output, uint32_t max_output)
+{
+	ResampleResult res;
+	ART_STATS_START (start);
+
+	if (stream->cascade)
+		res = resampleCascadeProcessInterleaved (stream->cascade, input, frames, output, max_output);
+	else
+		res = resampleProcessInterleaved (stream->resampler, input, frames, output, max_output, stream->sample_ratio);
+
+	ART_STATS_STOP (&stream->stats [ART_STAGE_RESAMPLE], start, frames);
+
+	if (stream->post_filter)
+		art_apply_lowpass (stream, &stream->stats [ART_STAGE_POST_FILTER], output, res.output_generated, 0, stream->config.num_channels);
+
+	return res.output_generated;
+}
+
+// The output stage for the resampler's writer (see art_resample_block()): the post-filter, then dither
+// and packing (or just copying the floats) straight to the destination, on each run of frames as it's
+// generated.
+
+typedef struct {
+	art_stream_t *stream;
+	uint8_t *dest;
+	int write_bytes;
+} art_writer_t;
+
+static void art_output_writer (void *context, float *frames, int num_frames)
+{
+	art_writer_t *writer = context;
+	art_stream_t *stream = writer->stream;
+
+	if (stream->post_filter)
+		biquad_cascade_apply (stream->lowpass, frames, num_frames, 0, stream->config.num_channels);
+
+	if (stream->quantizer)
+		format_quantize_pack (stream->quantizer, frames, writer->dest, num_frames, stream->out_format);
+	else
+		memcpy (writer->dest, frames, num_frames * writer->write_bytes);
+
+	writer->dest += num_frames * writer->write_bytes;
+}
+
+// Resample a block of (already converted and pre-filtered) float input into the stream's output format
+// at "dest". With a single resampler the stages after it are fused in as it generates the output (so the
+// post-filter and packing times are part of the resample stage), and otherwise the output goes through
+// the float buffer.
+
+static uint32_t art_resample_block (art_stream_t *stream, const float *input, uint32_t frames, uint8_t *dest, uint32_t max_output)
+{
+	art_writer_t writer = { stream, dest, stream->config.num_channels * ((stream->config.outbits + 7) / 8) };
+	uint32_t generated;
+
+	if (stream->cascade) {
+		generated = art_resample_floats (stream, input, frames, stream->outbuffer, max_output);
+
+		if (stream->quantizer)
+			art_convert_output (stream, stream->outbuffer, dest, generated);
+		else
+			memcpy (dest, stream->outbuffer, generated * writer.write_bytes);
+	}
+	else {
+		ART_STATS_START (start);
+		generated = resampleProcessInterleavedWriter (stream->resampler, input, frames, art_output_writer, &writer,
+			max_output, stream->sample_ratio).output_generated;
+		ART_STATS_STOP (&stream->stats [ART_STAGE_RESAMPLE], start, frames);
+	}
+
+	return generated;
+}
+
+// The most output frames that the given number of input frames could generate (in one call to
+// art_stream_process(), or with art_stream_flush() for the frames still to be appended).
+
+uint32_t art_stream_get_max_output (art_stream_t *stream, uint32_t input_frames)
+{
+    return (input_frames + stream->block_frames - 1) / stream->block_frames * stream->outbuffer_samples;
+}
+
+// Process "input_frames" of raw interleaved input (or silence, if input is NULL) into the output buffer,
+// which must have room for art_stream_get_max_output() frames. The input is taken a block at a time, and
+// the number of output frames generated is returned.
+
+uint32_t art_stream_process (art_stream_t *stream, const void *input, uint32_t input_frames, void *output)
+{
+    const art_stream_config_t *config = &stream->config;
+    int read_bytes = config->num_channels * ((config->inbits + 7) / 8);
+    int write_bytes = config->num_channels * ((config->outbits + 7) / 8);
+    const uint8_t *source = input;
+    uint8_t *dest = output;
+    uint32_t output_frames = 0;
+
+    while (input_frames) {
+        uint32_t frames = input_frames < stream->block_frames ? input_frames : stream->block_frames, generated;
+
+        if (source) {
+            art_convert_input (stream, source, stream->inbuffer, frames);
+            source += frames * read_bytes;
+        }
+        else
+            memset (stream->inbuffer, 0, frames * config->num_channels * sizeof (float));
+
+        if (stream->pre_filter)
+            art_apply_lowpass (stream, &stream->stats [ART_STAGE_PRE_FILTER], stream->inbuffer, frames, 0, config->num_channels);
+
+        generated = art_resample_block (stream, stream->inbuffer, frames, dest, stream->outbuffer_samples);
+        dest += generated * write_bytes;
+        output_frames += generated;
+        input_frames -= frames;
+    }
+
+    stream->output_samples += output_frames;
+    return output_frames;
+}
+
+// At the end of the input, feed the stream the silence that brings the tail of the audio (still in the
+// filter delay) out. Returns the number of output frames generated (and zero if called again).
+
+uint32_t art_stream_flush (art_stream_t *stream, void *output)
+{
+    uint32_t frames = stream->samples_to_append;
+
+    stream->samples_to_append = 0;
+    return art_stream_process (stream, NULL, frames, output);
+}
+
+// The rest is the ART tool's processing of its one stream (process_context.stream), which besides the
+// straightforward block-at-a-time path has memory-mapped, multithreaded and pipelined variations.
+
+uint16_t art_resample_init()
+{
+    art_stream_t *stream = process_context.stream = art_stream_create (&process_context.config);
+    uint32_t max_output;
+
+    if (!stream)
+        return 1;
+
+    process_context.remaining_samples = process_context.num_samples;
+    process_context.samples_to_append = stream->samples_to_append;
+    process_context.output_samples = 0;
+
+    // integer input is read into its own buffer, float input right into the stream's float buffer
+
+    if (process_context.config.inbits != 32)
+        process_context.readbuffer = malloc (stream->block_frames * process_context.config.num_channels * ((process_context.config.inbits + 7) / 8));
+    else
+        process_context.readbuffer = stream->inbuffer;
+
+    max_output = art_stream_get_max_output (stream, stream->samples_to_append);
+
+    if (max_output < stream->outbuffer_samples)
+        max_output = stream->outbuffer_samples;
+
+    process_context.tmpbuffer = malloc (max_output * process_context.config.num_channels * ((process_context.config.outbits + 7) / 8));
 
     return 0;
 }
 
-uint16_t art_resample_deinit()
+uint64_t art_resample_deinit()
 {
-    resampleFree (process_context.resampler);
-    tpdf_dither_free ();
-    free (process_context.inbuffer);
-    free (process_context.outbuffer);
+    if (process_context.config.inbits != 32)
+        free (process_context.readbuffer);
+
     free (process_context.tmpbuffer);
+    process_context.readbuffer = process_context.tmpbuffer = NULL;
 
 #ifdef ART_STREAM_CLIP_CHECK
-    if (process_context.clipped_samples)
-        fprintf (stderr, "warning: %u samples were clipped, suggest reducing gain!\n", process_context.clipped_samples);
+    if (process_context.stream->quantizer && process_context.stream->quantizer->clipped)
+        fprintf (stderr, "warning: %u samples were clipped, suggest reducing gain!\n", process_context.stream->quantizer->clipped);
 #endif
 
-    if (process_context.remaining_samples)
+    if (process_context.config.verbosity > 0) {
+        fprintf (stderr, "\n");       // after the progress display
+        art_stream_print_stats (process_context.stream, stderr);
+    }
+
+    art_stream_destroy (process_context.stream);
+    process_context.stream = NULL;
+
+    if (process_context.remaining_samples && !process_context.unknown_length)
         fprintf (stderr, "warning: file terminated early!\n");
 
     return process_context.output_samples;
 }
 
-uint16_t art_resample_process_block (uint32_t stream_samples_read)
+static void art_write_output (float *source, uint8_t *dest, uint32_t frames)
 {
-    ResampleResult res;
-	if (process_context.inbits <= 8) {
-		float gain_factor = process_context.gain / 128.0;
-		int i;
+	int stream_write_size = process_context.config.num_channels * ((process_context.config.outbits + 7) / 8);
 
-		for (i = 0; i < stream_samples_read * process_context.num_channels; ++i)
-			process_context.inbuffer [i] = ((int) process_context.tmpbuffer [i] - 128) * gain_factor;
+	art_convert_output (process_context.stream, source, dest, frames);
+	fwrite_stream (process_context.config.outbits == 32 ? (void *) source : (void *) dest, stream_write_size, frames);
+	process_context.output_samples += frames;
+}
+
+// Read up to "max_frames" of raw input from the file.
+
+static uint32_t art_read_file (void *buffer, uint32_t max_frames)
+{
+	int stream_read_size = process_context.config.num_channels * ((process_context.config.inbits + 7) / 8);
+	uint32_t frames = process_context.remaining_samples < max_frames ? (uint32_t) process_context.remaining_samples : max_frames;
+	uint32_t requested = frames;
+
+	frames = fread_stream (buffer, stream_read_size, frames);
+	process_context.remaining_samples -= frames;
+
+	if (frames < requested && process_context.unknown_length)
+		process_context.remaining_samples = 0;      // that was the end of the stream
+
+	return frames;
+}
+
+// Read up to "max_frames" of raw input, and once the file is exhausted, the frames of silence that flush
+// the filter delay out of the resampler. Returns zero when there is nothing left.
+
+static uint32_t art_read_input (void *buffer, uint32_t max_frames)
+{
+	int stream_read_size = process_context.config.num_channels * ((process_context.config.inbits + 7) / 8);
+	uint32_t frames = art_read_file (buffer, max_frames);
+
+	if (!frames) {
+		// END OF THE STREAM!!!!
+		frames = process_context.samples_to_append;
+
+		if (frames > max_frames)
+			frames = max_frames;
+
+		memset (buffer, (process_context.config.inbits <= 8) * 128, frames * stream_read_size);
+		process_context.samples_to_append -= frames;
 	}
-	else if (process_context.inbits <= 16) {
-		float gain_factor = process_context.gain / 32768.0;
-		int i, j;
-
-		for (i = j = 0; i < stream_samples_read * process_context.num_channels; ++i) {
-			int16_t value = process_context.tmpbuffer [j++];
-			value += process_context.tmpbuffer [j++] << 8;
-			process_context.inbuffer [i] = value * gain_factor;
+
+	return frames;
+}
+
+static void art_update_progress (uint64_t progress_divider, uint32_t *percent)
+{
+	if (progress_divider) {
+		uint32_t new_percent = 100 - (uint32_t) (process_context.remaining_samples / progress_divider);
+
+		if (new_percent != *percent) {
+			fprintf (stderr, "\rprogress: %u%% ", *percent = new_percent);
+			fflush (stderr);
 		}
 	}
-	else if (process_context.inbits <= 24) {
-		float gain_factor = process_context.gain / 8388608.0;
-		int i, j;
-
-		for (i = j = 0; i < stream_samples_read * process_context.num_channels; ++i) {
-			int32_t value = process_context.tmpbuffer [j++];
-			value += process_context.tmpbuffer [j++] << 8;
-			value += (int32_t) (signed char) process_context.tmpbuffer [j++] << 16;
-			process_context.inbuffer [i] = value * gain_factor;
+}
+
+// Memory-mapped processing, which goes straight from the mapped input (float data is passed right to
+// the resampler if it needs no conversion or filtering) to the mapped output (the resampler writes
+// float data right there, integer data is converted there). The mapped data chunks only need to be
+// suitably aligned for floats, which they normally are.
+
+static void art_resample_process_mapped (uint64_t progress_divider, uint32_t *percent)
+{
+	art_stream_t *stream = process_context.stream;
+	const art_stream_config_t *config = &stream->config;
+	int stream_read_size = config->num_channels * ((config->inbits + 7) / 8);
+	int stream_write_size = config->num_channels * ((config->outbits + 7) / 8);
+	int direct_input = config->inbits == 32 && config->gain == 1.0 && !IS_BIG_ENDIAN &&
+		!stream->pre_filter && !((uintptr_t) process_context.in_map & 3);
+	int direct_output = config->outbits == 32 && !IS_BIG_ENDIAN && !((uintptr_t) process_context.out_map & 3);
+
+	while (1) {
+		uint32_t frames = process_context.remaining_samples < stream->block_frames ? (uint32_t) process_context.remaining_samples : stream->block_frames;
+		const uint8_t *source = process_context.in_map + process_context.in_map_index;
+		const float *input = stream->inbuffer;
+		float *output = stream->outbuffer;
+		uint32_t generated;
+		uint64_t max_output;
+
+		if (frames) {
+			process_context.in_map_index += frames * stream_read_size;
+			process_context.remaining_samples -= frames;
+		}
+		else if ((frames = art_read_input (process_context.readbuffer, stream->block_frames)))
+			source = process_context.readbuffer;    // the silence at the end
+		else
+			break;
+
+		if (direct_input)
+			input = (const float *) source;
+		else {
+			art_convert_input (stream, source, stream->inbuffer, frames);
+
+			if (stream->pre_filter)
+				art_apply_lowpass (stream, &stream->stats [ART_STAGE_PRE_FILTER], stream->inbuffer, frames, 0, config->num_channels);
 		}
+
+		max_output = process_context.out_map_frames - process_context.output_samples;
+
+		if (direct_output)
+			output = (float *) (process_context.out_map + process_context.out_map_index);
+
+		if (max_output > stream->outbuffer_samples)
+			max_output = stream->outbuffer_samples;
+
+		if (config->outbits == 32 && !direct_output) {
+			generated = art_resample_floats (stream, input, frames, output, (uint32_t) max_output);
+			art_write_output (output, NULL, generated);
+		}
+		else {
+			if (direct_output)
+				generated = art_resample_floats (stream, input, frames, output, (uint32_t) max_output);
+			else
+				generated = art_resample_block (stream, input, frames, process_context.out_map + process_context.out_map_index, (uint32_t) max_output);
+
+			process_context.out_map_index += generated * stream_write_size;
+			process_context.output_samples += generated;
+		}
+
+		art_update_progress (progress_divider, percent);
+	}
+}
+
+// Dump the filter bank of the (fractional) resampler to the file specified with -d, either as a binary image
+// for resampleInitFromBank() or, if the filename ends in .h or .c, as C source for a const image.
+
+static int art_resample_dump_bank (const char *filename)
+{
+	art_stream_t *stream = process_context.stream;
+	Resample *resampler = stream->cascade ? stream->cascade->resampler : stream->resampler;
+	const char *extension = strrchr (filename, '.');
+	int source = extension && (!strcmp (extension, ".h") || !strcmp (extension, ".c"));
+	FILE *file;
+	int res;
+
+	if (!resampler) {
+		fprintf (stderr, "no sinc filter bank to dump (half-band stages only)!\n");
+		return 0;
+	}
+
+	if (!(file = fopen (filename, source ? "w" : "wb"))) {
+		fprintf (stderr, "can't open file \"%s\" for writing!\n", filename);
+		return 0;
+	}
+
+	if (source)
+		res = resampleExportBankSource (resampler, file, "art_filter_bank");
+	else {
+		size_t image_bytes = resampleExportBank (resampler, NULL, 0);
+		void *image = malloc (image_bytes);
+
+		resampleExportBank (resampler, image, image_bytes);
+		res = fwrite (image, 1, image_bytes, file) == image_bytes;
+		free (image);
+	}
+
+	if (fclose (file) || !res) {
+		fprintf (stderr, "can't write to file \"%s\"!\n", filename);
+		return 0;
+	}
+
+	if (stream->config.verbosity > 0)
+		fprintf (stderr, "dumped %d-tap, %d-filter bank to \"%s\"\n", resampler->numTaps, resampler->numFilters, filename);
+
+	return 1;
+}
+
+#ifndef ART_STREAM_NO_THREADS
+
+// Multithreaded processing for offline jobs (-j). The results are bit-identical to the single-threaded
+// path because every output sample goes through exactly the same arithmetic:
+//
+// Segment-parallel: the input is split into time segments, each resampled by its own worker with its
+// own Resample. A segment always starts on a whole period of the exact rational ratio (so the phase at
+// the start is exactly the same as it would be in a continuous run) and is preceded by numTaps frames of
+// warm-up input, which the resampler is advanced past with resampleAdvancePosition(). This requires the
+// exact polyphase (rational) resampler, and because the biquads, the dither and the noise-shaping are
+// sequential, those all stay on the main thread.
+//
+// Channel-parallel: each worker owns a subset of the channels (in groups of 4, because the resampler
+// filters 4 channels at a time and the partitioning must not change that) with its own Resample (or
+// cascade) and biquads, and runs through the file in large chunks. This works with any resampler, but of
+// course can't use more workers than there are groups of channels. It's used when segments aren't possible.
+
+#define ART_STREAM_CHUNK_FRAMES     65536       // input frames per round in channel-parallel mode
+#define ART_STREAM_SEGMENT_FRAMES   16384       // approximate input frames per segment in segment-parallel mode
+
+typedef struct {
+	pthread_t thread;
+	Resample *resampler;
+	ResampleCascade *cascade;
+	int first_channel, num_channels, warmup_frames, max_output, started;
+	uint32_t input_frames, output_generated;
+	float *input, *output, *inbuffer, *outbuffer;
+	art_stage_stats_t stats [ART_STREAM_NUM_STAGES];
+} art_worker_t;
+
+static int art_worker_init (art_worker_t *worker, int first_channel, int num_channels)
+{
+	art_stream_t *stream = process_context.stream;
+	const art_stream_config_t *config = &stream->config;
+
+	worker->first_channel = first_channel;
+	worker->num_channels = num_channels;
+
+	if (stream->cascade) {
+		worker->cascade = resampleCascadeInit (num_channels, stream->sample_ratio, config->num_taps,
+			config->num_filters, stream->resampler_lowpass, stream->resampler_flags);
+
+		if (!worker->cascade)
+			return 0;
+
+		resampleCascadeAdvancePosition (worker->cascade, resampleCascadeGetDelay (worker->cascade) + config->phase_shift);
 	}
 	else {
-		if (IS_BIG_ENDIAN) {
-			unsigned char *bptr = (unsigned char *) process_context.inbuffer, word [4];
-			int wcount = stream_samples_read * process_context.num_channels;
-
-			while (wcount--) {
-				memcpy (word, bptr, 4);
-				*bptr++ = word [3];
-				*bptr++ = word [2];
-				*bptr++ = word [1];
-				*bptr++ = word [0];
-			}
+		Resample *resampler = stream->resampler;
+
+		if (resampler->flags & RATIONAL_PHASE)
+			worker->resampler = resampleInitRational (num_channels, config->num_taps, resampler->numFilters,
+				resampler->rationalStep * resampler->numFilters + resampler->rationalStepPhase,
+				stream->resampler_lowpass, stream->resampler_flags);
+		else
+			worker->resampler = resampleInit (num_channels, config->num_taps, config->num_filters,
+				stream->resampler_lowpass, stream->resampler_flags);
+
+		if (!worker->resampler)
+			return 0;
+
+		resampleAdvancePosition (worker->resampler, resampleGetGroupDelay (worker->resampler) + config->phase_shift);
+	}
+
+	return 1;
+}
+
+// Free the worker, first adding its statistics (and its resampler's) to the stream's.
+
+static void art_worker_free (art_worker_t *worker)
+{
+	art_stream_t *stream = process_context.stream;
+	Resample *resampler = worker->cascade ? worker->cascade->resampler : worker->resampler;
+	ResampleStats rstats;
+
+	art_stats_merge (stream->stats, worker->stats);
+
+	if (resampler && resampleGetStats (resampler, &rstats)) {
+		stream->worker_stats.processCalls += rstats.processCalls;
+		stream->worker_stats.inputFrames += rstats.inputFrames;
+		stream->worker_stats.outputFrames += rstats.outputFrames;
+		stream->worker_stats.historyShifts += rstats.historyShifts;
+		stream->worker_stats.passthroughOutputs += rstats.passthroughOutputs;
+		stream->worker_stats.exactPhaseOutputs += rstats.exactPhaseOutputs;
+		stream->worker_stats.nearestOutputs += rstats.nearestOutputs;
+		stream->worker_stats.interpolatedOutputs += rstats.interpolatedOutputs;
+		stream->worker_stats.lazyFilters += rstats.lazyFilters;
+	}
+
+	if (worker->cascade)
+		resampleCascadeFree (worker->cascade);
+	else if (worker->resampler)
+		resampleFree (worker->resampler);
+
+	free (worker->inbuffer);
+	free (worker->outbuffer);
+}
+
+// Run all the workers on the given function and wait for them. If a thread can't be created, that worker
+// just runs on this one.
+
+static void art_run_workers (art_worker_t *workers, int num_workers, void *(*function) (void *))
+{
+	int i;
+
+	for (i = 0; i < num_workers; ++i)
+		workers [i].started = !pthread_create (&workers [i].thread, NULL, function, workers + i);
+
+	for (i = 0; i < num_workers; ++i)
+		if (workers [i].started)
+			pthread_join (workers [i].thread, NULL);
+		else
+			function (workers + i);
+}
+
+// Resample one time segment. The resampler is reset and positioned just like the main one at the start of
+// the file and then advanced over the warm-up frames, so the first output lands on the segment's first
+// frame. The output is limited to the segment length; a short result means that the input ran out.
+
+static void *art_segment_worker (void *arg)
+{
+	art_worker_t *worker = arg;
+	art_stream_t *stream = process_context.stream;
+	const art_stream_config_t *config = &stream->config;
+	ResampleResult res;
+
+	resampleReset (worker->resampler);
+	resampleAdvancePosition (worker->resampler, resampleGetGroupDelay (worker->resampler) + config->phase_shift);
+
+	if (worker->warmup_frames)
+		resampleAdvancePosition (worker->resampler, worker->warmup_frames);
+
+	ART_STATS_START (start);
+	res = resampleProcessInterleaved (worker->resampler, worker->input, worker->input_frames, worker->output, worker->max_output, stream->sample_ratio);
+	ART_STATS_STOP (&worker->stats [ART_STAGE_RESAMPLE], start, worker->input_frames);
+	worker->output_generated = res.output_generated;
+	return NULL;
+}
+
+// Process one chunk of this worker's channels, which are gathered from (and the results scattered back
+// to) the full interleaved buffers.
+
+static void *art_channel_worker (void *arg)
+{
+	art_worker_t *worker = arg;
+	art_stream_t *stream = process_context.stream;
+	int num_channels = stream->config.num_channels, wch = worker->num_channels, j;
+	ResampleResult res;
+	uint32_t i;
+
+	for (i = 0; i < worker->input_frames; ++i)
+		for (j = 0; j < wch; ++j)
+			worker->inbuffer [i * wch + j] = worker->input [i * num_channels + worker->first_channel + j];
+
+	if (stream->pre_filter)
+		art_apply_lowpass (stream, &worker->stats [ART_STAGE_PRE_FILTER], worker->inbuffer, worker->input_frames, worker->first_channel, wch);
+
+	ART_STATS_START (start);
+
+	if (worker->cascade)
+		res = resampleCascadeProcessInterleaved (worker->cascade, worker->inbuffer, worker->input_frames, worker->outbuffer, worker->max_output);
+	else
+		res = resampleProcessInterleaved (worker->resampler, worker->inbuffer, worker->input_frames, worker->outbuffer, worker->max_output, stream->sample_ratio);
+
+	ART_STATS_STOP (&worker->stats [ART_STAGE_RESAMPLE], start, worker->input_frames);
+
+	if (stream->post_filter)
+		art_apply_lowpass (stream, &worker->stats [ART_STAGE_POST_FILTER], worker->outbuffer, res.output_generated, worker->first_channel, wch);
+
+	for (i = 0; i < res.output_generated; ++i)
+		for (j = 0; j < wch; ++j)
+			worker->output [i * num_channels + worker->first_channel + j] = worker->outbuffer [i * wch + j];
+
+	worker->output_generated = res.output_generated;
+	return NULL;
+}
+
+static void art_process_channels (art_worker_t *workers, int num_workers, uint64_t progress_divider, uint32_t *percent)
+{
+	art_stream_t *stream = process_context.stream;
+	const art_stream_config_t *config = &stream->config;
+	int num_channels = config->num_channels, num_groups = (num_channels + 3) / 4, i;
+	int output_frames = (int) floor (ART_STREAM_CHUNK_FRAMES * stream->sample_ratio * 1.1 + 100.0);
+	int read_bytes = (config->inbits + 7) / 8, write_bytes = (config->outbits + 7) / 8;
+	float *inbuffer = malloc (ART_STREAM_CHUNK_FRAMES * num_channels * sizeof (float));
+	float *outbuffer = malloc (output_frames * num_channels * sizeof (float));
+	uint8_t *readbuffer = config->inbits == 32 ? (uint8_t *) inbuffer : malloc (ART_STREAM_CHUNK_FRAMES * num_channels * read_bytes);
+	uint8_t *writebuffer = config->outbits == 32 ? NULL : malloc (output_frames * num_channels * write_bytes);
+	uint32_t frames;
+
+	if (num_workers > num_groups)
+		num_workers = num_groups;
+
+	if (config->verbosity > 0)
+		fprintf (stderr, "channel-parallel processing with %d threads\n", num_workers);
+
+	for (i = 0; i < num_workers; ++i) {
+		int first = i * num_groups / num_workers * 4, last = (i + 1) * num_groups / num_workers * 4;
+
+		if (last > num_channels)
+			last = num_channels;
+
+		if (!art_worker_init (workers + i, first, last - first)) {
+			fprintf (stderr, "can't initialize resampler for worker thread!\n");
+			exit (1);
 		}
 
-		if (process_context.gain != 1.0)
-		{
-			for (int i = 0; i < stream_samples_read * process_context.num_channels; ++i)
-				process_context.inbuffer [i] *= process_context.gain;
+		workers [i].inbuffer = malloc (ART_STREAM_CHUNK_FRAMES * (last - first) * sizeof (float));
+		workers [i].outbuffer = malloc (output_frames * (last - first) * sizeof (float));
+		workers [i].input = inbuffer;
+		workers [i].output = outbuffer;
+		workers [i].max_output = output_frames;
+	}
+
+	while ((frames = art_read_input (readbuffer, ART_STREAM_CHUNK_FRAMES))) {
+		art_convert_input (stream, readbuffer, inbuffer, frames);
+
+		for (i = 0; i < num_workers; ++i)
+			workers [i].input_frames = frames;
+
+		art_run_workers (workers, num_workers, art_channel_worker);
+
+		if (workers [0].output_generated)
+			art_write_output (outbuffer, writebuffer, workers [0].output_generated);
+
+		art_update_progress (progress_divider, percent);
+	}
+
+	if (readbuffer != (uint8_t *) inbuffer)
+		free (readbuffer);
+
+	free (writebuffer);
+	free (outbuffer);
+	free (inbuffer);
+}
+
+static void art_process_segments (art_worker_t *workers, int num_workers, uint64_t progress_divider, uint32_t *percent)
+{
+	art_stream_t *stream = process_context.stream;
+	const art_stream_config_t *config = &stream->config;
+	Resample *resampler = stream->resampler;
+	int num_channels = config->num_channels, num_taps = config->num_taps, done = 0, i;
+	int period_outputs = resampler->numFilters, period_frames = resampler->rationalStep * resampler->numFilters + resampler->rationalStepPhase;
+	int periods = ART_STREAM_SEGMENT_FRAMES / period_frames > 1 ? ART_STREAM_SEGMENT_FRAMES / period_frames : 1;
+	uint32_t segment_frames = periods * period_frames, segment_outputs = periods * period_outputs;
+	uint32_t window_size = num_workers * segment_frames + num_taps * 2, window_frames = 0, frames;
+	int read_bytes = (config->inbits + 7) / 8, write_bytes = (config->outbits + 7) / 8;
+	float *window = malloc (window_size * num_channels * sizeof (float));
+	float *outbuffer = malloc ((size_t) num_workers * segment_outputs * num_channels * sizeof (float));
+	uint8_t *readbuffer = config->inbits == 32 ? NULL : malloc (window_size * num_channels * read_bytes);
+	uint8_t *writebuffer = config->outbits == 32 ? NULL : malloc (segment_outputs * num_channels * write_bytes);
+	uint64_t window_start = 0, first_frame = 0;
+
+	if (config->verbosity > 0)
+		fprintf (stderr, "segment-parallel processing with %d threads (%u output frames per segment)\n", num_workers, segment_outputs);
+
+	for (i = 0; i < num_workers; ++i) {
+		if (!art_worker_init (workers + i, 0, num_channels)) {
+			fprintf (stderr, "can't initialize resampler for worker thread!\n");
+			exit (1);
 		}
+
+		workers [i].output = outbuffer + (size_t) i * segment_outputs * num_channels;
+		workers [i].max_output = segment_outputs;
 	}
 
-	// common code to process the audio in 32-bit floats
+	while (!done) {
+		uint64_t base = first_frame > (uint64_t) num_taps ? first_frame - num_taps : 0, needed = first_frame + num_workers * segment_frames + num_taps;
 
-	if (process_context.pre_filter)
-		for (int i = 0; i < process_context.num_channels; ++i) {
-			biquad_apply_buffer (&process_context.lowpass [i] [0], process_context.inbuffer + i, stream_samples_read, process_context.num_channels);
-			biquad_apply_buffer (&process_context.lowpass [i] [1], process_context.inbuffer + i, stream_samples_read, process_context.num_channels);
+		// slide the window up to this round's warm-up frames and then fill it (converting and pre-filtering
+		// each frame exactly once, and in order)
+
+		if (base > window_start) {
+			uint32_t discard = base - window_start < window_frames ? base - window_start : window_frames;
+
+			memmove (window, window + discard * num_channels, (window_frames - discard) * num_channels * sizeof (float));
+			window_frames -= discard;
+			window_start += discard;
 		}
 
-	res = resampleProcessInterleaved (process_context.resampler, process_context.inbuffer, stream_samples_read, process_context.outbuffer, process_context.outbuffer_samples, process_context.sample_ratio);
-	uint32_t samples_generated = res.output_generated;
+		while (window_start + window_frames < needed) {
+			float *dest = window + window_frames * num_channels;
+
+			if (!(frames = art_read_input (readbuffer ? readbuffer : (uint8_t *) dest, needed - window_start - window_frames)))
+				break;
+
+			art_convert_input (stream, readbuffer ? readbuffer : (uint8_t *) dest, dest, frames);
+
+			if (stream->pre_filter)
+				art_apply_lowpass (stream, &stream->stats [ART_STAGE_PRE_FILTER], dest, frames, 0, num_channels);
 
-	if (process_context.post_filter)
-		for (int i = 0; i < process_context.num_channels; ++i) {
-			biquad_apply_buffer (&process_context.lowpass [i] [0], process_context.outbuffer + i, samples_generated, process_context.num_channels);
-			biquad_apply_buffer (&process_context.lowpass [i] [1], process_context.outbuffer + i, samples_generated, process_context.num_channels);
+			window_frames += frames;
 		}
 
-	// finally write the audio, converting to appropriate integer format if requested
+		for (i = 0; i < num_workers; ++i) {
+			uint64_t start = first_frame + (uint64_t) i * segment_frames, end = start + segment_frames + num_taps;
 
-	if (process_context.outbits != 32) {
-		float scaler = (1 << process_context.outbits) / 2.0;
-		int32_t offset = (process_context.outbits <= 8) * 128;
-#ifdef ART_STREAM_CLIP_CHECK
-		int32_t highclip = (1 << (process_context.outbits - 1)) - 1;
-		int32_t lowclip = ~highclip;
-#endif
-		int leftshift = (24 - process_context.outbits) % 8;
-		int i, j;
+			if (end > window_start + window_frames)
+				end = window_start + window_frames;
+
+			workers [i].warmup_frames = start < (uint64_t) num_taps ? (int) start : num_taps;
+			workers [i].input = window + (start - workers [i].warmup_frames - window_start) * num_channels;
+			workers [i].input_frames = end > start ? end - start + workers [i].warmup_frames : 0;
+		}
 
-		for (i = j = 0; i < samples_generated * process_context.num_channels; ++i) {
-			int chan = i % process_context.num_channels;
-			int32_t output = floor ((process_context.outbuffer [i] *= scaler) - process_context.error [chan] + tpdf_dither (chan, -1) + 0.5);
+		art_run_workers (workers, num_workers, art_segment_worker);
 
-#ifdef ART_STREAM_CLIP_CHECK
-			if (output > highclip)
-			{
-				process_context.clipped_samples++;
-				output = highclip;
-			}
-			else if (output < lowclip)
-			{
-				process_context.clipped_samples++;
-				output = lowclip;
-			}
-#endif
+		// the post-filter, dither and noise shaping must see the segments in order
 
-			process_context.error [chan] += output - process_context.outbuffer [i];
-			process_context.tmpbuffer [j++] = output = (output << leftshift) + offset;
+		for (i = 0; i < num_workers && !done; ++i) {
+			uint32_t generated = workers [i].output_generated;
 
-			if (process_context.outbits > 8) {
-				process_context.tmpbuffer [j++] = output >> 8;
+			if (stream->post_filter)
+				art_apply_lowpass (stream, &stream->stats [ART_STAGE_POST_FILTER], workers [i].output, generated, 0, num_channels);
 
-				if (process_context.outbits > 16)
-					process_context.tmpbuffer [j++] = output >> 16;
-			}
+			if (generated)
+				art_write_output (workers [i].output, writebuffer, generated);
+
+			done = generated < segment_outputs;
 		}
 
+		first_frame += (uint64_t) num_workers * segment_frames;
+		art_update_progress (progress_divider, percent);
+	}
+
+	free (readbuffer);
+	free (writebuffer);
+	free (outbuffer);
+	free (window);
+}
+
+static void art_resample_process_parallel (uint64_t progress_divider, uint32_t *percent)
+{
+	art_stream_t *stream = process_context.stream;
+	int num_workers = process_context.num_threads, i;
+	art_worker_t *workers = calloc (num_workers, sizeof (art_worker_t));
+
+	if (!process_context.channel_parallel && stream->resampler && (stream->resampler->flags & RATIONAL_PHASE))
+		art_process_segments (workers, num_workers, progress_divider, percent);
+	else {
+		if (!process_context.channel_parallel && stream->config.verbosity > 0)
+			fprintf (stderr, "segments need exact polyphase filters, using channels instead\n");
+
+		art_process_channels (workers, num_workers, progress_divider, percent);
 	}
 
-	process_context.output_samples += samples_generated;
+	for (i = 0; i < num_workers; ++i)
+		art_worker_free (workers + i);
 
-	return samples_generated;
+	free (workers);
 }
 
-uint16_t art_resample_process_audio()
+// Pipelined processing (-a). A reader thread fills blocks with raw input, this thread does all the DSP
+// (conversion, filtering, resampling and dither, so that all stays sequential and bit-identical), and a
+// writer thread writes the converted output. Blocks come from fixed pools and circulate through pairs of
+// lock-free single-producer/single-consumer rings (filled blocks one way, empty blocks back), so nothing is
+// allocated or locked while running and the disk and the CPU are busy at the same time. A block with zero
+// frames marks the end of the stream.
+
+#define ART_STREAM_PIPELINE_BLOCKS  8           // blocks in each pool (must be a power of 2)
+
+typedef struct {
+	uint32_t frames;
+	uint8_t *data;
+} art_block_t;
+
+typedef struct {
+	art_block_t *slots [ART_STREAM_PIPELINE_BLOCKS];
+	atomic_uint head, tail;
+} art_ring_t;
+
+typedef struct {
+	art_ring_t input_full, input_empty, output_full, output_empty;
+	art_block_t input_blocks [ART_STREAM_PIPELINE_BLOCKS], output_blocks [ART_STREAM_PIPELINE_BLOCKS];
+	uint64_t progress_divider;
+	uint32_t *percent;
+} art_pipeline_t;
+
+// Spin briefly (yielding) and then back off to short sleeps, so a thread waiting on slow storage doesn't
+// burn a core.
+
+static void art_ring_wait (int *waits)
 {
-	art_resample_init();
+	if (++*waits < 100)
+		sched_yield ();
+	else {
+		struct timespec pause = { 0, 100000 };
+		nanosleep (&pause, NULL);
+	}
+}
 
-    uint32_t progress_divider = 0, percent;
+static void art_ring_push (art_ring_t *ring, art_block_t *block)
+{
+	unsigned int tail = atomic_load_explicit (&ring->tail, memory_order_relaxed);
+	int waits = 0;
 
-    if (process_context.verbosity >= 0 && process_context.remaining_samples > 1000) {
-        progress_divider = (process_context.remaining_samples + 50) / 100;
-        fprintf (stderr, "\rprogress: %d%% ", percent = 0); fflush (stderr);
-    }
+	while (tail - atomic_load_explicit (&ring->head, memory_order_acquire) == ART_STREAM_PIPELINE_BLOCKS)
+		art_ring_wait (&waits);
 
-    while (process_context.remaining_samples + process_context.samples_to_append)
-	{
-        // first we read the audio data, converting to 32-bit float (if not already) and applying gain
-        unsigned long samples_to_read = process_context.remaining_samples, stream_samples_read;
+	ring->slots [tail & (ART_STREAM_PIPELINE_BLOCKS - 1)] = block;
+	atomic_store_explicit (&ring->tail, tail + 1, memory_order_release);
+}
 
-        if (samples_to_read > process_context.BUFFER_SAMPLES)
-            samples_to_read = process_context.BUFFER_SAMPLES;
+static art_block_t *art_ring_pop (art_ring_t *ring)
+{
+	unsigned int head = atomic_load_explicit (&ring->head, memory_order_relaxed);
+	art_block_t *block;
+	int waits = 0;
 
-        int stream_read_size = process_context.num_channels * ((process_context.inbits + 7) / 8);
+	while (atomic_load_explicit (&ring->tail, memory_order_acquire) == head)
+		art_ring_wait (&waits);
 
-        stream_samples_read = fread_stream(process_context.readbuffer, stream_read_size, samples_to_read);
+	block = ring->slots [head & (ART_STREAM_PIPELINE_BLOCKS - 1)];
+	atomic_store_explicit (&ring->head, head + 1, memory_order_release);
+	return block;
+}
 
-        process_context.remaining_samples -= stream_samples_read;
+static void *art_pipeline_reader (void *arg)
+{
+	art_pipeline_t *pipeline = arg;
+	art_block_t *block;
 
-        if (stream_samples_read==0)
-        {
-        	// END OF THE STREAM!!!!
-            int samples_to_append_now = process_context.samples_to_append;
+	do {
+		block = art_ring_pop (&pipeline->input_empty);
+		block->frames = art_read_input (block->data, process_context.stream->block_frames);
+		art_ring_push (&pipeline->input_full, block);
+		art_update_progress (pipeline->progress_divider, pipeline->percent);
+	} while (block->frames);
 
-            if (!samples_to_append_now)
-            {
-                break;
-            }
+	return NULL;
+}
 
-            if (samples_to_append_now > process_context.BUFFER_SAMPLES)
-                samples_to_append_now = process_context.BUFFER_SAMPLES;
+static void *art_pipeline_writer (void *arg)
+{
+	art_pipeline_t *pipeline = arg;
+	int stream_write_size = process_context.config.num_channels * ((process_context.config.outbits + 7) / 8);
+	art_block_t *block;
 
-            memset (process_context.readbuffer, (process_context.inbits <= 8) * 128, samples_to_append_now * process_context.num_channels * ((process_context.inbits + 7) / 8));
-            stream_samples_read = samples_to_append_now;
-            process_context.samples_to_append -= samples_to_append_now;
-        }
+	while ((block = art_ring_pop (&pipeline->output_full))->frames) {
+		fwrite_stream (block->data, stream_write_size, block->frames);
+		art_ring_push (&pipeline->output_empty, block);
+	}
 
-        uint32_t samples_generated = art_resample_process_block (stream_samples_read);
+	return NULL;
+}
 
-        if(samples_generated)
-        {
-    		int stream_write_size = process_context.num_channels * ((process_context.outbits + 7) / 8);
-    		fwrite_stream (process_context.tmpbuffer, stream_write_size, samples_generated);
-        }
+static void art_resample_process_pipelined (uint64_t progress_divider, uint32_t *percent)
+{
+	art_stream_t *stream = process_context.stream;
+	const art_stream_config_t *config = &stream->config;
+	int read_bytes = config->num_channels * ((config->inbits + 7) / 8);
+	int write_bytes = config->num_channels * ((config->outbits + 7) / 8);
+	art_pipeline_t *pipeline = calloc (1, sizeof (art_pipeline_t));
+	pthread_t reader, writer;
+	art_block_t *input, *output;
+	uint32_t input_frames;
+	int i;
+
+	pipeline->progress_divider = progress_divider;
+	pipeline->percent = percent;
+
+	for (i = 0; i < ART_STREAM_PIPELINE_BLOCKS; ++i) {
+		pipeline->input_blocks [i].data = malloc (stream->block_frames * read_bytes);
+		pipeline->output_blocks [i].data = malloc (stream->outbuffer_samples * write_bytes);
+		art_ring_push (&pipeline->input_empty, pipeline->input_blocks + i);
+		art_ring_push (&pipeline->output_empty, pipeline->output_blocks + i);
+	}
 
-        if (progress_divider) {
-            int new_percent = 100 - process_context.remaining_samples / progress_divider;
+	if (config->verbosity > 0)
+		fprintf (stderr, "pipelined processing with %d-frame blocks\n", stream->block_frames);
 
-            if (new_percent != percent) {
-                fprintf (stderr, "\rprogress: %d%% ", percent = new_percent);
-                fflush (stderr);
-            }
-        }
+	if (pthread_create (&reader, NULL, art_pipeline_reader, pipeline)) {
+		fprintf (stderr, "can't create reader thread!\n");
+		exit (1);
+	}
+
+	if (pthread_create (&writer, NULL, art_pipeline_writer, pipeline)) {
+		fprintf (stderr, "can't create writer thread!\n");
+		exit (1);
+	}
 
+	do {
+		input = art_ring_pop (&pipeline->input_full);
+		output = art_ring_pop (&pipeline->output_empty);
+		input_frames = input->frames;       // the block belongs to the reader again once it's pushed back
+		output->frames = 0;
+
+		if (input_frames) {
+			art_convert_input (stream, input->data, stream->inbuffer, input_frames);
+
+			if (stream->pre_filter)
+				art_apply_lowpass (stream, &stream->stats [ART_STAGE_PRE_FILTER], stream->inbuffer, input_frames, 0, config->num_channels);
+
+			output->frames = art_resample_block (stream, stream->inbuffer, input_frames, output->data, stream->outbuffer_samples);
+			process_context.output_samples += output->frames;
+		}
+
+		// an empty output block would end the writer early, so it goes right back (except at the end)
+
+		if (output->frames || !input_frames)
+			art_ring_push (&pipeline->output_full, output);
+		else
+			art_ring_push (&pipeline->output_empty, output);
+
+		art_ring_push (&pipeline->input_empty, input);
+	} while (input_frames);
+
+	pthread_join (reader, NULL);
+	pthread_join (writer, NULL);
+
+	for (i = 0; i < ART_STREAM_PIPELINE_BLOCKS; ++i) {
+		free (pipeline->input_blocks [i].data);
+		free (pipeline->output_blocks [i].data);
 	}
 
-	art_resample_deinit();
+	free (pipeline);
+}
+
+#endif
+
+uint64_t art_resample_process_audio()
+{
+	if (art_resample_init())
+		return 0;
+
+	art_stream_t *stream = process_context.stream;
+
+	if (process_context.bank_filename)
+		art_resample_dump_bank (process_context.bank_filename);
+
+    uint64_t progress_divider = 0;
+    uint32_t percent;
+
+    if (process_context.config.verbosity >= 0 && process_context.remaining_samples > 1000 && !process_context.unknown_length) {
+        progress_divider = (process_context.remaining_samples + 50) / 100;
+        fprintf (stderr, "\rprogress: %d%% ", percent = 0); fflush (stderr);
+    }
+
+    // if the output is to be memory-mapped, it's sized for exactly the output we expect (for a cascade,
+    // which has no exact query, or input too long for the query, an upper bound), and the mapped length is
+    // trimmed afterward if needed
+
+    if (process_context.map_output) {
+        uint64_t input_frames = process_context.remaining_samples + process_context.samples_to_append;
+
+        if (stream->cascade || input_frames > 0x7fffffff)
+            process_context.out_map_frames = (uint64_t) ceil (input_frames * stream->sample_ratio) + 64;
+        else
+            process_context.out_map_frames = resampleGetExpectedOutput (stream->resampler, (int) input_frames, stream->sample_ratio);
+
+        process_context.out_map = process_context.map_output (process_context.out_map_frames);
+        process_context.out_map_index = 0;
+    }
+
+#ifndef ART_STREAM_NO_THREADS
+    if (process_context.num_threads > 1)
+        art_resample_process_parallel (progress_divider, &percent);
+    else if (process_context.pipelined)
+        art_resample_process_pipelined (progress_divider, &percent);
+    else
+#endif
+    if (process_context.in_map && process_context.out_map)
+        art_resample_process_mapped (progress_divider, &percent);
+    else
+    {
+        int stream_write_size = process_context.config.num_channels * ((process_context.config.outbits + 7) / 8);
+        uint32_t stream_samples_read, samples_generated;
+
+        // read the audio data and process it a block at a time (the converted output is written there),
+        // and then flush the tail out of the stream
+
+        while ((stream_samples_read = art_read_file (process_context.readbuffer, stream->block_frames))) {
+            samples_generated = art_stream_process (stream, process_context.readbuffer, stream_samples_read, process_context.tmpbuffer);
+            fwrite_stream (process_context.tmpbuffer, stream_write_size, samples_generated);
+            art_update_progress (progress_divider, &percent);
+        }
+
+        samples_generated = art_stream_flush (stream, process_context.tmpbuffer);
+        fwrite_stream (process_context.tmpbuffer, stream_write_size, samples_generated);
+        process_context.samples_to_append = 0;
+        process_context.output_samples = stream->output_samples;
+    }
 
-	return 0;
+	return art_resample_deinit();
 }
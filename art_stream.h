@@ -7,9 +7,12 @@
 
 #define IS_BIG_ENDIAN (*(uint16_t *)"\0\xff" < 0x0100)
 
-#define ART_STREAM_NUM_CHANNELS 2
 #define ART_STREAM_CLIP_CHECK
+#define ART_STREAM_BIQUAD_FORM BIQUAD_TRANSPOSED_2
 
+// Everything needed to set up a stream. The samples are interleaved, in the same formats as the .WAV data:
+// inbits/outbits of 4-24 mean integer PCM (unsigned for 8 bits or less, little-endian otherwise) and 32
+// means native floats. A block_frames of zero gets the default (441).
 
 typedef struct
 {
@@ -18,57 +21,136 @@ typedef struct
 	uint32_t lowpass_freq;
 	uint16_t num_taps;
 	uint16_t num_filters;
-	double phase_shift;
-	double gain;
+	double phase_shift;     // in samples, -1.0 < phase_shift < 1.0
+	double gain;            // linear, 1.0 = unity
+
+	uint8_t bh4_window;
+	uint8_t hann_window;
+	int8_t verbosity;       // -1 = errors only, 0 = normal, 1 = lots of info
+	uint8_t interpolate;
+	uint8_t pre_post_filter;
+	uint8_t minimum_phase;  // low-delay filters (only the low frequencies are aligned)
+	uint8_t lazy_filters;   // generate each filter when it's first needed (not all of them up front)
+
+	uint16_t num_channels;
+	uint8_t outbits;
+	uint8_t inbits;
+
+	uint32_t block_frames;
+} art_stream_config_t;
+
+// Each stream keeps timing statistics for the stages of its processing (unless compiled out with
+// ART_STREAM_NO_STATS): the number of blocks and frames, the total, minimum and maximum nanoseconds per
+// block, and a histogram of the block times in power-of-two buckets (bucket 0 is under 1 microsecond
+// and bucket n is from 2^(n-1) to 2^n microseconds, with the last one open-ended). Where the post-filter
+// and packing are fused into the resampler's output (see art_resample_block()), their time is part of the
+// resample stage.
+
+#define ART_STAGE_READ          0
+#define ART_STAGE_CONVERT       1
+#define ART_STAGE_PRE_FILTER    2
+#define ART_STAGE_RESAMPLE      3
+#define ART_STAGE_POST_FILTER   4
+#define ART_STAGE_PACK          5   // dither, noise shaping and packing into the output format
+#define ART_STAGE_WRITE         6
+#define ART_STREAM_NUM_STAGES   7
+
+#define ART_STREAM_STATS_BUCKETS 24
 
-	double sample_ratio;
-    double lowpass_ratio;
+typedef struct
+{
+    uint64_t blocks, frames, total_ns, min_ns, max_ns;
+    uint32_t histogram [ART_STREAM_STATS_BUCKETS];
+} art_stage_stats_t;
 
-    uint32_t outbuffer_samples;
-    uint32_t remaining_samples;
-    uint32_t output_samples;
+// One resampling stream, with all of its DSP state (so any number of them may be used at once, on different
+// threads). Only the art_stream functions below need to be used, but the tool's own processing paths (which
+// bypass the block structure) work on the fields directly.
 
-#ifdef ART_STREAM_CLIP_CHECK
-    uint32_t clipped_samples;
-#endif
+typedef struct
+{
+	art_stream_config_t config;
+
+	double sample_ratio;
+    double lowpass_ratio;
 
-    uint32_t num_samples;
+    uint32_t block_frames;
+    uint32_t outbuffer_samples;     // output frames that one block of input can generate
+    uint64_t output_samples;
+    uint32_t samples_to_append;     // frames of silence still needed to flush the filter delay
 
     float *outbuffer;
     float *inbuffer;
-    uint8_t *tmpbuffer; // used as a go between for integer data!
-
-    void *readbuffer;
 
     uint16_t flags;
-    uint16_t samples_to_append;
-
+    uint8_t in_format, out_format;  // FORMAT_* for inbits and outbits
     uint8_t pre_filter;
     uint8_t post_filter;
 
-    uint8_t bh4_window;
-    uint8_t hann_window;
-    uint8_t verbosity;
-    uint8_t interpolate;
-    uint8_t pre_post_filter;
-
-    uint8_t num_channels;
-    uint8_t outbits;
-    uint8_t inbits;
-
-    Biquad lowpass [ART_STREAM_NUM_CHANNELS][2];
+    BiquadCascade *lowpass;         // two cascaded biquads on every channel
     BiquadCoefficients lowpass_coeff;
     Resample *resampler;
+    ResampleCascade *cascade;
+
+    double resampler_lowpass;       // arguments used for the resampler, so the workers can make their own
+    int resampler_flags;
+
+    FormatQuantizer *quantizer;     // dither and noise shaping for integer output
 
-    float error [ART_STREAM_NUM_CHANNELS];
+    art_stage_stats_t stats [ART_STREAM_NUM_STAGES];
+    ResampleStats worker_stats;     // from the resamplers of the tool's worker threads (which are gone)
+} art_stream_t;
 
-    uint32_t BUFFER_SAMPLES;
+// The state of the ART tool's current job (the file I/O and how to process it), with its one stream.
+
+typedef struct
+{
+    art_stream_config_t config;
+    art_stream_t *stream;
+
+    uint64_t remaining_samples;
+    uint64_t output_samples;
+    uint32_t samples_to_append;
+
+    uint64_t num_samples;       // with unknown_length, just an upper limit (the input is read to its end)
+    uint8_t unknown_length;
+
+    uint8_t *tmpbuffer; // used as a go between for integer data!
+
+    void *readbuffer;
 
     FILE* in_stream;
     FILE* out_stream;
+
+    char *bank_filename;    // if set, the filter bank is dumped here (as C source for .h or .c)
+
+    uint16_t num_threads;       // worker threads for offline processing (0 or 1 = single-threaded)
+    uint8_t channel_parallel;   // split the work by channels instead of time segments
+    uint8_t pipelined;          // read, process and write on separate threads
+
+    const uint8_t *in_map;      // memory-mapped input data chunk (if not NULL)
+    uint8_t *out_map;           // memory-mapped output data chunk, with room for out_map_frames
+    size_t in_map_index, out_map_index;
+    uint64_t out_map_frames;
+    uint8_t *(*map_output) (uint64_t num_frames);  // map the output file sized for num_frames (or NULL)
 }process_context_t;
 
-uint16_t art_resample_init();
-uint16_t art_resample_deinit();
-uint16_t art_resample_process_audio();
+#ifdef __cplusplus
+extern "C" {
+#endif
 
+art_stream_t *art_stream_create (const art_stream_config_t *config);
+uint32_t art_stream_get_max_output (art_stream_t *stream, uint32_t input_frames);
+uint32_t art_stream_process (art_stream_t *stream, const void *input, uint32_t input_frames, void *output);
+uint32_t art_stream_flush (art_stream_t *stream, void *output);
+void art_stream_reset (art_stream_t *stream);
+void art_stream_print_stats (art_stream_t *stream, FILE *file);
+void art_stream_destroy (art_stream_t *stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+uint16_t art_resample_init();
+uint64_t art_resample_deinit();
+uint64_t art_resample_process_audio();
@@ -0,0 +1,1109 @@
+////////////////////////////////////////////////////////////////////////////
+//                           **** BENCH ****                              //
+//                     Resampler Benchmark Harness                        //
+//                 Copyright (c) 2006-2023 David Bryant                   //
+//                         All Rights Reserved                            //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// bench.c
+
+// This times resampleProcess() and resampleProcessInterleaved() over a matrix of the ART quality presets,
+// some common sample rate ratios, channel counts, interpolation, windows and every kernel variant that the
+// CPU supports, and reports the results as a table and (optionally) as JSON. With -a it instead measures
+// the accuracy of the same matrix with test tones, sweeps, impulses and noise, and either kind of results
+// can be checked against a JSON file saved from an earlier run (bin/bench_accuracy.json has the accuracy
+// of the default matrix), so a change to the resampler can be checked for regressions.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+
+#include "resampler.h"
+
+#if !defined (_WIN32)
+#include <sys/resource.h>
+#endif
+
+static const char *sign_on = "\n"
+" BENCH  Resampler Benchmark  Version 0.1\n"
+" Copyright (c) 2006 - 2023 David Bryant.\n\n";
+
+static const char *usage =
+" Usage:     BENCH [-options]\n\n"
+" Options:  -1|2|3|4    = run only the specified preset(s), default = all\n"
+"           -c<list>    = channel counts (default = 1,2,8,32)\n"
+"           -r<list>    = ratios as inrate:outrate (default = 44100:48000,48000:96000,192000:48000)\n"
+"           -k<name>    = run only the specified kernel (scalar, sse2, avx2, avx512 or neon)\n"
+"           -n          = nearest filter only (don't interpolate)\n"
+"           -i          = interpolated filters only\n"
+"           -b          = Blackman-Harris windowing only\n"
+"           -h          = Hann windowing only\n"
+"           -p          = planar API (resampleProcess) only\n"
+"           -x          = interleaved API (resampleProcessInterleaved) only\n"
+"           -t<ms>      = minimum time to run each case (default = 25 ms)\n"
+"           -f<flags>   = extra resampleInit() flags to use for all cases (e.g., -f0x20 = fixed-point phase)\n"
+"           -a          = measure accuracy instead of timing (default channels = 1)\n"
+"           -g<file>    = check against the JSON results of an earlier run (exit code 1 on regressions,\n"
+"                         or if any result has nothing to be checked against)\n"
+"           -d<dB>      = allowed accuracy regression for -g (default = 0.5 dB)\n"
+"           -s<percent> = allowed slowdown (of the realtime factor) for -g (default = 20%)\n"
+"           -j<file>    = write the results as JSON to file (\"-\" for stdout)\n"
+"           -q          = quiet mode (don't display the table)\n\n"
+" Notes:    MAC/s counts the nominal convolution work of numTaps per channel per output frame, the\n"
+"           realtime factor is the seconds of input audio processed per second, and the RSS is the\n"
+"           peak for the process so far.\n\n"
+"           The accuracy is measured with sine tones, against the exact (double-precision) sine at each\n"
+"           output position. SNR is the worst over the passband tones (up to half the lowpass frequency)\n"
+"           of the tone to everything else in the output, ripple is the range of their gains, and the\n"
+"           position error is the worst offset of their phase (in input frames). Stopband is the worst\n"
+"           attenuation of the aliases (downsampling) or images (upsampling) of the stopband tones.\n"
+"           Sweep, impulse and noise are the SNRs of a linear sweep, a band-limited impulse and a sum\n"
+"           of random tones (all over the same passband range) compared to the exact signal at each\n"
+"           output position.\n\n"
+"           With -g, a result with extra flags or a kernel that the file doesn't have is checked against\n"
+"           the file's plain (no extra flags) and/or scalar result for the same case (accuracy only), and\n"
+"           accuracy above 110 dB (the float rounding floor) is never counted as a regression.\n\n";
+
+#define BENCH_BLOCK_FRAMES  1024
+#define BENCH_WARMUP_BLOCKS 4
+#define MAX_CHANNEL_COUNTS  16
+#define MAX_RATIOS          16
+
+#define ACCURACY_FRAMES     32768       // input frames of each test tone
+#define ACCURACY_AMPLITUDE  0.5
+#define ACCURACY_POSITION_TOLERANCE 0.001   // allowed growth of the position error (in frames) for -g
+#define ACCURACY_FLOOR_DB   110.0       // float rounding dominates beyond this, so -g doesn't check it
+#define IMPULSE_WIDTH       4096        // frames of the (windowed) band-limited impulse
+#define NOISE_TONES         32          // random tones summed for the noise signal
+
+// the same quality presets as ART (taps = filters)
+
+static const int presets [] = { 16, 64, 256, 1024 };
+
+// the test tones, as fractions of the lowpass frequency (passband) or of the stopband range (see measure_case())
+
+static const double passband_tones [] = { 0.02, 0.1, 0.2, 0.3, 0.4, 0.5 };
+static const double stopband_tones [] = { 0.25, 0.5, 0.75 };
+
+#define NUM_PASSBAND_TONES  (int) (sizeof (passband_tones) / sizeof (passband_tones [0]))
+#define NUM_STOPBAND_TONES  (int) (sizeof (stopband_tones) / sizeof (stopband_tones [0]))
+
+// the broadband test signals (see test_signal())
+
+enum { SIGNAL_SWEEP, SIGNAL_IMPULSE, SIGNAL_NOISE, NUM_SIGNALS };
+
+typedef struct {
+    int type;
+    double f_lo, f_hi, center;      // in cycles per input frame, and input frames
+    double noise_scale;
+    double freqs [NOISE_TONES], phases [NOISE_TONES];
+} TestSignal;
+
+typedef struct {
+    int preset, taps, filters, kernel, interleaved, interpolate, blackman_harris, num_channels, extra_flags;
+    double in_rate, out_rate;
+    double ns_per_frame, macs_per_second, realtime, seconds;
+    long peak_rss_kbytes;
+    int accuracy;       // these are accuracy results (not timing)
+    double snr_db, ripple_db, stopband_db, position_error;
+    double signal_snr_db [NUM_SIGNALS];     // sweep, impulse and noise
+} BenchResult;
+
+static double get_seconds (void)
+{
+#if defined (CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+    return (double) clock () / CLOCKS_PER_SEC;
+#endif
+}
+
+static long get_peak_rss_kbytes (void)
+{
+#if !defined (_WIN32)
+    struct rusage usage;
+
+    if (getrusage (RUSAGE_SELF, &usage))
+        return 0;
+#if defined (__APPLE__)
+    return usage.ru_maxrss / 1024;     // bytes on OS-X
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+// Parse a comma-separated list of integers (or of "inrate:outrate" pairs if "pairs" is set), returning the
+// number of entries parsed or -1 for a syntax error.
+
+static int parse_list (const char *str, double *values, int max_entries, int pairs)
+{
+    int count = 0;
+
+    while (*str) {
+        char *end;
+
+        if (count == max_entries)
+            return -1;
+
+        values [count * (pairs + 1)] = strtod (str, &end);
+
+        if (end == str)
+            return -1;
+
+        if (pairs) {
+            if (*end != ':')
+                return -1;
+
+            str = end + 1;
+            values [count * 2 + 1] = strtod (str, &end);
+
+            if (end == str)
+                return -1;
+        }
+
+        count++;
+
+        if (*end == ',')
+            end++;
+        else if (*end)
+            return -1;
+
+        str = end;
+    }
+
+    return count;
+}
+
+// Create the resampler for one case of the matrix (with the kernel forced), returning the lowpass ratio
+// that it uses (relative to the input Nyquist) in "lowpass_ratio".
+
+static Resample *create_resampler (const BenchResult *result, double *lowpass_ratio)
+{
+    double ratio = result->out_rate / result->in_rate;
+    int flags = INCLUDE_LOWPASS | result->extra_flags;
+    Resample *cxt;
+
+    // the lowpass is set up the same way as ART does it (ART's only exception is the pure sinc case for
+    // upsampling with long filters, which doesn't change the cost)
+
+    *lowpass_ratio = 1.0 - 10.24 / result->taps;
+
+    if (*lowpass_ratio < 0.84)
+        *lowpass_ratio = 0.84;
+
+    if (ratio < 1.0)
+        *lowpass_ratio *= ratio;
+
+    if (result->interpolate)
+        flags |= SUBSAMPLE_INTERPOLATE;
+
+    if (result->blackman_harris)
+        flags |= BLACKMAN_HARRIS;
+
+    if (result->interleaved)
+        flags |= INTERLEAVED_HISTORY;
+
+    resampleSetKernel (result->kernel);
+    cxt = resampleInit (result->num_channels, result->taps, result->filters, *lowpass_ratio, flags);
+    resampleSetKernel (RESAMPLE_KERNEL_AUTO);
+
+    return cxt;
+}
+
+// Run one case of the matrix, filling in the results. Returns FALSE if the resampler couldn't be created.
+
+static int run_case (BenchResult *result, double min_seconds)
+{
+    int num_channels = result->num_channels, taps = result->taps, max_output, i;
+    double ratio = result->out_rate / result->in_rate, lowpass_ratio;
+    double start, elapsed, output_frames = 0.0;
+    float **planar_in, **planar_out, *interleaved_in, *interleaved_out;
+    const float **inputs;
+    uint32_t random = 0x31415926;
+    int block_count = 0;
+    Resample *cxt;
+
+    if (!(cxt = create_resampler (result, &lowpass_ratio)))
+        return 0;
+
+    resampleAdvancePosition (cxt, resampleGetGroupDelay (cxt));
+    max_output = (int) ceil (BENCH_BLOCK_FRAMES * ratio) + 16;
+
+    planar_in = malloc (num_channels * sizeof (float *));
+    planar_out = malloc (num_channels * sizeof (float *));
+    inputs = malloc (num_channels * sizeof (float *));
+    interleaved_in = malloc (BENCH_BLOCK_FRAMES * num_channels * sizeof (float));
+    interleaved_out = malloc (max_output * num_channels * sizeof (float));
+
+    for (i = 0; i < num_channels; ++i) {
+        planar_in [i] = malloc (BENCH_BLOCK_FRAMES * sizeof (float));
+        planar_out [i] = malloc (max_output * sizeof (float));
+    }
+
+    // the input is white noise at about -6 dB (the content doesn't matter for timing, but this avoids denormals)
+
+    for (i = 0; i < BENCH_BLOCK_FRAMES * num_channels; ++i) {
+        random = random * 69069 + 1;
+        interleaved_in [i] = ((int32_t) random >> 8) * (1.0 / 16777216.0);
+        planar_in [i % num_channels] [i / num_channels] = interleaved_in [i];
+    }
+
+    // run the warm-up blocks, and then as many more as it takes to reach the minimum time
+
+    for (start = elapsed = 0.0; block_count < BENCH_WARMUP_BLOCKS || elapsed < min_seconds; ++block_count) {
+        int remaining = BENCH_BLOCK_FRAMES, generated = 0;
+
+        if (block_count == BENCH_WARMUP_BLOCKS)
+            start = get_seconds ();
+
+        while (remaining) {
+            ResampleResult res;
+
+            if (result->interleaved)
+                res = resampleProcessInterleaved (cxt, interleaved_in + (BENCH_BLOCK_FRAMES - remaining) * num_channels,
+                    remaining, interleaved_out, max_output, ratio);
+            else {
+                for (i = 0; i < num_channels; ++i)
+                    inputs [i] = planar_in [i] + BENCH_BLOCK_FRAMES - remaining;
+
+                res = resampleProcess (cxt, inputs, remaining, planar_out, max_output, ratio);
+            }
+
+            remaining -= res.input_used;
+            generated += res.output_generated;
+        }
+
+        if (block_count >= BENCH_WARMUP_BLOCKS) {
+            output_frames += generated;
+            elapsed = get_seconds () - start;
+        }
+    }
+
+    result->seconds = elapsed;
+    result->ns_per_frame = elapsed * 1e9 / output_frames;
+    result->macs_per_second = output_frames * num_channels * taps / elapsed;
+    result->realtime = (block_count - BENCH_WARMUP_BLOCKS) * (double) BENCH_BLOCK_FRAMES / result->in_rate / elapsed;
+    result->peak_rss_kbytes = get_peak_rss_kbytes ();
+
+    for (i = 0; i < num_channels; ++i) {
+        free (planar_in [i]);
+        free (planar_out [i]);
+    }
+
+    free (planar_in);
+    free (planar_out);
+    free (inputs);
+    free (interleaved_in);
+    free (interleaved_out);
+    resampleFree (cxt);
+
+    return 1;
+}
+
+// Fit a sine of "freq" (cycles per sample) to "count" samples (at the given stride) by least squares,
+// returning its amplitude and phase and the power of the residual (everything else).
+
+static double fit_tone (const float *samples, int stride, int count, double freq, double *amplitude, double *phase)
+{
+    double ss = 0.0, cc = 0.0, sc = 0.0, xs = 0.0, xc = 0.0, det, a, b, residual = 0.0;
+    int i;
+
+    for (i = 0; i < count; ++i) {
+        double s = sin (2.0 * M_PI * freq * i), c = cos (2.0 * M_PI * freq * i), x = samples [i * stride];
+
+        ss += s * s; cc += c * c; sc += s * c;
+        xs += x * s; xc += x * c;
+    }
+
+    det = ss * cc - sc * sc;
+    a = (xs * cc - xc * sc) / det;
+    b = (xc * ss - xs * sc) / det;
+
+    for (i = 0; i < count; ++i) {
+        double error = samples [i * stride] - a * sin (2.0 * M_PI * freq * i) - b * cos (2.0 * M_PI * freq * i);
+        residual += error * error;
+    }
+
+    *amplitude = sqrt (a * a + b * b);
+    *phase = atan2 (b, a);
+    return residual / count;
+}
+
+// Resample "signal" (ACCURACY_FRAMES frames, copied to every channel) from a reset resampler aligned with
+// the input, feeding it in blocks the same as the timing runs. The output is stored interleaved (for either
+// API) and the number of frames generated is returned. Output k is then aligned with input frame k / ratio,
+// so the range of the outputs that the input fully covers is returned in "first" and "count".
+
+static int resample_signal (Resample *cxt, const BenchResult *result, const float *signal, float *output,
+    int max_output, int *first, int *count)
+{
+    int num_channels = result->num_channels, taps = result->taps, used = 0, generated = 0, i, j;
+    double ratio = result->out_rate / result->in_rate;
+    float **planar_in, **planar_out, *interleaved_in;
+    const float **inputs;
+    float **outputs;
+
+    planar_in = malloc (num_channels * sizeof (float *));
+    planar_out = malloc (num_channels * sizeof (float *));
+    inputs = malloc (num_channels * sizeof (float *));
+    outputs = malloc (num_channels * sizeof (float *));
+    interleaved_in = malloc (ACCURACY_FRAMES * num_channels * sizeof (float));
+
+    for (i = 0; i < num_channels; ++i) {
+        planar_in [i] = malloc (ACCURACY_FRAMES * sizeof (float));
+        planar_out [i] = malloc (max_output * sizeof (float));
+    }
+
+    for (i = 0; i < ACCURACY_FRAMES * num_channels; ++i)
+        interleaved_in [i] = planar_in [i % num_channels] [i / num_channels] = signal [i / num_channels];
+
+    resampleReset (cxt);
+    resampleAdvancePosition (cxt, resampleGetGroupDelay (cxt));
+
+    while (used < ACCURACY_FRAMES) {
+        int frames = ACCURACY_FRAMES - used < BENCH_BLOCK_FRAMES ? ACCURACY_FRAMES - used : BENCH_BLOCK_FRAMES;
+        ResampleResult res;
+
+        if (result->interleaved)
+            res = resampleProcessInterleaved (cxt, interleaved_in + used * num_channels, frames,
+                output + generated * num_channels, max_output - generated, ratio);
+        else {
+            for (i = 0; i < num_channels; ++i) {
+                inputs [i] = planar_in [i] + used;
+                outputs [i] = planar_out [i] + generated;
+            }
+
+            res = resampleProcess (cxt, inputs, frames, outputs, max_output - generated, ratio);
+        }
+
+        used += res.input_used;
+        generated += res.output_generated;
+    }
+
+    if (!result->interleaved)
+        for (i = 0; i < generated; ++i)
+            for (j = 0; j < num_channels; ++j)
+                output [i * num_channels + j] = planar_out [j] [i];
+
+    // only analyze where the filter is over the input
+
+    *first = (int) ceil (taps * ratio);
+    *count = (int) floor ((ACCURACY_FRAMES - taps) * ratio) - *first;
+
+    if (*count > generated - *first)
+        *count = generated - *first;
+
+    for (i = 0; i < num_channels; ++i) {
+        free (planar_in [i]);
+        free (planar_out [i]);
+    }
+
+    free (planar_in);
+    free (planar_out);
+    free (inputs);
+    free (outputs);
+    free (interleaved_in);
+
+    return generated;
+}
+
+// Resample a tone of "freq" Hz on every channel and analyze the outputs that the input fully covers. The
+// worst channel's amplitude (relative to the input), phase offset (in input frames), residual and total
+// output power (both relative to the input's power) are returned.
+
+static void measure_tone (Resample *cxt, const BenchResult *result, double freq, double *gain, double *offset,
+    double *residual, double *total)
+{
+    int num_channels = result->num_channels, max_output, first, count, i;
+    double ratio = result->out_rate / result->in_rate;
+    float *signal, *output;
+
+    max_output = (int) ceil (ACCURACY_FRAMES * ratio) + 16;
+    signal = malloc (ACCURACY_FRAMES * sizeof (float));
+    output = malloc (max_output * num_channels * sizeof (float));
+
+    for (i = 0; i < ACCURACY_FRAMES; ++i)
+        signal [i] = ACCURACY_AMPLITUDE * sin (2.0 * M_PI * freq / result->in_rate * i);
+
+    resample_signal (cxt, result, signal, output, max_output, &first, &count);
+
+    *gain = 1e9;
+    *offset = *residual = *total = 0.0;
+
+    for (i = 0; i < num_channels; ++i) {
+        double amplitude, phase, power, input_power = ACCURACY_AMPLITUDE * ACCURACY_AMPLITUDE / 2.0;
+
+        power = fit_tone (output + first * num_channels + i, num_channels, count, freq / result->out_rate, &amplitude, &phase);
+
+        // the fit's phase is at output "first", where the input's phase is 2 pi freq first / out_rate
+
+        phase -= 2.0 * M_PI * freq * first / result->out_rate;
+        phase = remainder (phase, 2.0 * M_PI);
+
+        if (amplitude / ACCURACY_AMPLITUDE < *gain)
+            *gain = amplitude / ACCURACY_AMPLITUDE;
+
+        if (fabs (phase * result->in_rate / (2.0 * M_PI * freq)) > fabs (*offset))
+            *offset = phase * result->in_rate / (2.0 * M_PI * freq);
+
+        if (power / input_power > *residual)
+            *residual = power / input_power;
+
+        if ((power + amplitude * amplitude / 2.0) / input_power > *total)
+            *total = (power + amplitude * amplitude / 2.0) / input_power;
+    }
+
+    free (signal);
+    free (output);
+}
+
+// The broadband test signals are all (very nearly) band-limited to f_hi and can be evaluated exactly at
+// any time t (in input frames), so every output can be compared to the ideal value at its position. The
+// sweep is linear from f_lo to f_hi over the whole input, the impulse is a sinc pulse (with a Hann window)
+// that's flat up to f_hi and centered between two input frames, and the noise is a sum of tones with
+// pseudo-random frequencies (from f_lo to f_hi) and phases (scaled to the same peak level as the others,
+// so that the fixed-point formats aren't clipped).
+
+static double test_signal (const TestSignal *signal, double t)
+{
+    double sum = 0.0, x;
+    int i;
+
+    switch (signal->type) {
+        case SIGNAL_SWEEP:
+            x = signal->f_lo + (signal->f_hi - signal->f_lo) * t / (2.0 * ACCURACY_FRAMES);
+            return ACCURACY_AMPLITUDE * sin (2.0 * M_PI * t * x);
+
+        case SIGNAL_IMPULSE:
+            if (fabs (x = t - signal->center) >= IMPULSE_WIDTH / 2.0)
+                return 0.0;
+
+            sum = ACCURACY_AMPLITUDE * (0.5 + 0.5 * cos (2.0 * M_PI * x / IMPULSE_WIDTH));
+            return x == 0.0 ? sum : sum * sin (2.0 * M_PI * signal->f_hi * x) / (2.0 * M_PI * signal->f_hi * x);
+
+        default:
+            for (i = 0; i < NOISE_TONES; ++i)
+                sum += sin (2.0 * M_PI * signal->freqs [i] * t + signal->phases [i]);
+
+            return sum * signal->noise_scale;
+    }
+}
+
+// Resample one of the broadband test signals on every channel and return the worst channel's SNR (in dB)
+// of the outputs that the input fully covers, against the exact signal.
+
+static double measure_signal (Resample *cxt, const BenchResult *result, int type, double f_lo, double f_hi)
+{
+    int num_channels = result->num_channels, max_output, first, count, i, j;
+    double ratio = result->out_rate / result->in_rate, snr_db = 1e9;
+    uint32_t random = 0x27182818;
+    float *signal, *output;
+    double *exact;
+    TestSignal test;
+
+    test.type = type;
+    test.f_lo = f_lo;
+    test.f_hi = f_hi;
+    test.center = ACCURACY_FRAMES / 2 + 0.3;
+    test.noise_scale = 1.0;
+
+    for (i = 0; i < NOISE_TONES; ++i) {
+        random = random * 69069 + 1;
+        test.freqs [i] = f_lo + (f_hi - f_lo) * (random >> 8) / 16777216.0;
+        random = random * 69069 + 1;
+        test.phases [i] = 2.0 * M_PI * (random >> 8) / 16777216.0;
+    }
+
+    max_output = (int) ceil (ACCURACY_FRAMES * ratio) + 16;
+    signal = malloc (ACCURACY_FRAMES * sizeof (float));
+    output = malloc (max_output * num_channels * sizeof (float));
+
+    for (i = 0; i < ACCURACY_FRAMES; ++i)
+        signal [i] = test_signal (&test, i);
+
+    if (type == SIGNAL_NOISE) {
+        double peak = 0.0;
+
+        for (i = 0; i < ACCURACY_FRAMES; ++i)
+            if (fabs (signal [i]) > peak)
+                peak = fabs (signal [i]);
+
+        test.noise_scale = ACCURACY_AMPLITUDE / peak;
+
+        for (i = 0; i < ACCURACY_FRAMES; ++i)
+            signal [i] = test_signal (&test, i);
+    }
+
+    resample_signal (cxt, result, signal, output, max_output, &first, &count);
+    exact = malloc (count * sizeof (double));
+
+    for (i = 0; i < count; ++i)
+        exact [i] = test_signal (&test, (first + i) / ratio);
+
+    for (j = 0; j < num_channels; ++j) {
+        double signal_power = 0.0, error_power = 0.0;
+
+        for (i = 0; i < count; ++i) {
+            double error = output [(first + i) * num_channels + j] - exact [i];
+
+            signal_power += exact [i] * exact [i];
+            error_power += error * error;
+        }
+
+        if (error_power > 0.0 && 10.0 * log10 (signal_power / error_power) < snr_db)
+            snr_db = 10.0 * log10 (signal_power / error_power);
+    }
+
+    free (signal);
+    free (output);
+    free (exact);
+
+    return snr_db;
+}
+
+// Measure the accuracy for one case of the matrix, filling in the results. Returns FALSE if the resampler
+// couldn't be created. The stopband tones are placed so that their aliases (downsampling) or images
+// (upsampling) fall between the input and output Nyquist frequencies, where they should be removed.
+
+static int measure_case (BenchResult *result)
+{
+    double in_nyquist = result->in_rate / 2.0, out_nyquist = result->out_rate / 2.0, lowpass_ratio;
+    double gain, offset, residual, total, min_gain = 1e9, max_gain = 0.0;
+    double start = get_seconds ();
+    Resample *cxt;
+    int i;
+
+    if (!(cxt = create_resampler (result, &lowpass_ratio)))
+        return 0;
+
+    result->accuracy = 1;
+    result->snr_db = 1e9;
+    result->stopband_db = 0.0;
+    result->position_error = 0.0;
+
+    for (i = 0; i < NUM_PASSBAND_TONES; ++i) {
+        measure_tone (cxt, result, passband_tones [i] * lowpass_ratio * in_nyquist, &gain, &offset, &residual, &total);
+
+        if (gain < min_gain) min_gain = gain;
+        if (gain > max_gain) max_gain = gain;
+
+        if (-10.0 * log10 (residual / (gain * gain)) < result->snr_db)
+            result->snr_db = -10.0 * log10 (residual / (gain * gain));
+
+        if (fabs (offset) > fabs (result->position_error))
+            result->position_error = offset;
+    }
+
+    result->ripple_db = 20.0 * log10 (max_gain / min_gain);
+
+    for (i = 0; i < NUM_SIGNALS; ++i)
+        result->signal_snr_db [i] = measure_signal (cxt, result, i, passband_tones [0] * lowpass_ratio * 0.5,
+            passband_tones [NUM_PASSBAND_TONES - 1] * lowpass_ratio * 0.5);
+
+    for (i = 0; i < NUM_STOPBAND_TONES && result->in_rate != result->out_rate; ++i) {
+        double attenuation;
+
+        if (result->out_rate < result->in_rate) {
+            measure_tone (cxt, result, out_nyquist + stopband_tones [i] * (in_nyquist - out_nyquist), &gain, &offset, &residual, &total);
+            attenuation = -10.0 * log10 (total);
+        }
+        else {
+            measure_tone (cxt, result, in_nyquist - stopband_tones [i] * (out_nyquist - in_nyquist), &gain, &offset, &residual, &total);
+            attenuation = -10.0 * log10 (residual);
+        }
+
+        if (!i || attenuation < result->stopband_db)
+            result->stopband_db = attenuation;
+    }
+
+    result->seconds = get_seconds () - start;
+    result->peak_rss_kbytes = get_peak_rss_kbytes ();
+    resampleFree (cxt);
+
+    return 1;
+}
+
+static void print_header (FILE *file, int accuracy)
+{
+    if (accuracy) {
+        fprintf (file, "preset  taps  kernel  api          interp   window  ratio            ch    SNR dB  ripple dB  stopband dB  position  sweep dB  impulse dB  noise dB\n");
+        fprintf (file, "------  ----  ------  -----------  -------  ------  ---------------  --  --------  ---------  -----------  --------  --------  ----------  --------\n");
+    }
+    else {
+        fprintf (file, "preset  taps  kernel  api          interp   window  ratio            ch   ns/frame      MMAC/s  realtime   RSS KB\n");
+        fprintf (file, "------  ----  ------  -----------  -------  ------  ---------------  --  ----------  ----------  --------  -------\n");
+    }
+}
+
+static void print_result (FILE *file, const BenchResult *r)
+{
+    char ratio [32];
+
+    sprintf (ratio, "%g:%g", r->in_rate, r->out_rate);
+    fprintf (file, "  -%d    %4d  %-6s  %-11s  %-7s  %-6s  %-15s  %2d", r->preset, r->taps, resampleGetKernelName (r->kernel),
+        r->interleaved ? "interleaved" : "planar", r->interpolate ? "interp" : "nearest", r->blackman_harris ? "bh4" : "hann",
+        ratio, r->num_channels);
+
+    if (r->accuracy)
+        fprintf (file, "  %8.2f  %9.4f  %11.2f  %8.5f  %8.2f  %10.2f  %8.2f\n", r->snr_db, r->ripple_db, r->stopband_db, r->position_error,
+            r->signal_snr_db [SIGNAL_SWEEP], r->signal_snr_db [SIGNAL_IMPULSE], r->signal_snr_db [SIGNAL_NOISE]);
+    else
+        fprintf (file, "  %10.2f  %10.1f  %8.1f  %7ld\n", r->ns_per_frame, r->macs_per_second / 1e6, r->realtime,
+            r->peak_rss_kbytes);
+}
+
+// Each result is written on one line, so that an earlier run's file can be read back by read_json().
+
+static void write_json (FILE *file, const BenchResult *results, int num_results)
+{
+    int i;
+
+    fprintf (file, "{\n  \"results\": [\n");
+
+    for (i = 0; i < num_results; ++i) {
+        const BenchResult *r = results + i;
+
+        fprintf (file, "    { \"preset\": %d, \"taps\": %d, \"filters\": %d, \"kernel\": \"%s\", \"api\": \"%s\", "
+            "\"interpolate\": %s, \"window\": \"%s\", \"in_rate\": %g, \"out_rate\": %g, \"channels\": %d, \"flags\": %d, ",
+            r->preset, r->taps, r->filters, resampleGetKernelName (r->kernel), r->interleaved ? "interleaved" : "planar",
+            r->interpolate ? "true" : "false", r->blackman_harris ? "bh4" : "hann", r->in_rate, r->out_rate,
+            r->num_channels, r->extra_flags);
+
+        if (r->accuracy)
+            fprintf (file, "\"snr_db\": %.3f, \"ripple_db\": %.5f, \"stopband_db\": %.3f, \"position_error\": %.6f, "
+                "\"sweep_db\": %.3f, \"impulse_db\": %.3f, \"noise_db\": %.3f }%s\n",
+                r->snr_db, r->ripple_db, r->stopband_db, r->position_error, r->signal_snr_db [SIGNAL_SWEEP],
+                r->signal_snr_db [SIGNAL_IMPULSE], r->signal_snr_db [SIGNAL_NOISE], i + 1 < num_results ? "," : "");
+        else
+            fprintf (file, "\"ns_per_frame\": %.3f, \"macs_per_second\": %.0f, \"realtime\": %.2f, \"peak_rss_kbytes\": %ld }%s\n",
+                r->ns_per_frame, r->macs_per_second, r->realtime, r->peak_rss_kbytes, i + 1 < num_results ? "," : "");
+    }
+
+    fprintf (file, "  ]\n}\n");
+}
+
+// Find the value of "key" in one line of write_json() output, returning NULL if it's not there.
+
+static const char *json_value (const char *line, const char *key)
+{
+    char quoted [64];
+    const char *value;
+
+    sprintf (quoted, "\"%s\": ", key);
+    value = strstr (line, quoted);
+    return value ? value + strlen (quoted) : NULL;
+}
+
+static double json_number (const char *line, const char *key)
+{
+    const char *value = json_value (line, key);
+    return value ? strtod (value, NULL) : 0.0;
+}
+
+static int json_string_is (const char *line, const char *key, const char *string)
+{
+    const char *value = json_value (line, key);
+    return value && *value == '"' && !strncmp (value + 1, string, strlen (string)) && value [strlen (string) + 1] == '"';
+}
+
+// Read the results from a JSON file written by an earlier run (in the one-line-per-result format of
+// write_json()). Results with kernels that this CPU doesn't have are skipped. Returns the number of
+// results read, or -1 if the file can't be opened.
+
+static int read_json (const char *filename, BenchResult **results)
+{
+    int num_results = 0, max_results = 0;
+    FILE *file = fopen (filename, "r");
+    char line [1024];
+
+    *results = NULL;
+
+    if (!file)
+        return -1;
+
+    while (fgets (line, sizeof (line), file)) {
+        BenchResult *r;
+        int kernel;
+
+        if (!json_value (line, "preset"))
+            continue;
+
+        for (kernel = RESAMPLE_NUM_KERNELS - 1; kernel > RESAMPLE_KERNEL_AUTO; --kernel)
+            if (json_string_is (line, "kernel", resampleGetKernelName (kernel)))
+                break;
+
+        if (kernel == RESAMPLE_KERNEL_AUTO)
+            continue;
+
+        if (num_results == max_results)
+            *results = realloc (*results, (max_results += 64) * sizeof (BenchResult));
+
+        r = *results + num_results++;
+        memset (r, 0, sizeof (BenchResult));
+        r->preset = (int) json_number (line, "preset");
+        r->taps = (int) json_number (line, "taps");
+        r->filters = (int) json_number (line, "filters");
+        r->kernel = kernel;
+        r->interleaved = json_string_is (line, "api", "interleaved");
+        r->interpolate = !strncmp (json_value (line, "interpolate") ? json_value (line, "interpolate") : "", "true", 4);
+        r->blackman_harris = json_string_is (line, "window", "bh4");
+        r->in_rate = json_number (line, "in_rate");
+        r->out_rate = json_number (line, "out_rate");
+        r->num_channels = (int) json_number (line, "channels");
+        r->extra_flags = (int) json_number (line, "flags");
+
+        if ((r->accuracy = json_value (line, "snr_db") != NULL)) {
+            r->snr_db = json_number (line, "snr_db");
+            r->ripple_db = json_number (line, "ripple_db");
+            r->stopband_db = json_number (line, "stopband_db");
+            r->position_error = json_number (line, "position_error");
+            r->signal_snr_db [SIGNAL_SWEEP] = json_number (line, "sweep_db");
+            r->signal_snr_db [SIGNAL_IMPULSE] = json_number (line, "impulse_db");
+            r->signal_snr_db [SIGNAL_NOISE] = json_number (line, "noise_db");
+        }
+        else
+            r->realtime = json_number (line, "realtime");
+    }
+
+    fclose (file);
+    return num_results;
+}
+
+// Find the result from an earlier run for the same case. For accuracy, a result with extra flags or a kernel
+// that the earlier run doesn't have falls back to its plain (no extra flags) and/or scalar result, so that
+// (for example) a reduced-precision filter format can be checked against the regular filters and a new CPU
+// against the committed results. An exact match is always preferred. Returns NULL if there's none.
+
+static const BenchResult *find_golden (const BenchResult *r, const BenchResult *golden, int num_golden)
+{
+    const BenchResult *g, *best = NULL;
+    int best_score = 0;
+
+    for (g = golden; g < golden + num_golden; ++g)
+        if (g->accuracy == r->accuracy && g->taps == r->taps && g->filters == r->filters &&
+            g->interleaved == r->interleaved && g->interpolate == r->interpolate && g->blackman_harris == r->blackman_harris &&
+            g->in_rate == r->in_rate && g->out_rate == r->out_rate && g->num_channels == r->num_channels) {
+                int score = (g->extra_flags == r->extra_flags) * 2 + (g->kernel == r->kernel) + 1;
+
+                if (score < 4 && (!r->accuracy || (g->extra_flags != r->extra_flags && g->extra_flags) ||
+                    (g->kernel != r->kernel && g->kernel != RESAMPLE_KERNEL_SCALAR)))
+                        continue;
+
+                if (score > best_score) {
+                    best_score = score;
+                    best = g;
+                }
+        }
+
+    return best;
+}
+
+// Check an accuracy figure (where higher is better) against the earlier one. Anything above the float
+// rounding floor counts as good as anything else there, because that's just rounding noise.
+
+static int check_db (const char *name, double value, double golden, double db_tolerance)
+{
+    if (value >= (golden < ACCURACY_FLOOR_DB ? golden : ACCURACY_FLOOR_DB) - db_tolerance)
+        return 0;
+
+    fprintf (stderr, "regression: %s is %.2f dB (was %.2f dB)\n", name, value, golden);
+    return 1;
+}
+
+// Check a result against the matching one from an earlier run (see find_golden()), reporting any regression
+// beyond the tolerances. Returns TRUE if there was a regression, and counts the results that had a match.
+
+static int check_result (const BenchResult *r, const BenchResult *golden, int num_golden, int *matched,
+    double db_tolerance, double slowdown)
+{
+    const BenchResult *g = find_golden (r, golden, num_golden);
+    int failed = 0;
+
+    if (!g)
+        return 0;
+
+    (*matched)++;
+
+    if (r->accuracy) {
+        failed |= check_db ("SNR", r->snr_db, g->snr_db, db_tolerance);
+
+        if (r->ripple_db > g->ripple_db + db_tolerance) {
+            fprintf (stderr, "regression: ripple is %.4f dB (was %.4f dB)\n", r->ripple_db, g->ripple_db);
+            failed = 1;
+        }
+
+        failed |= check_db ("stopband", r->stopband_db, g->stopband_db, db_tolerance);
+
+        if (fabs (r->position_error) > fabs (g->position_error) + ACCURACY_POSITION_TOLERANCE) {
+            fprintf (stderr, "regression: position error is %.5f (was %.5f)\n", r->position_error, g->position_error);
+            failed = 1;
+        }
+
+        failed |= check_db ("sweep SNR", r->signal_snr_db [SIGNAL_SWEEP], g->signal_snr_db [SIGNAL_SWEEP], db_tolerance);
+        failed |= check_db ("impulse SNR", r->signal_snr_db [SIGNAL_IMPULSE], g->signal_snr_db [SIGNAL_IMPULSE], db_tolerance);
+        failed |= check_db ("noise SNR", r->signal_snr_db [SIGNAL_NOISE], g->signal_snr_db [SIGNAL_NOISE], db_tolerance);
+    }
+    else if (r->realtime < g->realtime * (1.0 - slowdown)) {
+        fprintf (stderr, "regression: realtime factor is %.1f (was %.1f)\n", r->realtime, g->realtime);
+        failed = 1;
+    }
+
+    if (failed)
+        print_result (stderr, r);
+
+    return failed;
+}
+
+int main (int argc, char **argv)
+{
+    double channel_counts [MAX_CHANNEL_COUNTS] = { 1, 2, 8, 32 }, ratios [MAX_RATIOS * 2] = { 44100, 48000, 48000, 96000, 192000, 48000 };
+    int num_channel_counts = 0, num_ratios = 3, preset_mask = 0, kernel = RESAMPLE_KERNEL_AUTO, quiet = 0;
+    int interp_mask = 3, window_mask = 3, api_mask = 3, num_results = 0, max_results;
+    int extra_flags = 0, accuracy = 0, num_golden = 0, num_matched = 0, num_regressions = 0;
+    int preset, k, r, c, interp, window, api;
+    char *json_filename = NULL, *golden_filename = NULL;
+    double min_seconds = 0.025, db_tolerance = 0.5, slowdown = 0.2;
+    BenchResult *results, *golden = NULL;
+    FILE *table = stdout;
+
+    while (--argc) {
+        char *arg = *++argv;
+
+        if (*arg != '-' || !arg [1]) {
+            fprintf (stderr, "%s%s", sign_on, usage);
+            return 1;
+        }
+
+        while (*++arg)
+            switch (*arg) {
+                case '1': case '2': case '3': case '4':
+                    preset_mask |= 1 << (*arg - '1');
+                    break;
+
+                case 'C': case 'c':
+                    if ((num_channel_counts = parse_list (arg + 1, channel_counts, MAX_CHANNEL_COUNTS, 0)) < 1) {
+                        fprintf (stderr, "\ninvalid channel list!\n");
+                        return 1;
+                    }
+
+                    arg += strlen (arg) - 1;
+                    break;
+
+                case 'R': case 'r':
+                    if ((num_ratios = parse_list (arg + 1, ratios, MAX_RATIOS, 1)) < 1) {
+                        fprintf (stderr, "\ninvalid ratio list!\n");
+                        return 1;
+                    }
+
+                    arg += strlen (arg) - 1;
+                    break;
+
+                case 'K': case 'k':
+                    for (kernel = RESAMPLE_NUM_KERNELS - 1; kernel > RESAMPLE_KERNEL_AUTO; --kernel)
+                        if (!strcmp (arg + 1, resampleGetKernelName (kernel)))
+                            break;
+
+                    if (kernel == RESAMPLE_KERNEL_AUTO || !resampleKernelAvailable (kernel)) {
+                        fprintf (stderr, "\nkernel \"%s\" is not available!\n", arg + 1);
+                        return 1;
+                    }
+
+                    arg += strlen (arg) - 1;
+                    break;
+
+                case 'N': case 'n':
+                    interp_mask = 1;
+                    break;
+
+                case 'I': case 'i':
+                    interp_mask = 2;
+                    break;
+
+                case 'H': case 'h':
+                    window_mask = 1;
+                    break;
+
+                case 'B': case 'b':
+                    window_mask = 2;
+                    break;
+
+                case 'P': case 'p':
+                    api_mask = 1;
+                    break;
+
+                case 'X': case 'x':
+                    api_mask = 2;
+                    break;
+
+                case 'T': case 't':
+                    min_seconds = strtod (arg + 1, &arg) / 1000.0;
+                    --arg;
+                    break;
+
+                case 'J': case 'j':
+                    json_filename = arg + 1;
+                    arg += strlen (arg) - 1;
+                    break;
+
+                case 'F': case 'f':
+                    extra_flags = (int) strtol (arg + 1, &arg, 0);
+                    --arg;
+                    break;
+
+                case 'A': case 'a':
+                    accuracy = 1;
+                    break;
+
+                case 'G': case 'g':
+                    golden_filename = arg + 1;
+                    arg += strlen (arg) - 1;
+                    break;
+
+                case 'D': case 'd':
+                    db_tolerance = strtod (arg + 1, &arg);
+                    --arg;
+                    break;
+
+                case 'S': case 's':
+                    slowdown = strtod (arg + 1, &arg) / 100.0;
+                    --arg;
+                    break;
+
+                case 'Q': case 'q':
+                    quiet = 1;
+                    break;
+
+                default:
+                    fprintf (stderr, "%s%s", sign_on, usage);
+                    return 1;
+            }
+    }
+
+    // the accuracy doesn't depend much on the channel count, so by default it's only measured for mono
+
+    if (!num_channel_counts)
+        num_channel_counts = accuracy ? 1 : 4;
+
+    for (c = 0; c < num_channel_counts; ++c)
+        if (channel_counts [c] < 1 || channel_counts [c] > 256 || channel_counts [c] != floor (channel_counts [c])) {
+            fprintf (stderr, "\nchannel counts must be 1 - 256!\n");
+            return 1;
+        }
+
+    for (r = 0; r < num_ratios; ++r)
+        if (ratios [r * 2] < 1.0 || ratios [r * 2 + 1] < 1.0) {
+            fprintf (stderr, "\ninvalid sample rates!\n");
+            return 1;
+        }
+
+    if (!preset_mask)
+        preset_mask = 0xf;
+
+    if (golden_filename && (num_golden = read_json (golden_filename, &golden)) < 0) {
+        fprintf (stderr, "\ncan't open file %s for reading!\n", golden_filename);
+        return 1;
+    }
+
+    // the table goes to stderr if the JSON is going to stdout
+
+    if (json_filename && !strcmp (json_filename, "-"))
+        table = stderr;
+
+    if (!quiet) {
+        fprintf (stderr, "%s", sign_on);
+        print_header (table, accuracy);
+    }
+
+    max_results = 4 * num_ratios * num_channel_counts * 2 * 2 * 2 * RESAMPLE_NUM_KERNELS;
+    results = calloc (max_results, sizeof (BenchResult));
+
+    for (preset = 0; preset < 4; ++preset) {
+        if (!(preset_mask & (1 << preset)))
+            continue;
+
+        for (k = RESAMPLE_KERNEL_SCALAR; k < RESAMPLE_NUM_KERNELS; ++k) {
+            if ((kernel != RESAMPLE_KERNEL_AUTO && k != kernel) || !resampleKernelAvailable (k))
+                continue;
+
+            for (api = 0; api < 2; ++api)
+                for (interp = 0; interp < 2; ++interp)
+                    for (window = 0; window < 2; ++window)
+                        for (r = 0; r < num_ratios; ++r)
+                            for (c = 0; c < num_channel_counts; ++c) {
+                                BenchResult *result = results + num_results;
+
+                                if (!(api_mask & (1 << api)) || !(interp_mask & (1 << interp)) || !(window_mask & (1 << window)))
+                                    continue;
+
+                                result->preset = preset + 1;
+                                result->taps = result->filters = presets [preset];
+                                result->kernel = k;
+                                result->interleaved = api;
+                                result->interpolate = interp;
+                                result->blackman_harris = window;
+                                result->in_rate = ratios [r * 2];
+                                result->out_rate = ratios [r * 2 + 1];
+                                result->num_channels = (int) channel_counts [c];
+                                result->extra_flags = extra_flags;
+
+                                if (!(accuracy ? measure_case (result) : run_case (result, min_seconds))) {
+                                    fprintf (stderr, "\ncould not create resampler!\n");
+                                    continue;
+                                }
+
+                                if (!quiet) {
+                                    print_result (table, result);
+                                    fflush (table);
+                                }
+
+                                if (num_golden)
+                                    num_regressions += check_result (result, golden, num_golden, &num_matched, db_tolerance, slowdown);
+
+                                num_results++;
+                            }
+        }
+    }
+
+    if (json_filename) {
+        FILE *file = strcmp (json_filename, "-") ? fopen (json_filename, "w") : stdout;
+
+        if (!file) {
+            fprintf (stderr, "\ncan't open file %s for writing!\n", json_filename);
+            free (results);
+            free (golden);
+            return 1;
+        }
+
+        write_json (file, results, num_results);
+
+        if (file != stdout)
+            fclose (file);
+    }
+
+    if (golden_filename) {
+        fprintf (stderr, "\n%d of %d results checked against %s, %d regressed\n", num_matched, num_results,
+            golden_filename, num_regressions);
+
+        // a check that covered nothing (or only part of the run) must not pass silently
+
+        if (num_matched < num_results || !num_matched) {
+            fprintf (stderr, "%d results had nothing to be checked against!\n", num_results - num_matched);
+            num_regressions++;
+        }
+    }
+
+    free (results);
+    free (golden);
+    return num_regressions ? 1 : 0;
+}
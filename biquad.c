@@ -8,6 +8,8 @@
 
 // biquad.c
 
+#include <string.h>
+
 #include "biquad.h"
 
 // Second-order Lowpass
@@ -91,3 +93,191 @@ void biquad_apply_buffer (Biquad *f, float *buffer, int num_samples, int stride)
         buffer += stride;
     }
 }
+
+// Create a cascade of "num_stages" biquads (with the given coefficients, one set per stage) for each of
+// "num_channels" channels, using the specified form. The gain is folded into the first stage. Returns
+// NULL if the parameters are invalid.
+
+BiquadCascade *biquad_cascade_init (const BiquadCoefficients *coeffs, int num_stages, int num_channels, int form, float gain)
+{
+    BiquadCascade *c;
+    int i;
+
+    if (num_stages < 1 || num_stages > BIQUAD_MAX_STAGES || num_channels < 1 ||
+        (form != BIQUAD_DIRECT_FORM_1 && form != BIQUAD_TRANSPOSED_2)) {
+            fprintf (stderr, "biquad_cascade_init(): invalid stages, channels or form!\n");
+            return NULL;
+    }
+
+    c = calloc (1, sizeof (BiquadCascade));
+    c->num_stages = num_stages;
+    c->num_channels = num_channels;
+    c->form = form;
+
+    for (i = 0; i < num_stages; ++i)
+        c->coeffs [i] = coeffs [i];
+
+    c->coeffs [0].a0 *= gain;
+    c->coeffs [0].a1 *= gain;
+    c->coeffs [0].a2 *= gain;
+    c->state = calloc (num_channels * num_stages * 4, sizeof (float));
+
+    return c;
+}
+
+void biquad_cascade_reset (BiquadCascade *c)
+{
+    memset (c->state, 0, c->num_channels * c->num_stages * 4 * sizeof (float));
+}
+
+void biquad_cascade_free (BiquadCascade *c)
+{
+    if (c) {
+        free (c->state);
+        free (c);
+    }
+}
+
+// Run up to BIQUAD_LANES channels (the "lanes" lanes of "state") through the cascade. The input frames
+// are "stride" floats apart, and any unused lanes just filter silence.
+
+static void cascade_df1 (const BiquadCascade *c, float *buffer, int num_frames, int stride, int lanes, float (*state) [4] [BIQUAD_LANES])
+{
+    const int num_stages = c->num_stages;
+
+    while (num_frames--) {
+        float x [BIQUAD_LANES] = { 0.0F };
+        int i, j;
+
+        for (j = 0; j < lanes; ++j)
+            x [j] = buffer [j];
+
+        for (i = 0; i < num_stages; ++i) {
+            const float a0 = c->coeffs [i].a0, a1 = c->coeffs [i].a1, a2 = c->coeffs [i].a2;
+            const float b1 = c->coeffs [i].b1, b2 = c->coeffs [i].b2;
+            float *in_d1 = state [i] [0], *in_d2 = state [i] [1], *out_d1 = state [i] [2], *out_d2 = state [i] [3];
+
+            for (j = 0; j < BIQUAD_LANES; ++j) {
+                float sum = (x [j] * a0) + (in_d1 [j] * a1) + (in_d2 [j] * a2) - (b1 * out_d1 [j]) - (b2 * out_d2 [j]);
+                out_d2 [j] = out_d1 [j];
+                in_d2 [j] = in_d1 [j];
+                in_d1 [j] = x [j];
+                x [j] = out_d1 [j] = sum;
+            }
+        }
+
+        for (j = 0; j < lanes; ++j)
+            buffer [j] = x [j];
+
+        buffer += stride;
+    }
+}
+
+static void cascade_tdf2 (const BiquadCascade *c, float *buffer, int num_frames, int stride, int lanes, float (*state) [4] [BIQUAD_LANES])
+{
+    const int num_stages = c->num_stages;
+
+    while (num_frames--) {
+        float x [BIQUAD_LANES] = { 0.0F };
+        int i, j;
+
+        for (j = 0; j < lanes; ++j)
+            x [j] = buffer [j];
+
+        for (i = 0; i < num_stages; ++i) {
+            const float a0 = c->coeffs [i].a0, a1 = c->coeffs [i].a1, a2 = c->coeffs [i].a2;
+            const float b1 = c->coeffs [i].b1, b2 = c->coeffs [i].b2;
+            float *s1 = state [i] [0], *s2 = state [i] [1];
+
+            for (j = 0; j < BIQUAD_LANES; ++j) {
+                float y = x [j] * a0 + s1 [j];
+                s1 [j] = x [j] * a1 - y * b1 + s2 [j];
+                s2 [j] = x [j] * a2 - y * b2;
+                x [j] = y;
+            }
+        }
+
+        for (j = 0; j < lanes; ++j)
+            buffer [j] = x [j];
+
+        buffer += stride;
+    }
+}
+
+// A single channel can't use the lanes, so here it's better to keep each stage's state in registers and
+// make a pass through the buffer for each stage.
+
+static void cascade_single (const BiquadCascade *c, float *buffer, int num_frames, int stride, float (*state) [4] [BIQUAD_LANES])
+{
+    int i, j;
+
+    for (i = 0; i < c->num_stages; ++i) {
+        const float a0 = c->coeffs [i].a0, a1 = c->coeffs [i].a1, a2 = c->coeffs [i].a2;
+        const float b1 = c->coeffs [i].b1, b2 = c->coeffs [i].b2;
+        float d0 = state [i] [0] [0], d1 = state [i] [1] [0], d2 = state [i] [2] [0], d3 = state [i] [3] [0];
+        float *sptr = buffer;
+
+        if (c->form == BIQUAD_TRANSPOSED_2)
+            for (j = 0; j < num_frames; ++j, sptr += stride) {
+                float x = *sptr, y = x * a0 + d0;
+                d0 = x * a1 - y * b1 + d1;
+                d1 = x * a2 - y * b2;
+                *sptr = y;
+            }
+        else
+            for (j = 0; j < num_frames; ++j, sptr += stride) {
+                float sum = (*sptr * a0) + (d0 * a1) + (d1 * a2) - (b1 * d2) - (b2 * d3);
+                d3 = d2;
+                d1 = d0;
+                d0 = *sptr;
+                *sptr = d2 = sum;
+            }
+
+        state [i] [0] [0] = d0; state [i] [1] [0] = d1; state [i] [2] [0] = d2; state [i] [3] [0] = d3;
+    }
+}
+
+// Apply the cascade to "num_frames" of an interleaved buffer containing "num_channels" channels, which are
+// channels first_channel through first_channel + num_channels - 1 of the cascade (so a caller may filter
+// just some of the channels, as long as each channel sees all of its audio in order).
+
+void biquad_cascade_apply (BiquadCascade *c, float *buffer, int num_frames, int first_channel, int num_channels)
+{
+    float state [BIQUAD_MAX_STAGES] [4] [BIQUAD_LANES];
+    int ch, lanes, i, j, k;
+
+    if (first_channel < 0 || num_channels < 1 || first_channel + num_channels > c->num_channels) {
+        fprintf (stderr, "biquad_cascade_apply(): invalid channel range!\n");
+        return;
+    }
+
+    for (ch = 0; ch < num_channels; ch += lanes) {
+        lanes = num_channels - ch < BIQUAD_LANES ? num_channels - ch : BIQUAD_LANES;
+        memset (state, 0, sizeof (state));
+
+        // gather the lanes' states, run the audio through, and put them back
+
+        for (j = 0; j < lanes; ++j) {
+            float *saved = c->state + (first_channel + ch + j) * c->num_stages * 4;
+
+            for (i = 0; i < c->num_stages; ++i)
+                for (k = 0; k < 4; ++k)
+                    state [i] [k] [j] = *saved++;
+        }
+
+        if (lanes == 1)
+            cascade_single (c, buffer + ch, num_frames, num_channels, state);
+        else if (c->form == BIQUAD_TRANSPOSED_2)
+            cascade_tdf2 (c, buffer + ch, num_frames, num_channels, lanes, state);
+        else
+            cascade_df1 (c, buffer + ch, num_frames, num_channels, lanes, state);
+
+        for (j = 0; j < lanes; ++j) {
+            float *saved = c->state + (first_channel + ch + j) * c->num_stages * 4;
+
+            for (i = 0; i < c->num_stages; ++i)
+                for (k = 0; k < 4; ++k)
+                    *saved++ = state [i] [k] [j];
+        }
+    }
+}
@@ -24,6 +24,24 @@ typedef struct {
     int first_order;            // optimization
 } Biquad;
 
+// A cascade of up to BIQUAD_MAX_STAGES biquads applied to every channel of an interleaved buffer in a
+// single pass. The channels are processed BIQUAD_LANES at a time with their states side by side, so the
+// inner loops run across the channels (which the compiler vectorizes) rather than along each channel's
+// serial dependency chain. BIQUAD_DIRECT_FORM_1 gives the same results as the Biquad functions, while
+// BIQUAD_TRANSPOSED_2 (transposed direct form II) has half of the state per stage and fewer operations.
+
+#define BIQUAD_MAX_STAGES       4
+#define BIQUAD_LANES            4
+
+#define BIQUAD_DIRECT_FORM_1    0
+#define BIQUAD_TRANSPOSED_2     1
+
+typedef struct {
+    BiquadCoefficients coeffs [BIQUAD_MAX_STAGES];
+    int num_stages, num_channels, form;
+    float *state;               // per channel, 4 values per stage (only 2 are used by the transposed form)
+} BiquadCascade;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -36,6 +54,11 @@ void biquad_highpass (BiquadCoefficients *filter, double frequency);
 void biquad_apply_buffer (Biquad *f, float *buffer, int num_samples, int stride);
 float biquad_apply_sample (Biquad *f, float input);
 
+BiquadCascade *biquad_cascade_init (const BiquadCoefficients *coeffs, int num_stages, int num_channels, int form, float gain);
+void biquad_cascade_apply (BiquadCascade *c, float *buffer, int num_frames, int first_channel, int num_channels);
+void biquad_cascade_reset (BiquadCascade *c);
+void biquad_cascade_free (BiquadCascade *c);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,343 @@
+////////////////////////////////////////////////////////////////////////////
+//                          **** FORMATS ****                             //
+//             Sample Format Conversion, Dither & Noise Shaping           //
+//                Copyright (c) 2006 - 2023 David Bryant.                 //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// formats.c
+
+// These all run over whole buffers with simple, branch-free loops (no per-sample calls, divisions or
+// data-dependent branches) so that the compiler can vectorize them.
+
+#include <string.h>
+
+#include "formats.h"
+
+#define IS_BIG_ENDIAN (*(uint16_t *)"\0\xff" < 0x0100)
+
+// Return the packed format for a .WAV bitdepth (1-24 for integers, 32 for floats), or 0 if none.
+
+int format_from_bits (int bits)
+{
+    if (bits == 32)
+        return FORMAT_F32;
+    else if (bits < 1 || bits > 24)
+        return 0;
+
+    return bits <= 8 ? FORMAT_U8 : bits <= 16 ? FORMAT_S16 : FORMAT_S24;
+}
+
+int format_sample_bytes (int format)
+{
+    switch (format) {
+        case FORMAT_U8: return 1;
+        case FORMAT_S16: return 2;
+        case FORMAT_S24: return 3;
+        case FORMAT_S32: case FORMAT_F32: return 4;
+        default: return 0;
+    }
+}
+
+// Convert "num_samples" of packed samples to floats (nominally +/-1.0) and apply the gain. For FORMAT_F32
+// the source may also be the destination.
+
+void format_unpack (const void *source, float *dest, int num_samples, int format, double gain)
+{
+    const uint8_t *bytes = source;
+    int i;
+
+    switch (format) {
+        case FORMAT_U8: {
+            float gain_factor = gain / 128.0;
+
+            for (i = 0; i < num_samples; ++i)
+                dest [i] = ((int) bytes [i] - 128) * gain_factor;
+
+            break;
+        }
+
+        case FORMAT_S16: {
+            float gain_factor = gain / 32768.0;
+
+            for (i = 0; i < num_samples; ++i)
+                dest [i] = (int16_t) (bytes [i * 2] | (bytes [i * 2 + 1] << 8)) * gain_factor;
+
+            break;
+        }
+
+        case FORMAT_S24: {
+            float gain_factor = gain / 8388608.0;
+
+            for (i = 0; i < num_samples; ++i)
+                dest [i] = ((int32_t) ((uint32_t) bytes [i * 3] << 8 | (uint32_t) bytes [i * 3 + 1] << 16 |
+                    (uint32_t) bytes [i * 3 + 2] << 24) >> 8) * gain_factor;
+
+            break;
+        }
+
+        case FORMAT_S32: {
+            float gain_factor = gain / 2147483648.0;
+
+            for (i = 0; i < num_samples; ++i)
+                dest [i] = (int32_t) ((uint32_t) bytes [i * 4] | (uint32_t) bytes [i * 4 + 1] << 8 |
+                    (uint32_t) bytes [i * 4 + 2] << 16 | (uint32_t) bytes [i * 4 + 3] << 24) * gain_factor;
+
+            break;
+        }
+
+        case FORMAT_F32:
+            if (IS_BIG_ENDIAN) {
+                uint32_t *words = (uint32_t *) dest;
+
+                if (source != (const void *) dest)
+                    memcpy (dest, source, num_samples * sizeof (float));
+
+                for (i = 0; i < num_samples; ++i)
+                    words [i] = (words [i] >> 24) | ((words [i] >> 8) & 0xff00) | ((words [i] << 8) & 0xff0000) | (words [i] << 24);
+
+                if (gain != 1.0)
+                    for (i = 0; i < num_samples; ++i)
+                        dest [i] *= gain;
+            }
+            else if (gain != 1.0) {
+                for (i = 0; i < num_samples; ++i) {     // the copy and the gain in one pass
+                    float value;
+
+                    memcpy (&value, bytes + i * 4, sizeof (value));
+                    dest [i] = value * gain;
+                }
+            }
+            else if (source != (const void *) dest)
+                memcpy (dest, source, num_samples * sizeof (float));
+
+            break;
+    }
+}
+
+// Pack "num_samples" of integer samples with "bits" valid bits (e.g., from format_quantize()) into an
+// integer format, left-justified in the container.
+
+void format_pack (const int32_t *source, void *dest, int num_samples, int format, int bits)
+{
+    uint8_t *bytes = dest;
+    int i;
+
+    switch (format) {
+        case FORMAT_U8: {
+            int shift = 8 - bits;
+
+            for (i = 0; i < num_samples; ++i)
+                bytes [i] = (uint8_t) (((uint32_t) source [i] << shift) + 128);
+
+            break;
+        }
+
+        case FORMAT_S16: {
+            int shift = 16 - bits;
+
+            for (i = 0; i < num_samples; ++i) {
+                uint32_t value = (uint32_t) source [i] << shift;
+                bytes [i * 2] = value;
+                bytes [i * 2 + 1] = value >> 8;
+            }
+
+            break;
+        }
+
+        case FORMAT_S24: {
+            int shift = 24 - bits;
+
+            for (i = 0; i < num_samples; ++i) {
+                uint32_t value = (uint32_t) source [i] << shift;
+                bytes [i * 3] = value;
+                bytes [i * 3 + 1] = value >> 8;
+                bytes [i * 3 + 2] = value >> 16;
+            }
+
+            break;
+        }
+
+        case FORMAT_S32: {
+            int shift = 32 - bits;
+
+            for (i = 0; i < num_samples; ++i) {
+                uint32_t value = (uint32_t) source [i] << shift;
+                bytes [i * 4] = value;
+                bytes [i * 4 + 1] = value >> 8;
+                bytes [i * 4 + 2] = value >> 16;
+                bytes [i * 4 + 3] = value >> 24;
+            }
+
+            break;
+        }
+    }
+}
+
+// Pack floats into FORMAT_F32 (i.e., copy them, in little-endian order).
+
+void format_pack_float (const float *source, void *dest, int num_samples)
+{
+    memcpy (dest, source, num_samples * sizeof (float));
+
+    if (IS_BIG_ENDIAN) {
+        uint32_t *words = (uint32_t *) dest;
+        int i;
+
+        for (i = 0; i < num_samples; ++i)
+            words [i] = (words [i] >> 24) | ((words [i] >> 8) & 0xff00) | ((words [i] << 8) & 0xff0000) | (words [i] << 24);
+    }
+}
+
+// Create a quantizer to "bits" (1-24) for interleaved audio with the given number of channels. The dither
+// is in the range +/-1 LSB, and noise shaping feeds back the total error (including the dither), giving it
+// a first-order highpass spectrum. Returns NULL if the parameters are invalid.
+
+FormatQuantizer *format_quantizer_init (int num_channels, int bits, int flags)
+{
+    FormatQuantizer *q;
+    int chunk_samples;
+
+    if (num_channels < 1 || bits < 1 || bits > 24) {
+        fprintf (stderr, "format_quantizer_init(): invalid channels or bits!\n");
+        return NULL;
+    }
+
+    q = calloc (1, sizeof (FormatQuantizer));
+    q->num_channels = num_channels;
+    q->bits = bits;
+    q->flags = flags;
+    q->shaping = (flags & FORMAT_NOISE_SHAPING) ? 1.0 : 0.0;
+    q->chunk_frames = FORMAT_CHUNK_SAMPLES / num_channels ? FORMAT_CHUNK_SAMPLES / num_channels : 1;
+    chunk_samples = q->chunk_frames * num_channels;
+
+    q->error = calloc (num_channels, sizeof (float));
+    q->last = calloc (num_channels, sizeof (float));
+    q->random = calloc (chunk_samples, sizeof (float));
+    q->quantized = malloc (chunk_samples * sizeof (int32_t));
+    format_quantizer_reset (q);
+
+    return q;
+}
+
+// Reset the noise-shaping error and the dither (to the same sequence as a new quantizer).
+
+void format_quantizer_reset (FormatQuantizer *q)
+{
+    uint32_t seed = 0x31415926;
+    int i;
+
+    for (i = 0; i < FORMAT_DITHER_LANES; ++i) {
+        seed = seed * 69069 + 1;
+        q->lanes [i] = seed | 1;       // a xorshift state can't be zero
+    }
+
+    memset (q->error, 0, q->num_channels * sizeof (float));
+    memset (q->last, 0, q->num_channels * sizeof (float));
+    q->row_used = FORMAT_DITHER_LANES;
+    q->clipped = 0;
+}
+
+// Step each of the generators once for a new row of uniform values in [0, 1).
+
+static void next_dither_row (uint32_t *lanes, float *row)
+{
+    int i;
+
+    for (i = 0; i < FORMAT_DITHER_LANES; ++i) {
+        uint32_t x = lanes [i];
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        lanes [i] = x;
+        row [i] = (x >> 8) * (1.0f / 16777216.0f);
+    }
+}
+
+// Fill "count" values of the uniform random stream (continuing from the last call).
+
+static void generate_dither (FormatQuantizer *q, float *random, int count)
+{
+    int i = 0;
+
+    while (i < count && q->row_used < FORMAT_DITHER_LANES)
+        random [i++] = q->row [q->row_used++];
+
+    for (; count - i >= FORMAT_DITHER_LANES; i += FORMAT_DITHER_LANES)
+        next_dither_row (q->lanes, random + i);
+
+    if (i < count) {
+        next_dither_row (q->lanes, q->row);
+
+        for (q->row_used = 0; i < count; ++i)
+            random [i] = q->row [q->row_used++];
+    }
+}
+
+// Quantize "num_frames" of interleaved float audio (nominally +/-1.0) to integers with q->bits valid bits,
+// with dither and noise shaping as configured, clipping (and counting) samples that are out of range. This
+// must be called on the audio in order.
+
+void format_quantize (FormatQuantizer *q, const float *source, int32_t *dest, int num_frames)
+{
+    const float scaler = (1 << q->bits) / 2.0, high = (1 << (q->bits - 1)) - 1, low = -high - 1;
+    const int num_channels = q->num_channels;
+
+    while (num_frames) {
+        int frames = num_frames < q->chunk_frames ? num_frames : q->chunk_frames;
+        int num_samples = frames * num_channels, clipped = 0, i, j;
+        float *random = q->random;
+
+        // the highpass TPDF dither is the difference between successive uniform values on each channel
+
+        if (q->flags & FORMAT_DITHER)
+            generate_dither (q, random, num_samples);
+
+        for (i = 0; i < num_samples; i += num_channels)
+            for (j = 0; j < num_channels; ++j) {
+                float sample = source [i + j] * scaler, uniform = random [i + j];
+                float value = floorf (sample - q->error [j] + (uniform - q->last [j]) + 0.5f);
+
+                clipped += (value > high) + (value < low);
+                value = value > high ? high : value < low ? low : value;
+                q->error [j] += (value - sample) * q->shaping;
+                q->last [j] = uniform;
+                dest [i + j] = (int32_t) value;
+            }
+
+        q->clipped += clipped;
+        source += num_samples;
+        dest += num_samples;
+        num_frames -= frames;
+    }
+}
+
+// Quantize and pack "num_frames" of interleaved float audio into an integer format.
+
+void format_quantize_pack (FormatQuantizer *q, const float *source, void *dest, int num_frames, int format)
+{
+    int sample_bytes = format_sample_bytes (format) * q->num_channels;
+    uint8_t *bytes = dest;
+
+    while (num_frames) {
+        int frames = num_frames < q->chunk_frames ? num_frames : q->chunk_frames;
+
+        format_quantize (q, source, q->quantized, frames);
+        format_pack (q->quantized, bytes, frames * q->num_channels, format, q->bits);
+        source += frames * q->num_channels;
+        bytes += frames * sample_bytes;
+        num_frames -= frames;
+    }
+}
+
+void format_quantizer_free (FormatQuantizer *q)
+{
+    if (q) {
+        free (q->error);
+        free (q->last);
+        free (q->random);
+        free (q->quantized);
+        free (q);
+    }
+}
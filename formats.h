@@ -0,0 +1,69 @@
+////////////////////////////////////////////////////////////////////////////
+//                          **** FORMATS ****                             //
+//             Sample Format Conversion, Dither & Noise Shaping           //
+//                Copyright (c) 2006 - 2023 David Bryant.                 //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// formats.h
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+
+// Packed sample formats, as found in .WAV files: integers are little-endian (and 8-bit is unsigned with
+// an offset of 128), floats are IEEE single precision. Integer samples with fewer valid bits than their
+// container are left-justified.
+
+#define FORMAT_U8       1
+#define FORMAT_S16      2
+#define FORMAT_S24      3       // packed 3 bytes per sample
+#define FORMAT_S32      4
+#define FORMAT_F32      5
+
+// quantizer options
+
+#define FORMAT_DITHER           0x1     // TPDF dither with a first-order highpass (HF boost) spectrum
+#define FORMAT_NOISE_SHAPING    0x2     // first-order error feedback, per channel
+
+// The dither comes from FORMAT_DITHER_LANES independent xorshift generators stepped together (so that
+// generating it vectorizes), and the samples of the interleaved stream take the lanes in turn, so the
+// sequence doesn't depend on how the stream is split into calls. The quantizer works through the audio
+// in chunks of whole frames, using the buffers allocated for a chunk at init.
+
+#define FORMAT_DITHER_LANES     8
+#define FORMAT_CHUNK_SAMPLES    1024
+
+typedef struct {
+    int num_channels, bits, flags, chunk_frames, row_used;
+    float shaping;                  // 1.0 with noise shaping, else 0.0
+    uint32_t clipped;               // samples clipped so far
+    uint32_t lanes [FORMAT_DITHER_LANES];
+    float row [FORMAT_DITHER_LANES];   // the current set of generated values, row_used taken so far
+    float *error, *last;            // noise-shaping error and the last random value, per channel
+    float *random;                  // a chunk of dither (or zeros)
+    int32_t *quantized;             // a chunk of quantized samples
+} FormatQuantizer;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int format_from_bits (int bits);
+int format_sample_bytes (int format);
+
+void format_unpack (const void *source, float *dest, int num_samples, int format, double gain);
+void format_pack (const int32_t *source, void *dest, int num_samples, int format, int bits);
+void format_pack_float (const float *source, void *dest, int num_samples);
+
+FormatQuantizer *format_quantizer_init (int num_channels, int bits, int flags);
+void format_quantize (FormatQuantizer *q, const float *source, int32_t *dest, int num_frames);
+void format_quantize_pack (FormatQuantizer *q, const float *source, void *dest, int num_frames, int format);
+void format_quantizer_reset (FormatQuantizer *q);
+void format_quantizer_free (FormatQuantizer *q);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,570 @@
+////////////////////////////////////////////////////////////////////////////
+//                         **** HALFBAND ****                             //
+//           Half-band Decimators/Interpolators & Stage Cascades          //
+//                Copyright (c) 2006 - 2022 David Bryant.                 //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// halfband.c
+
+#include "resampler.h"
+#include "halfband.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979324
+#endif
+
+#define HALFBAND_BUFFER_FRAMES  1024    // frames of each phase buffer beyond what the filter itself needs
+#define CASCADE_CHUNK_FRAMES    1024    // frames passed through the cascade stages at a time
+
+// Transition width (as a fraction of the stage's higher sample rate) is about HALFBAND_WIDTH_BH / numCoeffs
+// for the Blackman-Harris window (~90 dB stopband) and HALFBAND_WIDTH_HANN / numCoeffs for Hann (~40 dB).
+
+#define HALFBAND_WIDTH_BH       1.85
+#define HALFBAND_WIDTH_HANN     0.80
+
+// Return the number of unique coefficients required for a half-band filter that passes everything up to
+// "passband" (a fraction of the filter's higher sample rate, so less than 0.25) and rejects everything
+// above 0.5 - passband (which is what would alias back into the passband after decimation).
+
+int halfbandDesignCoeffs (double passband, int flags)
+{
+    double width = 0.5 - passband * 2.0;
+    double scale = (flags & BLACKMAN_HARRIS) ? HALFBAND_WIDTH_BH : HALFBAND_WIDTH_HANN;
+    int numCoeffs = width > 0.0 ? (int) ceil (scale / width) : HALFBAND_MAX_COEFFS;
+
+    if (numCoeffs < 2)
+        numCoeffs = 2;
+    else if (numCoeffs > HALFBAND_MAX_COEFFS)
+        numCoeffs = HALFBAND_MAX_COEFFS;
+
+    return numCoeffs;
+}
+
+// The non-zero taps are at odd distances n = 2k-1 from the center (k = 1 to numCoeffs), and the window
+// reaches π one sample beyond the last of them. The coefficients are normalized so that they sum to 0.25,
+// which (with the 0.5 center tap and the symmetric other half) gives unity DC gain.
+
+static void init_coeffs (HalfBand *hb, int flags)
+{
+    const double a0 = 0.35875;
+    const double a1 = 0.48829;
+    const double a2 = 0.14128;
+    const double a3 = 0.01168;
+    double coeff_sum = 0.0, scaler;
+    int k;
+
+    for (k = 0; k < hb->numCoeffs; ++k) {
+        double dist = (2 * k + 1) * M_PI * 0.5;
+        double ratio = dist / hb->numCoeffs;
+        double value = sin (dist) / dist * 0.5;
+
+        if (flags & BLACKMAN_HARRIS)
+            value *= a0 + a1 * cos (ratio) + a2 * cos (2 * ratio) + a3 * cos (3 * ratio);
+        else
+            value *= 0.5 * (1.0 + cos (ratio));     // Hann window
+
+        coeff_sum += hb->coeffs [k] = value;
+    }
+
+    // the interpolator only computes the odd outputs, so it needs twice the gain there
+
+    scaler = (hb->interpolate ? 0.5 : 0.25) / coeff_sum;
+
+    for (k = 0; k < hb->numCoeffs; ++k)
+        hb->coeffs [k] *= scaler;
+}
+
+// Initialize a half-band stage for the specified number of interleaved channels. An interpolator doubles
+// the sample rate (and only uses the "even" buffers) and a decimator halves it. Both are zero-phase with
+// respect to the lower rate, meaning that output frame m is centered exactly on input (or output) frame
+// 2m at the higher rate, so the only cost is latency (see halfbandGetLatency()).
+
+HalfBand *halfbandInit (int numChannels, int numCoeffs, int interpolate, int flags)
+{
+    HalfBand *hb;
+    int i;
+
+    if (numChannels < 1 || numCoeffs < 1 || numCoeffs > HALFBAND_MAX_COEFFS) {
+        fprintf (stderr, "must have 1 - %d half-band coefficients!\n", HALFBAND_MAX_COEFFS);
+        return NULL;
+    }
+
+    if (!(hb = calloc (1, sizeof (HalfBand))))
+        return NULL;
+
+    hb->numChannels = numChannels;
+    hb->numCoeffs = numCoeffs;
+    hb->interpolate = interpolate;
+    hb->numSamples = numCoeffs * 4 + HALFBAND_BUFFER_FRAMES;
+    hb->coeffs = calloc (numCoeffs, sizeof (float));
+    hb->even = calloc (numChannels, sizeof (float *));
+    hb->odd = calloc (numChannels, sizeof (float *));
+
+    if (!hb->coeffs || !hb->even || !hb->odd) {
+        halfbandFree (hb);
+        return NULL;
+    }
+
+    for (i = 0; i < numChannels; ++i) {
+        hb->even [i] = calloc (hb->numSamples, sizeof (float));
+
+        if (!interpolate)
+            hb->odd [i] = calloc (hb->numSamples, sizeof (float));
+
+        if (!hb->even [i] || (!interpolate && !hb->odd [i])) {
+            halfbandFree (hb);
+            return NULL;
+        }
+    }
+
+    init_coeffs (hb, flags);
+    halfbandReset (hb);
+    return hb;
+}
+
+// The buffers start with numCoeffs zero frames representing the (silent) input before the start of the
+// stream, which are exactly enough for the first output to be centered on the first input frame.
+
+void halfbandReset (HalfBand *hb)
+{
+    int i;
+
+    for (i = 0; i < hb->numChannels; ++i) {
+        memset (hb->even [i], 0, hb->numSamples * sizeof (float));
+
+        if (hb->odd [i])
+            memset (hb->odd [i], 0, hb->numSamples * sizeof (float));
+    }
+
+    hb->evenIndex = hb->oddIndex = hb->outputIndex = hb->numCoeffs;
+    hb->phase = 0;
+}
+
+// Return the number of input frames that must be appended at the end of the stream to flush all the
+// output corresponding to the real input (at the input rate).
+
+int halfbandGetLatency (HalfBand *hb)
+{
+    return hb->interpolate ? hb->numCoeffs : hb->numCoeffs * 2 - 1;
+}
+
+// Decimate the interleaved input by 2, returning the number of output frames generated (which is at most
+// numInputFrames / 2 + 1). Decimated output m is:
+//
+//   0.5 * even [m] + sum (k = 1 to numCoeffs) coeffs [k-1] * (odd [m-k] + odd [m+k-1])
+//
+// so it can be generated as soon as odd [m+numCoeffs-1] has arrived.
+
+int halfbandDecimate (HalfBand *hb, const float *input, int numInputFrames, float *output)
+{
+    int numChannels = hb->numChannels, numCoeffs = hb->numCoeffs, outputFrames = 0, i, k;
+
+    while (numInputFrames--) {
+        if (hb->evenIndex == hb->numSamples || hb->oddIndex == hb->numSamples) {
+            int shift = hb->outputIndex - numCoeffs;
+
+            for (i = 0; i < numChannels; ++i) {
+                memmove (hb->even [i], hb->even [i] + shift, (hb->evenIndex - shift) * sizeof (float));
+                memmove (hb->odd [i], hb->odd [i] + shift, (hb->oddIndex - shift) * sizeof (float));
+            }
+
+            hb->evenIndex -= shift;
+            hb->oddIndex -= shift;
+            hb->outputIndex -= shift;
+        }
+
+        if (hb->phase) {
+            for (i = 0; i < numChannels; ++i)
+                hb->odd [i] [hb->oddIndex] = *input++;
+
+            hb->oddIndex++;
+        }
+        else {
+            for (i = 0; i < numChannels; ++i)
+                hb->even [i] [hb->evenIndex] = *input++;
+
+            hb->evenIndex++;
+        }
+
+        hb->phase ^= 1;
+
+        if (hb->oddIndex >= hb->outputIndex + numCoeffs) {
+            for (i = 0; i < numChannels; ++i) {
+                const float *lo = hb->odd [i] + hb->outputIndex - 1, *hi = hb->odd [i] + hb->outputIndex;
+                float sum = 0.0;
+
+                for (k = 0; k < numCoeffs; ++k)
+                    sum += hb->coeffs [k] * (lo [-k] + hi [k]);
+
+                *output++ = hb->even [i] [hb->outputIndex] * 0.5 + sum;
+            }
+
+            hb->outputIndex++;
+            outputFrames++;
+        }
+    }
+
+    return outputFrames;
+}
+
+// Interpolate the interleaved input by 2, returning the number of output frames generated (which is at
+// most numInputFrames * 2). Output 2m is simply input [m] and output 2m+1 is:
+//
+//   sum (k = 1 to numCoeffs) coeffs [k-1] * (input [m-k+1] + input [m+k])
+//
+// so both can be generated as soon as input [m+numCoeffs] has arrived.
+
+int halfbandInterpolate (HalfBand *hb, const float *input, int numInputFrames, float *output)
+{
+    int numChannels = hb->numChannels, numCoeffs = hb->numCoeffs, outputFrames = 0, i, k;
+
+    while (numInputFrames--) {
+        if (hb->evenIndex == hb->numSamples) {
+            int shift = hb->outputIndex - numCoeffs + 1;
+
+            for (i = 0; i < numChannels; ++i)
+                memmove (hb->even [i], hb->even [i] + shift, (hb->evenIndex - shift) * sizeof (float));
+
+            hb->evenIndex -= shift;
+            hb->outputIndex -= shift;
+        }
+
+        for (i = 0; i < numChannels; ++i)
+            hb->even [i] [hb->evenIndex] = *input++;
+
+        if (++hb->evenIndex > hb->outputIndex + numCoeffs) {
+            for (i = 0; i < numChannels; ++i) {
+                const float *lo = hb->even [i] + hb->outputIndex, *hi = lo + 1;
+                float sum = 0.0;
+
+                for (k = 0; k < numCoeffs; ++k)
+                    sum += hb->coeffs [k] * (lo [-k] + hi [k]);
+
+                output [i] = *lo;
+                output [i + numChannels] = sum;
+            }
+
+            output += numChannels * 2;
+            hb->outputIndex++;
+            outputFrames += 2;
+        }
+    }
+
+    return outputFrames;
+}
+
+// This also frees a partially built instance (from a failed halfbandInit()).
+
+void halfbandFree (HalfBand *hb)
+{
+    int i;
+
+    for (i = 0; i < hb->numChannels; ++i) {
+        if (hb->even)
+            free (hb->even [i]);
+
+        if (hb->odd)
+            free (hb->odd [i]);
+    }
+
+    free (hb->even);
+    free (hb->odd);
+    free (hb->coeffs);
+    free (hb);
+}
+
+// Plan and initialize a cascade for the given ratio (output rate / input rate). The other parameters are
+// the same as for resampleInit() and are used for the fractional stage (if one is required), with the
+// lowpassRatio relative to the input Nyquist (as with INCLUDE_LOWPASS). Every 2x of the ratio beyond the
+// first is handled by a half-band stage whose length is chosen to preserve the final passband (the
+// lowpass, or the passband of a pure sinc filter of numTaps) while rejecting whatever would alias into it.
+//
+// A single Resample stage matching that response over the whole ratio would need its filters to be
+// 2^stages times longer for decimation (they must be numTaps long at the output rate) and still costs
+// numTaps for each output when interpolating, so the cascade is almost always cheaper; when it isn't
+// (very short fractional filters) the planner falls back to that single stage (numStages = 0). Of course
+// this also means the cascade's stopband (between its stages) is not as good as the fractional stage's
+// when the half-bands use the Hann window; use BLACKMAN_HARRIS for ~90 dB throughout.
+
+ResampleCascade *resampleCascadeInit (int numChannels, double ratio, int numTaps, int numFilters, double lowpassRatio, int flags)
+{
+    int filter_mult = (flags & SUBSAMPLE_INTERPOLATE) ? 2 : 1, interpolate = ratio > 1.0, numStages = 0, i;
+    double frac_ratio = ratio, frac_lowpass = lowpassRatio, passband, stage_scale, cost;
+    int stage_coeffs [CASCADE_MAX_STAGES];
+    ResampleCascade *cxt;
+
+    if (numChannels < 1 || ratio <= 0.0) {
+        fprintf (stderr, "invalid cascade parameters!\n");
+        return NULL;
+    }
+
+    // passband is the highest frequency to preserve, as a fraction of the input sample rate
+
+    if (lowpassRatio > 0.0 && lowpassRatio < 1.0)
+        passband = lowpassRatio * 0.5;
+    else
+        passband = 0.5 * (numTaps > 20 ? 1.0 - 10.24 / numTaps : 0.5);
+
+    if (interpolate) {
+        while (numStages < CASCADE_MAX_STAGES && frac_ratio >= 2.0) {
+            frac_ratio *= 0.5;
+            numStages++;
+        }
+
+        // the interpolators run after the fractional stage, at 2x, 4x, etc. of its output rate
+
+        for (stage_scale = frac_ratio * 2.0, i = 0; i < numStages; ++i, stage_scale *= 2.0)
+            stage_coeffs [i] = halfbandDesignCoeffs (passband / stage_scale, flags);
+
+        for (cost = 0.0, stage_scale = 2.0 / (1 << numStages), i = 0; i < numStages; ++i, stage_scale *= 2.0)
+            cost += stage_coeffs [i] * 0.5 * stage_scale;
+
+        cost += frac_ratio == 1.0 ? 0.0 : (double) numTaps * filter_mult / (1 << numStages);
+    }
+    else {
+        while (numStages < CASCADE_MAX_STAGES && frac_ratio <= 0.5) {
+            frac_ratio *= 2.0;
+            frac_lowpass *= 2.0;
+            numStages++;
+        }
+
+        // the decimators run first, at the input rate, 1/2 the input rate, etc.
+
+        for (stage_scale = 1.0, i = 0; i < numStages; ++i, stage_scale *= 2.0)
+            stage_coeffs [i] = halfbandDesignCoeffs (passband * stage_scale, flags);
+
+        for (cost = 0.0, stage_scale = 0.5 / ratio, i = 0; i < numStages; ++i, stage_scale *= 0.5)
+            cost += (stage_coeffs [i] + 1) * stage_scale;
+
+        cost += frac_ratio == 1.0 ? 0.0 : (double) numTaps * filter_mult;
+    }
+
+    if (!(cxt = calloc (1, sizeof (ResampleCascade))))
+        return NULL;
+
+    cxt->numChannels = numChannels;
+    cxt->interpolate = interpolate;
+    cxt->cascadeCost = cost;
+    cxt->singleStageCost = (double) numTaps * filter_mult * (interpolate ? 1 : (1 << numStages));
+
+    if (cxt->cascadeCost >= cxt->singleStageCost) {
+        numStages = 0;
+        frac_ratio = ratio;
+        frac_lowpass = lowpassRatio;
+        cxt->cascadeCost = cxt->singleStageCost;
+    }
+
+    cxt->numStages = numStages;
+    cxt->ratio = frac_ratio;
+    cxt->lowpassRatio = frac_lowpass;
+
+    // an exact power-of-two ratio needs no fractional stage at all (unless that's all there is)
+
+    if (frac_ratio != 1.0 || !numStages) {
+        cxt->resampler = resampleInit (numChannels, numTaps, numFilters, frac_lowpass, flags);
+
+        if (!cxt->resampler) {
+            free (cxt);
+            return NULL;
+        }
+    }
+
+    for (i = 0; i < numStages; ++i)
+        if (!(cxt->stages [i] = halfbandInit (numChannels, stage_coeffs [i], interpolate, flags))) {
+            cxt->numStages = i;         // so only the stages already created are freed
+            resampleCascadeFree (cxt);
+            return NULL;
+        }
+
+    for (i = 0; i < 2; ++i)
+        if (!(cxt->buffers [i] = malloc ((CASCADE_CHUNK_FRAMES + 16) * numChannels * sizeof (float)))) {
+            resampleCascadeFree (cxt);
+            return NULL;
+        }
+
+    return cxt;
+}
+
+// Run the next chunk of input through the stages (leaving it "pending" output) and return the number of
+// input frames consumed. Interpolating cascades always call the fractional stage (even with no input)
+// because it may still have output ready from earlier input.
+
+static int cascade_fill (ResampleCascade *cxt, const float *input, int numInputFrames)
+{
+    int nch = cxt->numChannels, input_used, frames, b = 0, i;
+    const float *source = input;
+
+    if (cxt->interpolate) {
+        if (cxt->resampler) {
+            ResampleResult res = resampleProcessInterleaved (cxt->resampler, input, numInputFrames,
+                cxt->buffers [b], CASCADE_CHUNK_FRAMES >> cxt->numStages, cxt->ratio);
+
+            input_used = res.input_used;
+            frames = res.output_generated;
+            source = cxt->buffers [b];
+            b ^= 1;
+        }
+        else {
+            input_used = frames = numInputFrames < (CASCADE_CHUNK_FRAMES >> cxt->numStages) ?
+                numInputFrames : (CASCADE_CHUNK_FRAMES >> cxt->numStages);
+        }
+
+        for (i = 0; i < cxt->numStages; ++i) {
+            frames = halfbandInterpolate (cxt->stages [i], source, frames, cxt->buffers [b]);
+            source = cxt->buffers [b];
+            b ^= 1;
+        }
+    }
+    else {
+        input_used = frames = numInputFrames < CASCADE_CHUNK_FRAMES ? numInputFrames : CASCADE_CHUNK_FRAMES;
+
+        for (i = 0; i < cxt->numStages; ++i) {
+            frames = halfbandDecimate (cxt->stages [i], source, frames, cxt->buffers [b]);
+            source = cxt->buffers [b];
+            b ^= 1;
+        }
+    }
+
+    cxt->pending = (float *) source;
+    cxt->pendingFrames = frames;
+
+    if (!frames)
+        return input_used;
+
+    // with no decimators the input goes straight to the fractional stage, but it might not all be
+    // consumed in this call so it must be copied
+
+    if (source == input) {
+        memcpy (cxt->buffers [0], input, frames * nch * sizeof (float));
+        cxt->pending = cxt->buffers [0];
+    }
+
+    return input_used;
+}
+
+// Process interleaved audio through the cascade. As with resampleProcessInterleaved(), processing stops
+// when either the input is exhausted or the output is full; output that's generated internally but won't
+// fit is held and returned first on the next call.
+
+ResampleResult resampleCascadeProcessInterleaved (ResampleCascade *cxt, const float *input, int numInputFrames, float *output, int numOutputFrames)
+{
+    int nch = cxt->numChannels, drain_resampler = cxt->resampler && !cxt->interpolate;
+    ResampleResult res = { 0, 0 };
+
+    while (1) {
+        if (drain_resampler) {
+            ResampleResult sub = resampleProcessInterleaved (cxt->resampler, cxt->pending, cxt->pendingFrames,
+                output, numOutputFrames, cxt->ratio);
+
+            cxt->pending += sub.input_used * nch;
+            cxt->pendingFrames -= sub.input_used;
+            output += sub.output_generated * nch;
+            numOutputFrames -= sub.output_generated;
+            res.output_generated += sub.output_generated;
+        }
+        else if (cxt->pendingFrames) {
+            int frames = cxt->pendingFrames < numOutputFrames ? cxt->pendingFrames : numOutputFrames;
+
+            memcpy (output, cxt->pending, frames * nch * sizeof (float));
+            cxt->pending += frames * nch;
+            cxt->pendingFrames -= frames;
+            output += frames * nch;
+            numOutputFrames -= frames;
+            res.output_generated += frames;
+        }
+
+        if (!numOutputFrames || cxt->pendingFrames)
+            break;
+
+        if (!numInputFrames && !(cxt->interpolate && cxt->resampler))
+            break;
+
+        int input_used = cascade_fill (cxt, input, numInputFrames);
+
+        input += input_used * nch;
+        numInputFrames -= input_used;
+        res.input_used += input_used;
+
+        if (!input_used && !cxt->pendingFrames)
+            break;
+    }
+
+    return res;
+}
+
+// Return the group delay of the fractional stage's filters in input frames (see resampleGetGroupDelay()),
+// which is what would normally be passed to resampleCascadeAdvancePosition() to align the output with the
+// input (the half-band stages are zero-phase and need no correction).
+
+double resampleCascadeGetDelay (ResampleCascade *cxt)
+{
+    if (!cxt->resampler)
+        return 0.0;
+
+    return resampleGetGroupDelay (cxt->resampler) * (cxt->interpolate ? 1 : (1 << cxt->numStages));
+}
+
+// Advance the position of the fractional stage by the given number of input frames.
+
+void resampleCascadeAdvancePosition (ResampleCascade *cxt, double delta)
+{
+    if (!cxt->resampler) {
+        if (delta != 0.0)
+            fprintf (stderr, "cascade has no fractional stage, can't advance position!\n");
+
+        return;
+    }
+
+    resampleAdvancePosition (cxt->resampler, cxt->interpolate ? delta : delta / (1 << cxt->numStages));
+}
+
+// Return the number of input frames that must be appended to the end of the stream to flush out all the
+// output corresponding to the real input (assuming the position was advanced by resampleCascadeGetDelay()).
+
+int resampleCascadeGetLatency (ResampleCascade *cxt)
+{
+    double latency = cxt->resampler ? cxt->resampler->numTaps / 2.0 : 0.0, scale;
+    int i;
+
+    if (cxt->interpolate)
+        for (scale = 1.0 / cxt->ratio, i = 0; i < cxt->numStages; ++i, scale *= 0.5)
+            latency += halfbandGetLatency (cxt->stages [i]) * scale;
+    else {
+        latency *= 1 << cxt->numStages;
+
+        for (scale = 1.0, i = 0; i < cxt->numStages; ++i, scale *= 2.0)
+            latency += halfbandGetLatency (cxt->stages [i]) * scale;
+    }
+
+    return (int) ceil (latency) + 1;
+}
+
+void resampleCascadeReset (ResampleCascade *cxt)
+{
+    int i;
+
+    for (i = 0; i < cxt->numStages; ++i)
+        halfbandReset (cxt->stages [i]);
+
+    if (cxt->resampler)
+        resampleReset (cxt->resampler);
+
+    cxt->pendingFrames = 0;
+}
+
+void resampleCascadeFree (ResampleCascade *cxt)
+{
+    int i;
+
+    for (i = 0; i < cxt->numStages; ++i)
+        halfbandFree (cxt->stages [i]);
+
+    if (cxt->resampler)
+        resampleFree (cxt->resampler);
+
+    free (cxt->buffers [0]);
+    free (cxt->buffers [1]);
+    free (cxt);
+}
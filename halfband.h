@@ -0,0 +1,62 @@
+////////////////////////////////////////////////////////////////////////////
+//                         **** HALFBAND ****                             //
+//           Half-band Decimators/Interpolators & Stage Cascades          //
+//                Copyright (c) 2006 - 2022 David Bryant.                 //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// halfband.h
+
+// Note: resampler.h must be included before this header
+
+#define HALFBAND_MAX_COEFFS     256     // unique (non-zero, non-center) coefficients per half-band filter
+#define CASCADE_MAX_STAGES      8       // half-band stages in a cascade (i.e., up to 256x either way)
+
+// A half-band filter has every other coefficient zero (except the center, which is 0.5) and is symmetric,
+// so a filter with numCoeffs unique coefficients has 4 * numCoeffs - 1 taps but only needs numCoeffs
+// multiplies per decimated output (or per interpolated odd output). The decimator keeps the even and odd
+// input phases in separate buffers so that the taps it needs are always contiguous.
+
+typedef struct {
+    int numChannels, numCoeffs, numSamples, interpolate, phase;
+    int evenIndex, oddIndex, outputIndex;
+    float *coeffs, **even, **odd;
+} HalfBand;
+
+// A cascade breaks a large ratio into a chain of 2x half-band stages plus (if still required) one short
+// fractional Resample stage. When downsampling, the half-band decimators come first and the fractional
+// stage runs at the lowest rate; when upsampling, the fractional stage comes first followed by the
+// half-band interpolators. The costs are estimated multiply-accumulates per output frame.
+
+typedef struct {
+    int numChannels, numStages, interpolate, pendingFrames;
+    HalfBand *stages [CASCADE_MAX_STAGES];
+    Resample *resampler;
+    float *buffers [2], *pending;
+    double ratio, lowpassRatio, cascadeCost, singleStageCost;
+} ResampleCascade;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+HalfBand *halfbandInit (int numChannels, int numCoeffs, int interpolate, int flags);
+int halfbandDecimate (HalfBand *hb, const float *input, int numInputFrames, float *output);
+int halfbandInterpolate (HalfBand *hb, const float *input, int numInputFrames, float *output);
+int halfbandDesignCoeffs (double passband, int flags);
+int halfbandGetLatency (HalfBand *hb);
+void halfbandReset (HalfBand *hb);
+void halfbandFree (HalfBand *hb);
+
+ResampleCascade *resampleCascadeInit (int numChannels, double ratio, int numTaps, int numFilters, double lowpassRatio, int flags);
+ResampleResult resampleCascadeProcessInterleaved (ResampleCascade *cxt, const float *input, int numInputFrames, float *output, int numOutputFrames);
+void resampleCascadeAdvancePosition (ResampleCascade *cxt, double delta);
+double resampleCascadeGetDelay (ResampleCascade *cxt);
+int resampleCascadeGetLatency (ResampleCascade *cxt);
+void resampleCascadeReset (ResampleCascade *cxt);
+void resampleCascadeFree (ResampleCascade *cxt);
+
+#ifdef __cplusplus
+}
+#endif
@@ -14,376 +14,2854 @@
 #define M_PI 3.14159265358979324
 #endif
 
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#include <immintrin.h>
+#define RESAMPLER_X86
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RESAMPLER_NEON
+#endif
+
+#if defined(__GNUC__)
+#define TARGET(x) __attribute__ ((target (x)))
+#else
+#define TARGET(x)
+#endif
+
+// Filters are stored with this alignment (enough for AVX-512 aligned loads) and are zero-padded at the
+// end to a multiple of the selected kernel's width, so the kernels never need a scalar tail loop.
+
+#define FILTER_ALIGNMENT 64
+
+// Each filter in the bank starts on its own cache line, and strides that are a multiple of 4 KB get one
+// more line so that walking through the phases doesn't keep hitting the same cache sets. Paired filters
+// alternate blocks of PAIR_BLOCK taps from the filter and from its difference to the next one.
+
+#define FILTER_STRIDE_FLOATS (FILTER_ALIGNMENT / sizeof (float))
+#define PAIR_BLOCK ((int) FILTER_STRIDE_FLOATS)
+
+// The shared filter banks are found and released under a lock so that instances can be created and freed
+// from multiple threads; define RESAMPLER_NO_THREADS for single-threaded targets without pthreads. The lock
+// is only held to search and link the list: a new bank is linked in (marked as generating) before its
+// filters are generated, and an instance that finds a bank still generating waits for it to be finished.
+
+#ifdef RESAMPLER_NO_THREADS
+#define BANK_LOCK()
+#define BANK_UNLOCK()
+#define BANK_WAIT()
+#define BANK_GENERATED()
+#define LAZY_LOCK_INIT(bank)
+#define LAZY_LOCK_FREE(bank)
+#define LAZY_LOCK(bank)
+#define LAZY_UNLOCK(bank)
+#else
+#include <pthread.h>
+static pthread_mutex_t bank_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bank_generated = PTHREAD_COND_INITIALIZER;
+#define BANK_LOCK() pthread_mutex_lock (&bank_mutex)
+#define BANK_UNLOCK() pthread_mutex_unlock (&bank_mutex)
+#define BANK_WAIT() pthread_cond_wait (&bank_generated, &bank_mutex)
+#define BANK_GENERATED() pthread_cond_broadcast (&bank_generated)
+#define LAZY_LOCK_INIT(bank) do { (bank)->lazyLock = malloc (sizeof (pthread_mutex_t)); \
+    pthread_mutex_init ((pthread_mutex_t *) (bank)->lazyLock, NULL); } while (0)
+#define LAZY_LOCK_FREE(bank) do { if ((bank)->lazyLock) { \
+    pthread_mutex_destroy ((pthread_mutex_t *) (bank)->lazyLock); free ((bank)->lazyLock); } } while (0)
+#define LAZY_LOCK(bank) pthread_mutex_lock ((pthread_mutex_t *) (bank)->lazyLock)
+#define LAZY_UNLOCK(bank) pthread_mutex_unlock ((pthread_mutex_t *) (bank)->lazyLock)
+#endif
+
+static ResampleFilterBank *filter_banks;
+
+// The ready flags of a lazy bank are read without any lock (so they're atomic, set only once the filter
+// has been written), and the filters are generated under the bank's own lazyLock (so each is generated
+// only once, without holding up instances using other banks or the list).
+
+#ifdef RESAMPLER_NO_THREADS
+typedef unsigned char ReadyFlag;
+#define FILTER_READY(ready,i) (((ReadyFlag *) (ready)) [i])
+#define SET_FILTER_READY(ready,i) (((ReadyFlag *) (ready)) [i] = 1)
+#else
+#include <stdatomic.h>
+typedef atomic_uchar ReadyFlag;
+#define FILTER_READY(ready,i) atomic_load_explicit ((ReadyFlag *) (ready) + (i), memory_order_acquire)
+#define SET_FILTER_READY(ready,i) atomic_store_explicit ((ReadyFlag *) (ready) + (i), 1, memory_order_release)
+#endif
+
+// The counters in cxt->stats (see resampleGetStats()) cost an increment or two per output frame; define
+// RESAMPLER_NO_STATS to compile them out entirely.
+
+#ifdef RESAMPLER_NO_STATS
+#define STATS_ADD(cxt,counter,n)
+#else
+#define STATS_ADD(cxt,counter,n) ((cxt)->stats.counter += (n))
+#endif
+
+#define STATS_INC(cxt,counter) STATS_ADD (cxt, counter, 1)
+
 // This is the basic convolution operation that is the core of the resampler and utilizes the
 // bulk of the CPU load (assuming reasonably long filters). The first version is the canonical
-// form, followed by three variations that may or may not be faster depending on your compiler,
-// options, and system. Try 'em and use the fastest, or rewrite them using SIMD. Note that on
-// gcc and clang, -Ofast can make a huge difference.
+// form and is always available, followed by SIMD versions for x86 and ARM. The fastest one that
+// the CPU supports is selected once in resampleInit() and stored in the context. Note that on
+// gcc and clang, -Ofast can make a huge difference (especially for the canonical version).
+
+static double apply_filter_scalar (const float *A, const float *B, int num_taps)
+{
+    float sum = 0.0;
+
+    do sum += *A++ * *B++;
+    while (--num_taps);
+
+    return sum;
+}
+
+// The "x4" kernels convolve one filter against four channels of history at once (starting at index
+// "start" of each buffer) so the filter coefficients are only loaded once for all four.
+
+static void apply_filter_x4_scalar (const float *A, float *const *B, int start, int num_taps, float *results)
+{
+    const float *B0 = B [0] + start, *B1 = B [1] + start, *B2 = B [2] + start, *B3 = B [3] + start;
+    float sum0 = 0.0, sum1 = 0.0, sum2 = 0.0, sum3 = 0.0;
+
+    do {
+        float a = *A++;
+        sum0 += a * *B0++;
+        sum1 += a * *B1++;
+        sum2 += a * *B2++;
+        sum3 += a * *B3++;
+    } while (--num_taps);
+
+    results [0] = sum0;
+    results [1] = sum1;
+    results [2] = sum2;
+    results [3] = sum3;
+}
+
+// The "interleaved" kernels are for the INTERLEAVED_HISTORY layout, where each history frame holds
+// "stride" floats (the channel count rounded up to the vector width). The vector lanes run across the
+// channels, so every channel of the frame is produced in one pass and no tap padding is required. The
+// results array must have room for "stride" floats.
+
+static void apply_filter_interleaved_scalar (const float *A, const float *B, int stride, int num_taps, float *results)
+{
+    int i, j;
+
+    for (j = 0; j < stride; ++j)
+        results [j] = 0.0;
+
+    for (i = 0; i < num_taps; ++i, B += stride) {
+        float a = A [i];
+
+        for (j = 0; j < stride; ++j)
+            results [j] += a * B [j];
+    }
+}
+
+#ifdef RESAMPLER_X86
+
+// SSE2: 4 floats per step, num_taps must be a multiple of 4
+
+TARGET ("sse2")
+static double apply_filter_sse2 (const float *A, const float *B, int num_taps)
+{
+    __m128 sum0 = _mm_setzero_ps (), sum1 = _mm_setzero_ps ();
+
+    for (; num_taps >= 8; num_taps -= 8, A += 8, B += 8) {
+        sum0 = _mm_add_ps (sum0, _mm_mul_ps (_mm_load_ps (A), _mm_loadu_ps (B)));
+        sum1 = _mm_add_ps (sum1, _mm_mul_ps (_mm_load_ps (A + 4), _mm_loadu_ps (B + 4)));
+    }
+
+    if (num_taps)
+        sum0 = _mm_add_ps (sum0, _mm_mul_ps (_mm_load_ps (A), _mm_loadu_ps (B)));
+
+    sum0 = _mm_add_ps (sum0, sum1);
+    sum0 = _mm_add_ps (sum0, _mm_shuffle_ps (sum0, sum0, _MM_SHUFFLE (1, 0, 3, 2)));
+    sum0 = _mm_add_ss (sum0, _mm_shuffle_ps (sum0, sum0, _MM_SHUFFLE (2, 3, 0, 1)));
+
+    return _mm_cvtss_f32 (sum0);
+}
+
+TARGET ("sse2")
+static void apply_filter_x4_sse2 (const float *A, float *const *B, int start, int num_taps, float *results)
+{
+    const float *B0 = B [0] + start, *B1 = B [1] + start, *B2 = B [2] + start, *B3 = B [3] + start;
+    __m128 sum0 = _mm_setzero_ps (), sum1 = _mm_setzero_ps (), sum2 = _mm_setzero_ps (), sum3 = _mm_setzero_ps ();
+    int i;
+
+    for (i = 0; i < num_taps; i += 4) {
+        __m128 a = _mm_load_ps (A + i);
+        sum0 = _mm_add_ps (sum0, _mm_mul_ps (a, _mm_loadu_ps (B0 + i)));
+        sum1 = _mm_add_ps (sum1, _mm_mul_ps (a, _mm_loadu_ps (B1 + i)));
+        sum2 = _mm_add_ps (sum2, _mm_mul_ps (a, _mm_loadu_ps (B2 + i)));
+        sum3 = _mm_add_ps (sum3, _mm_mul_ps (a, _mm_loadu_ps (B3 + i)));
+    }
+
+    _MM_TRANSPOSE4_PS (sum0, sum1, sum2, sum3);
+    _mm_storeu_ps (results, _mm_add_ps (_mm_add_ps (sum0, sum1), _mm_add_ps (sum2, sum3)));
+}
+
+// stride must be a multiple of 4, num_taps must be even
+
+TARGET ("sse2")
+static void apply_filter_interleaved_sse2 (const float *A, const float *B, int stride, int num_taps, float *results)
+{
+    int i, j;
+
+    for (j = 0; j < stride; j += 4) {
+        __m128 sum0 = _mm_setzero_ps (), sum1 = _mm_setzero_ps ();
+        const float *b = B + j;
+
+        for (i = 0; i < num_taps; i += 2, b += stride * 2) {
+            sum0 = _mm_add_ps (sum0, _mm_mul_ps (_mm_set1_ps (A [i]), _mm_load_ps (b)));
+            sum1 = _mm_add_ps (sum1, _mm_mul_ps (_mm_set1_ps (A [i+1]), _mm_load_ps (b + stride)));
+        }
+
+        _mm_storeu_ps (results + j, _mm_add_ps (sum0, sum1));
+    }
+}
+
+// AVX2 + FMA: 8 floats per step, num_taps must be a multiple of 8
+
+TARGET ("avx2,fma")
+static double apply_filter_avx2 (const float *A, const float *B, int num_taps)
+{
+    __m256 sum0 = _mm256_setzero_ps (), sum1 = _mm256_setzero_ps ();
+    __m128 sum;
+
+    for (; num_taps >= 16; num_taps -= 16, A += 16, B += 16) {
+        sum0 = _mm256_fmadd_ps (_mm256_load_ps (A), _mm256_loadu_ps (B), sum0);
+        sum1 = _mm256_fmadd_ps (_mm256_load_ps (A + 8), _mm256_loadu_ps (B + 8), sum1);
+    }
+
+    if (num_taps)
+        sum0 = _mm256_fmadd_ps (_mm256_load_ps (A), _mm256_loadu_ps (B), sum0);
+
+    sum0 = _mm256_add_ps (sum0, sum1);
+    sum = _mm_add_ps (_mm256_castps256_ps128 (sum0), _mm256_extractf128_ps (sum0, 1));
+    sum = _mm_add_ps (sum, _mm_movehl_ps (sum, sum));
+    sum = _mm_add_ss (sum, _mm_movehdup_ps (sum));
+
+    return _mm_cvtss_f32 (sum);
+}
+
+TARGET ("avx2,fma")
+static inline __m128 hsum4_avx (__m256 sum0, __m256 sum1, __m256 sum2, __m256 sum3)
+{
+    __m256 sum01 = _mm256_hadd_ps (sum0, sum1), sum23 = _mm256_hadd_ps (sum2, sum3);
+    __m256 sum = _mm256_hadd_ps (sum01, sum23);
+
+    return _mm_add_ps (_mm256_castps256_ps128 (sum), _mm256_extractf128_ps (sum, 1));
+}
+
+TARGET ("avx2,fma")
+static void apply_filter_x4_avx2 (const float *A, float *const *B, int start, int num_taps, float *results)
+{
+    const float *B0 = B [0] + start, *B1 = B [1] + start, *B2 = B [2] + start, *B3 = B [3] + start;
+    __m256 sum0 = _mm256_setzero_ps (), sum1 = _mm256_setzero_ps (), sum2 = _mm256_setzero_ps (), sum3 = _mm256_setzero_ps ();
+    int i;
+
+    for (i = 0; i < num_taps; i += 8) {
+        __m256 a = _mm256_load_ps (A + i);
+        sum0 = _mm256_fmadd_ps (a, _mm256_loadu_ps (B0 + i), sum0);
+        sum1 = _mm256_fmadd_ps (a, _mm256_loadu_ps (B1 + i), sum1);
+        sum2 = _mm256_fmadd_ps (a, _mm256_loadu_ps (B2 + i), sum2);
+        sum3 = _mm256_fmadd_ps (a, _mm256_loadu_ps (B3 + i), sum3);
+    }
+
+    _mm_storeu_ps (results, hsum4_avx (sum0, sum1, sum2, sum3));
+}
+
+// stride must be a multiple of 4 (groups of 8 channels use full AVX registers), num_taps must be even;
+// the helper starts at channel "j" so the AVX-512 version can use it for its leftover channels
+
+TARGET ("avx2,fma")
+static void interleaved_avx2 (const float *A, const float *B, int j, int stride, int num_taps, float *results)
+{
+    int i;
+
+    for (; j + 8 <= stride; j += 8) {
+        __m256 sum0 = _mm256_setzero_ps (), sum1 = _mm256_setzero_ps ();
+        const float *b = B + j;
+
+        for (i = 0; i < num_taps; i += 2, b += stride * 2) {
+            sum0 = _mm256_fmadd_ps (_mm256_set1_ps (A [i]), _mm256_loadu_ps (b), sum0);
+            sum1 = _mm256_fmadd_ps (_mm256_set1_ps (A [i+1]), _mm256_loadu_ps (b + stride), sum1);
+        }
+
+        _mm256_storeu_ps (results + j, _mm256_add_ps (sum0, sum1));
+    }
+
+    if (j < stride) {
+        __m128 sum0 = _mm_setzero_ps (), sum1 = _mm_setzero_ps ();
+        const float *b = B + j;
+
+        for (i = 0; i < num_taps; i += 2, b += stride * 2) {
+            sum0 = _mm_fmadd_ps (_mm_set1_ps (A [i]), _mm_load_ps (b), sum0);
+            sum1 = _mm_fmadd_ps (_mm_set1_ps (A [i+1]), _mm_load_ps (b + stride), sum1);
+        }
+
+        _mm_storeu_ps (results + j, _mm_add_ps (sum0, sum1));
+    }
+}
+
+TARGET ("avx2,fma")
+static void apply_filter_interleaved_avx2 (const float *A, const float *B, int stride, int num_taps, float *results)
+{
+    interleaved_avx2 (A, B, 0, stride, num_taps, results);
+}
+
+// AVX-512F: 16 floats per step, num_taps must be a multiple of 16
+
+TARGET ("avx512f")
+static double apply_filter_avx512 (const float *A, const float *B, int num_taps)
+{
+    __m512 sum0 = _mm512_setzero_ps (), sum1 = _mm512_setzero_ps ();
+
+    for (; num_taps >= 32; num_taps -= 32, A += 32, B += 32) {
+        sum0 = _mm512_fmadd_ps (_mm512_load_ps (A), _mm512_loadu_ps (B), sum0);
+        sum1 = _mm512_fmadd_ps (_mm512_load_ps (A + 16), _mm512_loadu_ps (B + 16), sum1);
+    }
+
+    if (num_taps)
+        sum0 = _mm512_fmadd_ps (_mm512_load_ps (A), _mm512_loadu_ps (B), sum0);
+
+    return _mm512_reduce_add_ps (_mm512_add_ps (sum0, sum1));
+}
+
+TARGET ("avx512f")
+static void apply_filter_x4_avx512 (const float *A, float *const *B, int start, int num_taps, float *results)
+{
+    const float *B0 = B [0] + start, *B1 = B [1] + start, *B2 = B [2] + start, *B3 = B [3] + start;
+    __m512 sum0 = _mm512_setzero_ps (), sum1 = _mm512_setzero_ps (), sum2 = _mm512_setzero_ps (), sum3 = _mm512_setzero_ps ();
+    int i;
+
+    for (i = 0; i < num_taps; i += 16) {
+        __m512 a = _mm512_load_ps (A + i);
+        sum0 = _mm512_fmadd_ps (a, _mm512_loadu_ps (B0 + i), sum0);
+        sum1 = _mm512_fmadd_ps (a, _mm512_loadu_ps (B1 + i), sum1);
+        sum2 = _mm512_fmadd_ps (a, _mm512_loadu_ps (B2 + i), sum2);
+        sum3 = _mm512_fmadd_ps (a, _mm512_loadu_ps (B3 + i), sum3);
+    }
+
+    results [0] = _mm512_reduce_add_ps (sum0);
+    results [1] = _mm512_reduce_add_ps (sum1);
+    results [2] = _mm512_reduce_add_ps (sum2);
+    results [3] = _mm512_reduce_add_ps (sum3);
+}
+
+// stride must be a multiple of 4 (groups of 16 channels use full AVX-512 registers), num_taps must be even
+
+TARGET ("avx512f")
+static void apply_filter_interleaved_avx512 (const float *A, const float *B, int stride, int num_taps, float *results)
+{
+    int i, j;
+
+    for (j = 0; j + 16 <= stride; j += 16) {
+        __m512 sum0 = _mm512_setzero_ps (), sum1 = _mm512_setzero_ps ();
+        const float *b = B + j;
+
+        for (i = 0; i < num_taps; i += 2, b += stride * 2) {
+            sum0 = _mm512_fmadd_ps (_mm512_set1_ps (A [i]), _mm512_loadu_ps (b), sum0);
+            sum1 = _mm512_fmadd_ps (_mm512_set1_ps (A [i+1]), _mm512_loadu_ps (b + stride), sum1);
+        }
+
+        _mm512_storeu_ps (results + j, _mm512_add_ps (sum0, sum1));
+    }
+
+    if (j < stride)
+        interleaved_avx2 (A, B, j, stride, num_taps, results);
+}
+
+#endif
+
+#ifdef RESAMPLER_NEON
+
+// NEON: 4 floats per step, num_taps must be a multiple of 4
+
+static double apply_filter_neon (const float *A, const float *B, int num_taps)
+{
+    float32x4_t sum0 = vdupq_n_f32 (0.0F), sum1 = vdupq_n_f32 (0.0F);
+
+    for (; num_taps >= 8; num_taps -= 8, A += 8, B += 8) {
+        sum0 = vmlaq_f32 (sum0, vld1q_f32 (A), vld1q_f32 (B));
+        sum1 = vmlaq_f32 (sum1, vld1q_f32 (A + 4), vld1q_f32 (B + 4));
+    }
+
+    if (num_taps)
+        sum0 = vmlaq_f32 (sum0, vld1q_f32 (A), vld1q_f32 (B));
+
+    sum0 = vaddq_f32 (sum0, sum1);
+#if defined(__aarch64__)
+    return vaddvq_f32 (sum0);
+#else
+    float32x2_t sum = vadd_f32 (vget_low_f32 (sum0), vget_high_f32 (sum0));
+    return vget_lane_f32 (vpadd_f32 (sum, sum), 0);
+#endif
+}
+
+static void apply_filter_x4_neon (const float *A, float *const *B, int start, int num_taps, float *results)
+{
+    const float *B0 = B [0] + start, *B1 = B [1] + start, *B2 = B [2] + start, *B3 = B [3] + start;
+    float32x4_t sum0 = vdupq_n_f32 (0.0F), sum1 = vdupq_n_f32 (0.0F), sum2 = vdupq_n_f32 (0.0F), sum3 = vdupq_n_f32 (0.0F);
+    int i;
+
+    for (i = 0; i < num_taps; i += 4) {
+        float32x4_t a = vld1q_f32 (A + i);
+        sum0 = vmlaq_f32 (sum0, a, vld1q_f32 (B0 + i));
+        sum1 = vmlaq_f32 (sum1, a, vld1q_f32 (B1 + i));
+        sum2 = vmlaq_f32 (sum2, a, vld1q_f32 (B2 + i));
+        sum3 = vmlaq_f32 (sum3, a, vld1q_f32 (B3 + i));
+    }
+
+#if defined(__aarch64__)
+    float32x4_t sum = vpaddq_f32 (vpaddq_f32 (sum0, sum1), vpaddq_f32 (sum2, sum3));
+#else
+    float32x2_t sum01 = vpadd_f32 (vadd_f32 (vget_low_f32 (sum0), vget_high_f32 (sum0)), vadd_f32 (vget_low_f32 (sum1), vget_high_f32 (sum1)));
+    float32x2_t sum23 = vpadd_f32 (vadd_f32 (vget_low_f32 (sum2), vget_high_f32 (sum2)), vadd_f32 (vget_low_f32 (sum3), vget_high_f32 (sum3)));
+    float32x4_t sum = vcombine_f32 (sum01, sum23);
+#endif
+    vst1q_f32 (results, sum);
+}
+
+// stride must be a multiple of 4, num_taps must be even
+
+static void apply_filter_interleaved_neon (const float *A, const float *B, int stride, int num_taps, float *results)
+{
+    int i, j;
+
+    for (j = 0; j < stride; j += 4) {
+        float32x4_t sum0 = vdupq_n_f32 (0.0F), sum1 = vdupq_n_f32 (0.0F);
+        const float *b = B + j;
+
+        for (i = 0; i < num_taps; i += 2, b += stride * 2) {
+            sum0 = vmlaq_n_f32 (sum0, vld1q_f32 (b), A [i]);
+            sum1 = vmlaq_n_f32 (sum1, vld1q_f32 (b + stride), A [i+1]);
+        }
+
+        vst1q_f32 (results + j, vaddq_f32 (sum0, sum1));
+    }
+}
+
+#endif
+
+// Reduced-precision kernels. The Q15 kernels multiply Q15 filters with the Q31 history into a 64-bit
+// (Q46) accumulator, which can't overflow with any filter this code generates. The half-precision kernels
+// convert IEEE fp16 filters to float and accumulate in float, just like the regular kernels. Unlike the
+// float versions, these only come in the single-channel form.
+
+static inline float half_to_float (uint16_t half)
+{
+    uint32_t sign = (uint32_t) (half & 0x8000) << 16, exponent = (half >> 10) & 0x1f, mantissa = half & 0x3ff;
+    float value;
+
+    if (!exponent)                                  // zero or subnormal
+        value = mantissa * (1.0F / 16777216.0F);
+    else if (exponent == 31)                        // never generated, so just make these large
+        value = 65536.0F;
+    else {
+        uint32_t bits = ((exponent + 112) << 23) | (mantissa << 13);
+        memcpy (&value, &bits, sizeof (value));
+    }
+
+    return sign ? -value : value;
+}
+
+static int64_t apply_filter_q15_scalar (const int16_t *A, const int32_t *B, int num_taps)
+{
+    int64_t sum = 0;
+
+    do sum += (int64_t) *A++ * *B++;
+    while (--num_taps);
+
+    return sum;
+}
+
+static double apply_filter_half_scalar (const uint16_t *A, const float *B, int num_taps)
+{
+    float sum = 0.0;
+
+    do sum += half_to_float (*A++) * *B++;
+    while (--num_taps);
+
+    return sum;
+}
+
+#ifdef RESAMPLER_X86
+
+// AVX2: 8 taps per step; _mm256_mul_epi32() only multiplies the even
+// 32-bit lanes into 64-bit products, so the odd lanes are shifted down and done separately
+
+TARGET ("avx2")
+static int64_t apply_filter_q15_avx2 (const int16_t *A, const int32_t *B, int num_taps)
+{
+    __m256i sum = _mm256_setzero_si256 ();
+    __m128i sum2;
+
+    for (; num_taps; num_taps -= 8, A += 8, B += 8) {
+        __m256i a = _mm256_cvtepi16_epi32 (_mm_load_si128 ((const __m128i *) A));
+        __m256i b = _mm256_loadu_si256 ((const __m256i *) B);
+
+        sum = _mm256_add_epi64 (sum, _mm256_mul_epi32 (a, b));
+        sum = _mm256_add_epi64 (sum, _mm256_mul_epi32 (_mm256_srli_epi64 (a, 32), _mm256_srli_epi64 (b, 32)));
+    }
+
+    sum2 = _mm_add_epi64 (_mm256_castsi256_si128 (sum), _mm256_extracti128_si256 (sum, 1));
+    return _mm_cvtsi128_si64 (_mm_add_epi64 (sum2, _mm_unpackhi_epi64 (sum2, sum2)));
+}
+
+// The half-precision version also needs F16C (for the conversion) and FMA, which AVX2 doesn't imply, so
+// select_kernel() only uses it when the CPU reports F16C too.
+
+TARGET ("avx2,fma,f16c")
+static double apply_filter_half_avx2 (const uint16_t *A, const float *B, int num_taps)
+{
+    __m256 sum0 = _mm256_setzero_ps ();
+    __m128 sum;
+
+    for (; num_taps; num_taps -= 8, A += 8, B += 8)
+        sum0 = _mm256_fmadd_ps (_mm256_cvtph_ps (_mm_load_si128 ((const __m128i *) A)), _mm256_loadu_ps (B), sum0);
+
+    sum = _mm_add_ps (_mm256_castps256_ps128 (sum0), _mm256_extractf128_ps (sum0, 1));
+    sum = _mm_add_ps (sum, _mm_movehl_ps (sum, sum));
+    sum = _mm_add_ss (sum, _mm_movehdup_ps (sum));
+
+    return _mm_cvtss_f32 (sum);
+}
+
+// AVX-512F: 16 taps per step
+
+TARGET ("avx512f")
+static double apply_filter_half_avx512 (const uint16_t *A, const float *B, int num_taps)
+{
+    __m512 sum0 = _mm512_setzero_ps ();
+
+    for (; num_taps; num_taps -= 16, A += 16, B += 16)
+        sum0 = _mm512_fmadd_ps (_mm512_cvtph_ps (_mm256_load_si256 ((const __m256i *) A)), _mm512_loadu_ps (B), sum0);
+
+    return _mm512_reduce_add_ps (sum0);
+}
+
+#endif
+
+#ifdef RESAMPLER_NEON
+
+// NEON: 4 taps per step (the half-precision conversion is only available on AArch64)
+
+static int64_t apply_filter_q15_neon (const int16_t *A, const int32_t *B, int num_taps)
+{
+    int64x2_t sum = vdupq_n_s64 (0);
+
+    for (; num_taps; num_taps -= 4, A += 4, B += 4) {
+        int32x4_t a = vmovl_s16 (vld1_s16 (A)), b = vld1q_s32 (B);
+
+        sum = vmlal_s32 (sum, vget_low_s32 (a), vget_low_s32 (b));
+        sum = vmlal_s32 (sum, vget_high_s32 (a), vget_high_s32 (b));
+    }
+
+    return vgetq_lane_s64 (sum, 0) + vgetq_lane_s64 (sum, 1);
+}
+
+#if defined(__aarch64__)
+static double apply_filter_half_neon (const uint16_t *A, const float *B, int num_taps)
+{
+    float32x4_t sum0 = vdupq_n_f32 (0.0F);
+
+    for (; num_taps; num_taps -= 4, A += 4, B += 4)
+        sum0 = vmlaq_f32 (sum0, vcvt_f32_f16 (vreinterpret_f16_u16 (vld1_u16 (A))), vld1q_f32 (B));
+
+    return vaddvq_f32 (sum0);
+}
+#else
+#define apply_filter_half_neon apply_filter_half_scalar
+#endif
+
+#endif
+
+#define SET_KERNELS(cxt,isa) do { \
+    (cxt)->applyFilter = apply_filter_##isa; \
+    (cxt)->applyFilterX4 = apply_filter_x4_##isa; \
+    (cxt)->applyFilterInterleaved = apply_filter_interleaved_##isa; \
+} while (0)
+
+#define SET_REDUCED_KERNELS(cxt,q15,half) do { \
+    (cxt)->applyFilterQ15 = apply_filter_q15_##q15; \
+    (cxt)->applyFilterHalf = apply_filter_half_##half; \
+} while (0)
+
+#if defined(RESAMPLER_X86)
+static int cpu_supports_f16c (void)
+{
+#if defined(__GNUC__)
+    __builtin_cpu_init ();
+    return __builtin_cpu_supports ("f16c");
+#else
+    return 0;
+#endif
+}
+#endif
+
+// The kernel variant that resampleSetKernel() has forced (for benchmarking and testing), or AUTO.
+
+static int forced_kernel = RESAMPLE_KERNEL_AUTO;
+
+// Return TRUE if the specified kernel variant is built in and the CPU supports it.
+
+int resampleKernelAvailable (int kernel)
+{
+    switch (kernel) {
+        case RESAMPLE_KERNEL_AUTO:
+        case RESAMPLE_KERNEL_SCALAR:
+            return 1;
+
+#if defined(RESAMPLER_X86) && defined(__GNUC__)
+        case RESAMPLE_KERNEL_SSE2:
+            __builtin_cpu_init ();
+            return __builtin_cpu_supports ("sse2");
+
+        case RESAMPLE_KERNEL_AVX2:
+            __builtin_cpu_init ();
+            return __builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma");
+
+        case RESAMPLE_KERNEL_AVX512:
+            __builtin_cpu_init ();
+            return __builtin_cpu_supports ("avx512f");
+#elif defined(RESAMPLER_X86) && defined(_M_X64)
+        case RESAMPLE_KERNEL_SSE2:
+            return 1;
+#elif defined(RESAMPLER_NEON)
+        case RESAMPLE_KERNEL_NEON:
+            return 1;
+#endif
+        default:
+            return 0;
+    }
+}
+
+const char *resampleGetKernelName (int kernel)
+{
+    static const char *names [] = { "auto", "scalar", "sse2", "avx2", "avx512", "neon" };
+
+    return kernel >= 0 && kernel < (int) (sizeof (names) / sizeof (names [0])) ? names [kernel] : "unknown";
+}
+
+// Force the specified kernel variant for the resamplers initialized from now on (RESAMPLE_KERNEL_AUTO
+// restores the normal selection). Returns FALSE (and changes nothing) if it's not available. Note that this
+// is global and is not meant to be changed while other threads are initializing resamplers.
+
+int resampleSetKernel (int kernel)
+{
+    if (!resampleKernelAvailable (kernel))
+        return 0;
+
+    forced_kernel = kernel;
+    return 1;
+}
+
+// Set the kernels in the context to the forced variant (or else the widest ones this CPU supports) and
+// return the number of floats they process per step (the filters are padded to a multiple of this, and
+// it's also the preferred channel stride for the interleaved history layout). The AVX2 half-precision
+// kernel also needs F16C, which isn't implied by AVX2, so without it the scalar one is used.
+
+static int select_kernel (Resample *cxt)
+{
+    int kernel = forced_kernel;
+
+    if (kernel == RESAMPLE_KERNEL_AUTO) {
+        static const int preferred [] = { RESAMPLE_KERNEL_AVX512, RESAMPLE_KERNEL_AVX2, RESAMPLE_KERNEL_SSE2, RESAMPLE_KERNEL_NEON };
+        int i;
+
+        for (kernel = RESAMPLE_KERNEL_SCALAR, i = 0; i < (int) (sizeof (preferred) / sizeof (preferred [0])); ++i)
+            if (resampleKernelAvailable (preferred [i])) {
+                kernel = preferred [i];
+                break;
+            }
+    }
+
+    cxt->kernel = kernel;
+
+    switch (kernel) {
+#if defined(RESAMPLER_X86)
+        case RESAMPLE_KERNEL_AVX512:
+            SET_KERNELS (cxt, avx512);
+            SET_REDUCED_KERNELS (cxt, avx2, avx512);
+            return 16;
+
+        case RESAMPLE_KERNEL_AVX2:
+            SET_KERNELS (cxt, avx2);
+
+            if (cpu_supports_f16c ())
+                SET_REDUCED_KERNELS (cxt, avx2, avx2);
+            else
+                SET_REDUCED_KERNELS (cxt, avx2, scalar);
+
+            return 8;
+
+        case RESAMPLE_KERNEL_SSE2:
+            SET_KERNELS (cxt, sse2);
+            SET_REDUCED_KERNELS (cxt, scalar, scalar);
+            return 4;
+#elif defined(RESAMPLER_NEON)
+        case RESAMPLE_KERNEL_NEON:
+            SET_KERNELS (cxt, neon);
+            SET_REDUCED_KERNELS (cxt, neon, neon);
+            return 4;
+#endif
+        default:
+            cxt->kernel = RESAMPLE_KERNEL_SCALAR;
+            SET_KERNELS (cxt, scalar);
+            SET_REDUCED_KERNELS (cxt, scalar, scalar);
+            return 4;
+    }
+}
+
+// Allocate zeroed memory aligned to FILTER_ALIGNMENT bytes (the original pointer is stashed just
+// before the returned block so that aligned_free() can find it).
+
+static void *aligned_calloc (size_t num_bytes)
+{
+    unsigned char *raw = calloc (num_bytes + FILTER_ALIGNMENT + sizeof (void *), 1), *aligned;
+
+    if (!raw)
+        return NULL;
+
+    aligned = raw + sizeof (void *);
+    aligned += (FILTER_ALIGNMENT - ((uintptr_t) aligned & (FILTER_ALIGNMENT - 1))) & (FILTER_ALIGNMENT - 1);
+    ((void **) aligned) [-1] = raw;
+    return aligned;
+}
+
+static void aligned_free (void *ptr)
+{
+    if (ptr)
+        free (((void **) ptr) [-1]);
+}
+
+// "dist" is the absolute distance from the sinc maximum to the filter tap to be calculated, in radians
+// "ratio" is that distance divided by half the tap count such that it reaches π at the window extremes
+
+// Note that with this scaling, the odd terms of the Blackman-Harris calculation appear to be negated
+// with respect to the reference formula version.
+
+static double windowed_sinc (Resample *cxt, double dist, double lowpass_ratio)
+{
+    const double a0 = 0.35875;
+    const double a1 = 0.48829;
+    const double a2 = 0.14128;
+    const double a3 = 0.01168;
+    double ratio = dist / (cxt->numTaps / 2);
+    double value;
+
+    if (dist == 0.0)
+        return 1.0;
+
+    value = sin (dist * lowpass_ratio) / (dist * lowpass_ratio);
+
+    if (cxt->flags & BLACKMAN_HARRIS)
+        value *= a0 + a1 * cos (ratio) + a2 * cos (2 * ratio) + a3 * cos (3 * ratio);
+    else
+        value *= 0.5 * (1.0 + cos (ratio));     // Hann window
+
+    return value;
+}
+
+static void init_filter (Resample *cxt, float *filter, double fraction, double lowpass_ratio)
+{
+    double filter_sum = 0.0;
+    int i;
+
+    for (i = 0; i < cxt->numTaps; ++i)
+        filter_sum += cxt->tempFilter [i] = windowed_sinc (cxt, fabs ((cxt->numTaps / 2 - 1) + fraction - i) * M_PI, lowpass_ratio);
+
+    // filter should have unity DC gain
+
+    double scaler = 1.0 / filter_sum, error = 0.0;
+
+    for (i = cxt->numTaps / 2; i < cxt->numTaps; i = cxt->numTaps - i - (i >= cxt->numTaps / 2)) {
+        filter [i] = (cxt->tempFilter [i] *= scaler) - error;
+        error += filter [i] - cxt->tempFilter [i];
+    }
+}
+
+// Minimum-phase filters (MINIMUM_PHASE) are made from the windowed sinc sampled at the full resolution of
+// the bank (numTaps * numFilters + 1 points, which are exactly the taps of all the phases) with the
+// cepstral method: the log magnitude of its spectrum is transformed, folded onto the positive quefrencies
+// and transformed back and exponentiated, which gives the minimum-phase response with the same magnitude
+// (and so the same stopband). The FFT size is 4 times the prototype (less for the very largest banks) to
+// keep the cepstral aliasing down, and the magnitude is floored at -200 dB for the logarithm.
+
+#define MIN_PHASE_MAX_FFT   (1 << 22)
+
+static void fft (double *re, double *im, int n, const double *cosines, const double *sines, int inverse)
+{
+    int i, j, k, len;
+
+    for (i = 1, j = 0; i < n; ++i) {
+        int bit = n >> 1;
+
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+
+        if (i < (j ^= bit)) {
+            double temp = re [i]; re [i] = re [j]; re [j] = temp;
+            temp = im [i]; im [i] = im [j]; im [j] = temp;
+        }
+    }
+
+    for (len = 2; len <= n; len <<= 1) {
+        int half = len >> 1, step = n / len;
+
+        for (i = 0; i < n; i += len)
+            for (k = 0; k < half; ++k) {
+                double wr = cosines [k * step], wi = inverse ? sines [k * step] : -sines [k * step];
+                double *ar = re + i + k, *ai = im + i + k;
+                double xr = ar [half] * wr - ai [half] * wi, xi = ar [half] * wi + ai [half] * wr;
+
+                ar [half] = *ar - xr; ai [half] = *ai - xi;
+                *ar += xr; *ai += xi;
+            }
+    }
+
+    if (inverse)
+        for (i = 0; i < n; ++i) {
+            re [i] /= n;
+            im [i] /= n;
+        }
+}
+
+// Return the minimum-phase prototype (starting at the most recent input sample, i.e., the end of the
+// filters) and its group delay at DC in input frames.
+
+static double *min_phase_prototype (Resample *cxt, double lowpass_ratio, double *group_delay)
+{
+    int length = cxt->numTaps * cxt->numFilters + 1, size = 2, i;
+    double *re, *im, *cosines, *sines, *prototype, peak = 0.0, sum = 0.0, moment = 0.0;
+
+    while (size < length * 4 && size < MIN_PHASE_MAX_FFT)
+        size <<= 1;
+
+    while (size < length * 2)
+        size <<= 1;
+
+    re = calloc (size, sizeof (double));
+    im = calloc (size, sizeof (double));
+    cosines = malloc (size / 2 * sizeof (double));
+    sines = malloc (size / 2 * sizeof (double));
+    prototype = malloc (length * sizeof (double));
+
+    for (i = 0; i < size / 2; ++i) {
+        cosines [i] = cos (2.0 * M_PI * i / size);
+        sines [i] = sin (2.0 * M_PI * i / size);
+    }
+
+    for (i = 0; i < length; ++i)
+        re [i] = windowed_sinc (cxt, fabs ((double) i / cxt->numFilters - cxt->numTaps / 2) * M_PI, lowpass_ratio);
+
+    fft (re, im, size, cosines, sines, 0);
+
+    for (i = 0; i < size; ++i) {
+        re [i] = sqrt (re [i] * re [i] + im [i] * im [i]);
+        im [i] = 0.0;
+
+        if (re [i] > peak)
+            peak = re [i];
+    }
+
+    for (i = 0; i < size; ++i)
+        re [i] = log (re [i] > peak * 1e-10 ? re [i] : peak * 1e-10);
+
+    fft (re, im, size, cosines, sines, 1);      // the real cepstrum
+
+    for (i = 0; i < size; ++i) {
+        if (i > size / 2)
+            re [i] = 0.0;
+        else if (i && i < size / 2)
+            re [i] *= 2.0;
+
+        im [i] = 0.0;
+    }
+
+    fft (re, im, size, cosines, sines, 0);
+
+    for (i = 0; i < size; ++i) {
+        double magnitude = exp (re [i]);
+
+        re [i] = magnitude * cos (im [i]);
+        im [i] = magnitude * sin (im [i]);
+    }
+
+    fft (re, im, size, cosines, sines, 1);
+
+    for (i = 0; i < length; ++i) {
+        sum += prototype [i] = re [i];
+        moment += re [i] * i;
+    }
+
+    *group_delay = moment / sum / cxt->numFilters;
+
+    free (re); free (im);
+    free (cosines); free (sines);
+    return prototype;
+}
+
+// Take the filter for the given phase out of a minimum-phase prototype (the prototype runs backward
+// through the taps, from the most recent input sample) and normalize it like init_filter() does.
+
+static void init_filter_min_phase (Resample *cxt, const double *prototype, float *filter, int phase)
+{
+    double filter_sum = 0.0, scaler, error = 0.0;
+    int i;
+
+    for (i = 0; i < cxt->numTaps; ++i)
+        filter_sum += cxt->tempFilter [i] = prototype [(cxt->numTaps - 1 - i) * cxt->numFilters + phase];
+
+    for (scaler = 1.0 / filter_sum, i = 0; i < cxt->numTaps; ++i) {
+        filter [i] = (cxt->tempFilter [i] *= scaler) - error;
+        error += filter [i] - cxt->tempFilter [i];
+    }
+}
+
+static void design_filter (Resample *cxt, const double *prototype, float *filter, int phase, double lowpass_ratio)
+{
+    if (prototype)
+        init_filter_min_phase (cxt, prototype, filter, phase);
+    else
+        init_filter (cxt, filter, (double) phase / cxt->numFilters, lowpass_ratio);
+}
+
+// Convert a float to IEEE half precision (round to nearest even, including subnormals), for FP16_FILTERS.
+
+static uint16_t float_to_half (float value)
+{
+    uint32_t bits, sign, mantissa;
+    int exponent;
+
+    memcpy (&bits, &value, sizeof (bits));
+    sign = (bits >> 16) & 0x8000;
+    exponent = (int) ((bits >> 23) & 0xff) - 112;
+    mantissa = bits & 0x7fffff;
+
+    if (exponent >= 31)                             // overflow (can't happen with these filters)
+        return sign | 0x7bff;
+
+    if (exponent <= 0) {                            // subnormal or zero
+        if (exponent < -10)
+            return sign;
+
+        mantissa |= 0x800000;
+        bits = mantissa >> (14 - exponent);
+
+        if ((mantissa >> (13 - exponent) & 1) && ((mantissa & ((1U << (13 - exponent)) - 1)) || (bits & 1)))
+            bits++;
+
+        return sign | bits;
+    }
+
+    bits = (exponent << 10) | (mantissa >> 13);
+
+    if ((mantissa & 0x1000) && ((mantissa & 0xfff) || (bits & 1)))
+        bits++;                                     // may carry into the exponent, which is correct
+
+    return sign | bits;
+}
+
+// Convert one float filter to the bank's reduced-precision format. The Q15 rounding error is carried from
+// tap to tap (so the DC gain is preserved), and the center tap of the unfiltered phase 0 filter (which is
+// exactly 1.0) is clipped to the largest Q15 value.
+
+static void reduce_filter (const float *filter, void *reduced, int num_taps, int format)
+{
+    double error = 0.0;
+    int i;
+
+    if (format == FP16_FILTERS) {
+        for (i = 0; i < num_taps; ++i)
+            ((uint16_t *) reduced) [i] = float_to_half (filter [i]);
+
+        return;
+    }
+
+    for (i = 0; i < num_taps; ++i) {
+        double value = filter [i] * 32768.0 + error;
+        long rounded = lrint (value);
+
+        if (rounded > 32767)
+            rounded = 32767;
+        else if (rounded < -32768)
+            rounded = -32768;
+
+        ((int16_t *) reduced) [i] = (int16_t) rounded;
+        error = value - rounded;
+    }
+}
+
+// The bank geometry follows from the instance's parameters: the filters are padded out to whole cache
+// lines (with twice as many 16-bit values per line for the reduced formats), avoiding strides that are a
+// multiple of the page size. Note that we actually have one more than the specified number of filters.
+
+static int filter_stride (int filter_taps, int format)
+{
+    int line = format ? FILTER_STRIDE_FLOATS * 2 : FILTER_STRIDE_FLOATS;
+    int stride = (filter_taps + line - 1) / line * line;
+
+    if (!(stride % (4096 / (format ? sizeof (int16_t) : sizeof (float)))))
+        stride += line;
+
+    return stride;
+}
+
+static int bank_stored_filters (Resample *cxt)
+{
+    return (cxt->flags & COMPACT_FILTERS) ? cxt->numFilters / 2 + 1 : cxt->numFilters + 1;
+}
+
+static void init_bank_params (Resample *cxt, ResampleFilterBank *bank, double lowpass_ratio)
+{
+    bank->numTaps = cxt->numTaps;
+    bank->numFilters = cxt->numFilters;
+    bank->filterTaps = cxt->filterTaps;
+    bank->window = cxt->flags & BLACKMAN_HARRIS;
+    bank->paired = (cxt->flags & PAIRED_FILTERS) ? 1 : 0;
+    bank->compact = (cxt->flags & COMPACT_FILTERS) ? 1 : 0;
+    bank->format = cxt->flags & (Q15_FILTERS | FP16_FILTERS);
+    bank->minPhase = (cxt->flags & MINIMUM_PHASE) ? 1 : 0;
+    bank->numStored = bank_stored_filters (cxt);
+    bank->lowpassRatio = lowpass_ratio;
+    bank->filterStride = filter_stride (cxt->filterTaps, bank->format);
+}
+
+// The size of the slab for a bank with the instance's parameters (these match init_bank_params()).
+
+static size_t bank_slab_bytes (Resample *cxt)
+{
+    int format = cxt->flags & (Q15_FILTERS | FP16_FILTERS), stride = filter_stride (cxt->filterTaps, format);
+
+    if (format)
+        return (size_t) bank_stored_filters (cxt) * stride * sizeof (int16_t);
+    else if (cxt->flags & PAIRED_FILTERS)
+        return (size_t) cxt->numFilters * stride * 2 * sizeof (float);
+    else
+        return (size_t) bank_stored_filters (cxt) * stride * sizeof (float);
+}
+
+// Generate the filters into a bank whose slab (and filter pointers, for the basic float layout) have been
+// allocated. This needs cxt->tempFilter and a zeroed scratch area of two float filter strides (the
+// reduced formats generate each filter in float first, and the pairs need two filters at a time).
+
+static void generate_filter_bank (Resample *cxt, ResampleFilterBank *bank, float *scratch, double lowpass_ratio)
+{
+    int float_stride = filter_stride (cxt->filterTaps, 0), i, j;
+    double *prototype = NULL;
+    float *filter;
+
+    if (bank->minPhase)
+        prototype = min_phase_prototype (cxt, lowpass_ratio, &bank->groupDelay);
+    else
+        bank->groupDelay = cxt->numTaps / 2.0;
+
+    if (bank->format) {
+        for (i = 0; i < bank->numStored; ++i) {
+            design_filter (cxt, prototype, scratch, i, lowpass_ratio);
+            reduce_filter (scratch, (int16_t *) bank->reducedSlab + (size_t) i * bank->filterStride, cxt->numTaps, bank->format);
+        }
+    }
+    else if (bank->paired) {
+        float *this = scratch, *next = scratch + float_stride;
+
+        design_filter (cxt, prototype, next, 0, lowpass_ratio);
+
+        for (i = 0; i < cxt->numFilters; ++i) {
+            float *pair = bank->slab + (size_t) i * bank->filterStride * 2, *temp = this;
+
+            this = next; next = temp;
+            design_filter (cxt, prototype, next, i + 1, lowpass_ratio);
+
+            for (j = 0; j < bank->filterStride; ++j) {
+                pair [j / PAIR_BLOCK * PAIR_BLOCK * 2 + j % PAIR_BLOCK] = this [j];
+                pair [j / PAIR_BLOCK * PAIR_BLOCK * 2 + j % PAIR_BLOCK + PAIR_BLOCK] = next [j] - this [j];
+            }
+        }
+    }
+    else if (bank->filterReady)
+        for (filter = bank->slab, i = 0; i < bank->numStored; ++i, filter += bank->filterStride)
+            bank->filters [i] = filter;
+    else
+        for (filter = bank->slab, i = 0; i < bank->numStored; ++i, filter += bank->filterStride)
+            design_filter (cxt, prototype, bank->filters [i] = filter, i, lowpass_ratio);
+
+    free (prototype);
+}
+
+// Generate the missing filters of a lazy bank (with its lazyLock held), returning how many that was.
+
+static int warm_filter_bank (Resample *cxt, ResampleFilterBank *bank)
+{
+    double *temp_filter = cxt->tempFilter;
+    int count = 0, i;
+
+    cxt->tempFilter = bank->lazyTemp;
+
+    for (i = 0; i < bank->numStored; ++i)
+        if (!FILTER_READY (bank->filterReady, i)) {
+            init_filter (cxt, bank->filters [i], (double) i / bank->numFilters, bank->lowpassRatio);
+            SET_FILTER_READY (bank->filterReady, i);
+            count++;
+        }
+
+    cxt->tempFilter = temp_filter;
+    return count;
+}
+
+// Find a filter bank matching this instance's parameters (and bump its reference count) or, if there's none
+// yet, generate one and add it to the list. The banks are never modified after they're generated (other
+// than filling in lazy filters), and the list lock isn't held while generating.
+
+static ResampleFilterBank *acquire_filter_bank (Resample *cxt, double lowpass_ratio)
+{
+    int window = cxt->flags & BLACKMAN_HARRIS, paired = (cxt->flags & PAIRED_FILTERS) ? 1 : 0;
+    int compact = (cxt->flags & COMPACT_FILTERS) ? 1 : 0, format = cxt->flags & (Q15_FILTERS | FP16_FILTERS);
+    int min_phase = (cxt->flags & MINIMUM_PHASE) ? 1 : 0;
+    ResampleFilterBank *bank;
+    float *scratch;
+
+    BANK_LOCK();
+
+    for (bank = filter_banks; bank; bank = bank->next)
+        if (bank->numTaps == cxt->numTaps && bank->numFilters == cxt->numFilters && bank->filterTaps == cxt->filterTaps &&
+            bank->window == window && bank->paired == paired && bank->compact == compact && bank->format == format && bank->minPhase == min_phase &&
+            bank->lowpassRatio == lowpass_ratio) {
+            bank->refCount++;
+
+            while (bank->generating)
+                BANK_WAIT();
+
+            BANK_UNLOCK();
+
+            if (bank->filterReady && !(cxt->flags & LAZY_FILTERS)) {   // another instance's lazy bank
+                LAZY_LOCK (bank);
+                warm_filter_bank (cxt, bank);
+                LAZY_UNLOCK (bank);
+            }
+
+            return bank;
+        }
+
+    bank = calloc (1, sizeof (ResampleFilterBank));
+    init_bank_params (cxt, bank, lowpass_ratio);
+    bank->refCount = bank->generating = 1;
+    bank->next = filter_banks;
+    filter_banks = bank;
+    BANK_UNLOCK();
+
+    if (cxt->flags & LAZY_FILTERS) {
+        bank->filterReady = calloc (bank->numStored, sizeof (ReadyFlag));
+        bank->lazyTemp = malloc (cxt->numTaps * sizeof (double));
+        LAZY_LOCK_INIT (bank);
+    }
+
+    if (format)
+        bank->reducedSlab = aligned_calloc (bank_slab_bytes (cxt));
+    else {
+        bank->slab = aligned_calloc (bank_slab_bytes (cxt));
+
+        if (!paired)
+            bank->filters = calloc (bank->numStored, sizeof (float*));
+    }
+
+    cxt->tempFilter = malloc (cxt->numTaps * sizeof (double));
+    scratch = calloc (filter_stride (cxt->filterTaps, 0) * 2, sizeof (float));
+    generate_filter_bank (cxt, bank, scratch, lowpass_ratio);
+    free (cxt->tempFilter); cxt->tempFilter = NULL;
+    free (scratch);
+
+    BANK_LOCK();
+    bank->generating = 0;
+    BANK_GENERATED();
+    BANK_UNLOCK();
+
+    return bank;
+}
+
+// Wrap a bank around an exported image (see resampleInitFromBank()). These are private to the instance
+// and not added to the list, and of course the slab itself belongs to the caller.
+
+static ResampleFilterBank *wrap_filter_bank (Resample *cxt, const ResampleBankHeader *image)
+{
+    ResampleFilterBank *bank = calloc (1, sizeof (ResampleFilterBank));
+    int i;
+
+    bank->numTaps = image->numTaps;
+    bank->numFilters = image->numFilters;
+    bank->numStored = image->numStored;
+    bank->filterTaps = cxt->filterTaps;
+    bank->filterStride = image->filterStride;
+    bank->window = image->flags & BLACKMAN_HARRIS;
+    bank->paired = (image->flags & PAIRED_FILTERS) ? 1 : 0;
+    bank->compact = (image->flags & COMPACT_FILTERS) ? 1 : 0;
+    bank->format = image->flags & (Q15_FILTERS | FP16_FILTERS);
+    bank->minPhase = (image->flags & MINIMUM_PHASE) ? 1 : 0;
+    bank->lowpassRatio = image->lowpassRatio;
+    bank->groupDelay = image->groupDelay > 0.0 ? image->groupDelay : image->numTaps / 2.0;
+    bank->external = bank->refCount = 1;
+
+    if (bank->format)
+        bank->reducedSlab = (void *) ((const char *) image + image->headerBytes);
+    else
+        bank->slab = (float *) ((const char *) image + image->headerBytes);
+
+    if (!bank->paired && !bank->format) {
+        bank->filters = calloc (bank->numStored, sizeof (float*));
+
+        for (i = 0; i < bank->numStored; ++i)
+            bank->filters [i] = bank->slab + (size_t) i * bank->filterStride;
+    }
+
+    return bank;
+}
+
+static void release_filter_bank (ResampleFilterBank *bank)
+{
+    ResampleFilterBank **link;
+
+    if (bank->external) {
+        free (bank->filters);
+        free (bank);
+        return;
+    }
+
+    BANK_LOCK();
+
+    if (--bank->refCount) {
+        BANK_UNLOCK();
+        return;
+    }
+
+    for (link = &filter_banks; *link != bank; link = &(*link)->next);
+
+    *link = bank->next;
+    BANK_UNLOCK();
+
+    aligned_free (bank->slab);
+    aligned_free (bank->reducedSlab);
+    free (bank->filterReady);
+    free (bank->lazyTemp);
+    LAZY_LOCK_FREE (bank);
+    free (bank->filters);
+    free (bank);
+}
+
+// Generate lazy filter i on its first use (if another thread didn't just generate it).
+
+static void generate_lazy_filter (Resample *cxt, int i)
+{
+    ResampleFilterBank *bank = cxt->filterBank;
+
+    LAZY_LOCK (bank);
+
+    if (!FILTER_READY (bank->filterReady, i)) {
+        cxt->tempFilter = bank->lazyTemp;
+        init_filter (cxt, bank->filters [i], (double) i / bank->numFilters, bank->lowpassRatio);
+        cxt->tempFilter = NULL;
+        SET_FILTER_READY (bank->filterReady, i);
+        STATS_INC (cxt, lazyFilters);
+    }
+
+    LAZY_UNLOCK (bank);
+}
+
+// Return stored filter i, generating it first if it's a lazy one that hasn't been used yet (the only cost
+// in the normal case is checking its flag).
+
+static inline const float *stored_filter (Resample *cxt, int i)
+{
+    if (cxt->filterReady && !FILTER_READY (cxt->filterReady, i))
+        generate_lazy_filter (cxt, i);
+
+    return cxt->filters [i];
+}
+
+// Generate all of the filters that a LAZY_FILTERS instance hasn't used yet (e.g., at startup for realtime
+// use, so that no filter is ever generated while processing). After this the instance doesn't check for
+// missing filters anymore. Returns the number of filters generated (zero if the bank was already complete).
+
+int resampleWarmFilters (Resample *cxt)
+{
+    int count;
+
+    if (!cxt->filterReady)
+        return 0;
+
+    LAZY_LOCK (cxt->filterBank);
+    count = warm_filter_bank (cxt, cxt->filterBank);
+    LAZY_UNLOCK (cxt->filterBank);
+
+    STATS_ADD (cxt, lazyFilters, count);
+    cxt->filterReady = NULL;
+    return count;
+}
+
+// Return filter i for the selection functions below. In a compact bank the filters past the stored half
+// are the mirror images of the stored ones, so those get reversed into the mixFilter scratch (the padding
+// taps beyond numTaps are always zero there).
+
+static const float *get_filter (Resample *cxt, int i)
+{
+    const float *filter;
+    int j;
+
+    if (i < cxt->numStoredFilters)
+        return stored_filter (cxt, i);
+
+    filter = stored_filter (cxt, cxt->numFilters - i) + cxt->numTaps - 1;
+
+    for (j = 0; j < cxt->numTaps; ++j)
+        cxt->mixFilter [j] = filter [-j];
+
+    return cxt->mixFilter;
+}
+
+// Fold the two filters on either side of the phase together into mixFilter so that only one convolution
+// is needed per channel when interpolating (rather than one for each filter).
+
+static const float *mix_filters (Resample *cxt, int i, float fraction)
+{
+    float *mix = cxt->mixFilter;
+
+    if (cxt->filterPairs) {
+        const float *pair = cxt->filterPairs + (size_t) i * cxt->filterBank->filterStride * 2;
+        int j;
+
+        for (i = 0; i < cxt->filterTaps; i += PAIR_BLOCK, pair += PAIR_BLOCK * 2)
+            for (j = 0; j < PAIR_BLOCK; ++j)
+                mix [i + j] = pair [j] + pair [j + PAIR_BLOCK] * fraction;
+    }
+    else if (i + 1 < cxt->numStoredFilters) {
+        const float *filter1 = stored_filter (cxt, i), *filter2 = stored_filter (cxt, i+1);
+
+        for (i = 0; i < cxt->filterTaps; ++i)
+            mix [i] = filter1 [i] + (filter2 [i] - filter1 [i]) * fraction;
+    }
+    else {
+        // compact bank with one or both filters mirrored, so walk those backward (from their last real tap)
+
+        const float *filter1, *filter2;
+        int step1 = 1, step2 = -1, j;
+
+        if (i >= cxt->numStoredFilters) {
+            filter1 = stored_filter (cxt, cxt->numFilters - i) + cxt->numTaps - 1;
+            step1 = -1;
+        }
+        else
+            filter1 = stored_filter (cxt, i);
+
+        filter2 = stored_filter (cxt, cxt->numFilters - i - 1) + cxt->numTaps - 1;
+
+        for (j = 0; j < cxt->numTaps; ++j, filter1 += step1, filter2 += step2)
+            mix [j] = *filter1 + (*filter2 - *filter1) * fraction;
+    }
+
+    return mix;
+}
+
+// These functions work out the phase for the current output position (in samples from the start of the
+// history buffers) once for all channels. They return the filter to convolve with (and the history index
+// it is centered on in *index), or NULL if the position falls exactly on an input sample and no lowpass
+// is being applied (in which case the output is simply that input sample).
+
+static const float *subsample_no_interpolate (Resample *cxt, double offset, int *index)
+{
+    double whole = floor (offset);
+
+    *index = (int) whole;
+    offset -= whole;
+
+    if (offset == 0.0 && !(cxt->flags & INCLUDE_LOWPASS)) {
+        STATS_INC (cxt, passthroughOutputs);
+        return NULL;
+    }
+
+    STATS_INC (cxt, nearestOutputs);
+    return get_filter (cxt, (int) floor (offset * cxt->numFilters + 0.5));
+}
+
+static const float *subsample_interpolate (Resample *cxt, double offset, int *index)
+{
+    double whole = floor (offset);
+    int i;
+
+    *index = (int) whole;
+    offset -= whole;
+
+    if (offset == 0.0 && !(cxt->flags & INCLUDE_LOWPASS)) {
+        STATS_INC (cxt, passthroughOutputs);
+        return NULL;
+    }
+
+    i = (int) floor (offset *= cxt->numFilters);
+
+    if ((offset -= i) == 0.0 && cxt->filters) {
+        STATS_INC (cxt, exactPhaseOutputs);
+        return get_filter (cxt, i);
+    }
+
+    STATS_INC (cxt, interpolatedOutputs);
+    return mix_filters (cxt, i, (float) offset);
+}
+
+// With FIXED_POINT_PHASE the position is a 32.32 fixed-point value, so the whole part is the history
+// index and the fraction scaled by the number of filters gives the filter index in its upper 32 bits
+// and the interpolation weight in its lower 32 bits (all in integer math, no floor() or conversions).
+// With RATIONAL_PHASE the fraction is always exactly rationalPhase / numFilters, so that's the filter.
+
+static const float *subsample_fixed (Resample *cxt, int *index)
+{
+    uint32_t fraction = (uint32_t) cxt->outputPhase;
+    uint64_t scaled = (uint64_t) fraction * cxt->numFilters;
+
+    *index = (int) (cxt->outputPhase >> 32);
+
+    if (cxt->flags & RATIONAL_PHASE) {
+        if (!cxt->rationalPhase && !(cxt->flags & INCLUDE_LOWPASS)) {
+            STATS_INC (cxt, passthroughOutputs);
+            return NULL;
+        }
+
+        STATS_INC (cxt, exactPhaseOutputs);
+        return get_filter (cxt, cxt->rationalPhase);
+    }
+
+    if (!fraction && !(cxt->flags & INCLUDE_LOWPASS)) {
+        STATS_INC (cxt, passthroughOutputs);
+        return NULL;
+    }
+
+    if (!(cxt->flags & SUBSAMPLE_INTERPOLATE)) {
+        STATS_INC (cxt, nearestOutputs);
+        return get_filter (cxt, (int) ((scaled + 0x80000000) >> 32));
+    }
+
+    if (!(uint32_t) scaled && cxt->filters) {
+        STATS_INC (cxt, exactPhaseOutputs);
+        return get_filter (cxt, (int) (scaled >> 32));
+    }
+
+    STATS_INC (cxt, interpolatedOutputs);
+    return mix_filters (cxt, (int) (scaled >> 32), (uint32_t) scaled * (1.0F / 4294967296.0F));
+}
+
+// Map a history index (as used by inputIndex and outputOffset) to the physical frame in the history
+// buffer. This is the identity except with RING_HISTORY, where the history is a power-of-two ring that
+// is followed by a guard region mirroring its first filterTaps frames, so the frames for any one
+// convolution are always contiguous.
+
+static inline int history_frame (Resample *cxt, int index)
+{
+    return (cxt->flags & RING_HISTORY) ? (index + cxt->ringBase) & (cxt->numSamples - 1) : index;
+}
+
+// For the reduced-precision banks the filters are not mixed; instead this works out the filter index and
+// the interpolation fraction (zero if none) from the same position state as the functions above, and the
+// results of the two convolutions are interpolated. Returns FALSE if the output is just the input sample.
+
+static int subsample_phase (Resample *cxt, int *index, int *filter, float *fraction)
+{
+    *fraction = 0.0F;
+
+    if (cxt->flags & FIXED_POINT_PHASE) {
+        uint32_t frac = (uint32_t) cxt->outputPhase;
+        uint64_t scaled = (uint64_t) frac * cxt->numFilters;
+
+        *index = (int) (cxt->outputPhase >> 32);
+
+        if (cxt->flags & RATIONAL_PHASE) {
+            *filter = cxt->rationalPhase;
+            return cxt->rationalPhase || (cxt->flags & INCLUDE_LOWPASS);
+        }
+
+        if (!frac && !(cxt->flags & INCLUDE_LOWPASS))
+            return 0;
+
+        if (!(cxt->flags & SUBSAMPLE_INTERPOLATE)) {
+            *filter = (int) ((scaled + 0x80000000) >> 32);
+            return 1;
+        }
+
+        *filter = (int) (scaled >> 32);
+        *fraction = (uint32_t) scaled * (1.0F / 4294967296.0F);
+    }
+    else {
+        double offset = cxt->outputOffset, whole = floor (offset);
+
+        *index = (int) whole;
+        offset -= whole;
+
+        if (offset == 0.0 && !(cxt->flags & INCLUDE_LOWPASS))
+            return 0;
+
+        if (!(cxt->flags & SUBSAMPLE_INTERPOLATE)) {
+            *filter = (int) floor (offset * cxt->numFilters + 0.5);
+            return 1;
+        }
+
+        *filter = (int) floor (offset *= cxt->numFilters);
+        *fraction = (float) (offset - *filter);
+    }
+
+    return 1;
+}
+
+// The Q31 history is stored in the same (32-bit) buffers as the float history, and is saturated at full
+// scale on input.
+
+static inline int32_t float_to_q31 (float value)
+{
+    double scaled = value * 2147483648.0;
+
+    if (scaled >= 2147483647.0)
+        return 0x7fffffff;
+
+    if (scaled <= -2147483648.0)
+        return -0x7fffffff - 1;
+
+    return (int32_t) lrint (scaled);
+}
+
+static void convert_to_q31 (float *samples, int count)
+{
+    int32_t value;
+
+    while (count--) {
+        value = float_to_q31 (*samples);
+        memcpy (samples++, &value, sizeof (value));
+    }
+}
+
+static void subsample_frame_reduced (Resample *cxt, float *results)
+{
+    int index, filter, start, stride = cxt->filterBank->filterStride, i;
+    float fraction;
+
+    if (!subsample_phase (cxt, &index, &filter, &fraction)) {
+        STATS_INC (cxt, passthroughOutputs);
+        index = history_frame (cxt, index);
+
+        for (i = 0; i < cxt->numChannels; ++i)
+            if (cxt->flags & Q15_FILTERS)
+                results [i] = ((const int32_t *) cxt->buffers [i]) [index] * (1.0 / 2147483648.0);
+            else
+                results [i] = cxt->buffers [i] [index];
+
+        return;
+    }
+
+    if (fraction)
+        STATS_INC (cxt, interpolatedOutputs);
+    else if (cxt->flags & SUBSAMPLE_INTERPOLATE)
+        STATS_INC (cxt, exactPhaseOutputs);
+    else
+        STATS_INC (cxt, nearestOutputs);
+
+    start = history_frame (cxt, index - cxt->numTaps / 2 + 1);
+
+    if (cxt->flags & Q15_FILTERS) {
+        const int16_t *filter1 = (const int16_t *) cxt->reducedFilters + (size_t) filter * stride;
+
+        for (i = 0; i < cxt->numChannels; ++i) {
+            const int32_t *source = (const int32_t *) cxt->buffers [i] + start;
+            double sum = (double) cxt->applyFilterQ15 (filter1, source, cxt->filterTaps);
+
+            if (fraction)
+                sum += ((double) cxt->applyFilterQ15 (filter1 + stride, source, cxt->filterTaps) - sum) * fraction;
+
+            results [i] = sum * (1.0 / 70368744177664.0);       // Q46 to float
+        }
+    }
+    else {
+        const uint16_t *filter1 = (const uint16_t *) cxt->reducedFilters + (size_t) filter * stride;
+
+        for (i = 0; i < cxt->numChannels; ++i) {
+            const float *source = cxt->buffers [i] + start;
+            double sum = cxt->applyFilterHalf (filter1, source, cxt->filterTaps);
+
+            if (fraction)
+                sum += (cxt->applyFilterHalf (filter1 + stride, source, cxt->filterTaps) - sum) * fraction;
+
+            results [i] = sum;
+        }
+    }
+}
+
+// Calculate one output frame at the current position, storing one result per channel (filter selection
+// is done once and then the same coefficients are convolved with every channel's history). With the
+// INTERLEAVED_HISTORY layout the results array must have room for channelStride floats.
+
+static void subsample_frame (Resample *cxt, float *results)
+{
+    const float *filter;
+    int index, start, i;
+
+    if (cxt->reducedFilters) {
+        subsample_frame_reduced (cxt, results);
+        return;
+    }
+
+    if (cxt->flags & FIXED_POINT_PHASE)
+        filter = subsample_fixed (cxt, &index);
+    else if (cxt->flags & SUBSAMPLE_INTERPOLATE)
+        filter = subsample_interpolate (cxt, cxt->outputOffset, &index);
+    else
+        filter = subsample_no_interpolate (cxt, cxt->outputOffset, &index);
+
+    start = history_frame (cxt, index - cxt->numTaps / 2 + 1);
+    index = history_frame (cxt, index);
+
+    if (cxt->history) {
+        if (filter)
+            cxt->applyFilterInterleaved (filter, cxt->history + start * cxt->channelStride, cxt->channelStride, cxt->numTaps, results);
+        else
+            memcpy (results, cxt->history + index * cxt->channelStride, cxt->numChannels * sizeof (float));
+
+        return;
+    }
+
+    if (!filter) {
+        for (i = 0; i < cxt->numChannels; ++i)
+            results [i] = cxt->buffers [i] [index];
+
+        return;
+    }
+
+    for (i = 0; i + 4 <= cxt->numChannels; i += 4)
+        cxt->applyFilterX4 (filter, cxt->buffers + i, start, cxt->filterTaps, results + i);
+
+    for (; i < cxt->numChannels; ++i)
+        results [i] = cxt->applyFilter (filter, cxt->buffers [i] + start, cxt->filterTaps);
+}
+
+// Helpers for the output position, which is either the double outputOffset or (with FIXED_POINT_PHASE)
+// the 32.32 fixed-point outputPhase. With RATIONAL_PHASE the whole part is in outputPhase and the fraction
+// is exactly rationalPhase / numFilters. The step for the fixed-point case is only recalculated when the
+// ratio changes, so there's no divide per sample (or even per call).
+
+static void reset_position (Resample *cxt)
+{
+    cxt->outputOffset = cxt->numTaps / 2;
+    cxt->outputPhase = (int64_t) (cxt->numTaps / 2) << 32;
+    cxt->phaseExtra = cxt->rationalPhase = 0;
+    cxt->inputIndex = cxt->numTaps;
+}
+
+static inline void shift_position (Resample *cxt, int shift)
+{
+    cxt->outputOffset -= shift;
+    cxt->outputPhase -= (int64_t) shift << 32;
+    cxt->inputIndex -= shift;
+}
+
+static inline int output_index (Resample *cxt)
+{
+    return (cxt->flags & FIXED_POINT_PHASE) ? (int) (cxt->outputPhase >> 32) : (int) floor (cxt->outputOffset);
+}
+
+static inline int output_ready (Resample *cxt)
+{
+    if (cxt->flags & FIXED_POINT_PHASE)
+        return (int) (cxt->outputPhase >> 32) < cxt->inputIndex - cxt->numTaps / 2;
+    else
+        return cxt->outputOffset < cxt->inputIndex - cxt->numTaps / 2;
+}
+
+static inline void output_advance (Resample *cxt, double step)
+{
+    if (cxt->flags & RATIONAL_PHASE) {
+        cxt->outputPhase += (int64_t) cxt->rationalStep << 32;
+
+        if ((cxt->rationalPhase += cxt->rationalStepPhase) >= cxt->numFilters) {
+            cxt->rationalPhase -= cxt->numFilters;
+            cxt->outputPhase += (int64_t) 1 << 32;
+        }
+    }
+    else if (cxt->flags & FIXED_POINT_PHASE) {
+        uint32_t extra = cxt->phaseExtra + cxt->phaseStepExtra;
+
+        cxt->outputPhase += cxt->phaseStep + (extra < cxt->phaseExtra);
+        cxt->phaseExtra = extra;
+    }
+    else
+        cxt->outputOffset += step;
+}
+
+// The fixed-point step is 1.0 / ratio in 32.32, plus another 32 bits of fraction in phaseStepExtra (which
+// accumulates into phaseExtra and carries into outputPhase) so that the step is as precise as the double
+// ratio it came from and the position never drifts from rounding.
+
+static void fixed_phase_step (Resample *cxt, double ratio)
+{
+    if (!(cxt->flags & RATIONAL_PHASE) && ratio != cxt->phaseRatio) {
+        double scaled = 4294967296.0 / ratio, whole = floor (scaled);
+        double extra = floor ((scaled - whole) * 4294967296.0 + 0.5);
+
+        if (extra >= 4294967296.0) {
+            extra -= 4294967296.0;
+            whole += 1.0;
+        }
+
+        cxt->phaseStep = (int64_t) whole;
+        cxt->phaseStepExtra = (uint32_t) extra;
+        cxt->phaseRatio = ratio;
+    }
+}
+
+// The same for a step given directly (for the ramped processing, which changes it every output frame).
+// This invalidates the cached step for the regular processing functions.
+
+static void fixed_phase_step_direct (Resample *cxt, double step)
+{
+    double scaled = step * 4294967296.0, whole = floor (scaled);
+    double extra = floor ((scaled - whole) * 4294967296.0 + 0.5);
+
+    if (extra >= 4294967296.0) {
+        extra -= 4294967296.0;
+        whole += 1.0;
+    }
+
+    cxt->phaseStep = (int64_t) whole;
+    cxt->phaseStepExtra = (uint32_t) extra;
+    cxt->phaseRatio = 0.0;
+}
+
+static Resample *init_resampler (int numChannels, int numTaps, int numFilters, double lowpassRatio, int flags,
+    const ResampleBankHeader *image, void *arena, size_t arenaSize);
+
+Resample *resampleInit (int numChannels, int numTaps, int numFilters, double lowpassRatio, int flags)
+{
+    return init_resampler (numChannels, numTaps, numFilters, lowpassRatio, flags, NULL, NULL, 0);
+}
+
+// Initialize a resampler entirely inside the caller's arena, which must be FILTER_ALIGNMENT (64) byte
+// aligned and at least resampleGetMemoryRequirement() bytes. The instance gets its own filter bank in the
+// arena (it isn't shared, so no lock is taken either), and nothing at all is allocated, so this may be
+// used where there's no heap. Other than generating the filters this takes constant time, resampleReset()
+// works as usual, and resampleFree() does nothing (the arena may simply be reused or discarded).
+
+Resample *resampleInitInPlace (void *arena, size_t arenaSize, int numChannels, int numTaps, int numFilters, double lowpassRatio, int flags)
+{
+    return init_resampler (numChannels, numTaps, numFilters, lowpassRatio, flags, NULL, arena, arenaSize);
+}
+
+// Work out the instance's sizes and kernels from its parameters (everything but the memory), after
+// normalizing the flags. Returns zero (after displaying why) if the parameters are invalid.
+
+static int setup_resampler (Resample *cxt, int numChannels, int numTaps, int numFilters, int flags)
+{
+    int historyMultiplier = (flags & HISTORY_MULTIPLIER_MASK) >> HISTORY_MULTIPLIER_SHIFT;
+    int tapMultiple;
+
+    if (!(flags & SUBSAMPLE_INTERPOLATE) || (flags & COMPACT_FILTERS))   // only interpolation can use the
+        flags &= ~PAIRED_FILTERS;                                           // filter pairs (and not compact)
+
+    if (flags & MINIMUM_PHASE)                      // minimum-phase filters aren't symmetrical, so they
+        flags &= ~COMPACT_FILTERS;                  // can't be mirrored
+
+    if (flags & (Q15_FILTERS | FP16_FILTERS))       // reduced-precision banks have only the basic layout
+        flags &= ~(INTERLEAVED_HISTORY | PAIRED_FILTERS | COMPACT_FILTERS | ((flags & Q15_FILTERS) ? FP16_FILTERS : 0));
+
+    if (flags & (PAIRED_FILTERS | Q15_FILTERS | FP16_FILTERS | MINIMUM_PHASE))  // lazy generation is only for
+        flags &= ~LAZY_FILTERS;                                                 // the (compact) float filters
+
+    if ((numTaps & 3) || numTaps <= 0 || numTaps > 1024) {
+        fprintf (stderr, "must 4-1024 filter taps, and a multiple of 4!\n");
+        return 0;
+    }
+
+    if (numFilters < 2 || numFilters > 1024) {
+        fprintf (stderr, "must be 2-1024 filters!\n");
+        return 0;
+    }
+
+    if (!historyMultiplier)
+        historyMultiplier = 16;
+    else if (historyMultiplier < 2) {
+        fprintf (stderr, "history must be at least 2x the filter taps!\n");
+        return 0;
+    }
+
+    cxt->numChannels = numChannels;
+    cxt->numSamples = numTaps * historyMultiplier;
+
+    if (flags & RING_HISTORY)
+        while (cxt->numSamples & (cxt->numSamples - 1))
+            cxt->numSamples += cxt->numSamples & -cxt->numSamples;
+    cxt->numFilters = numFilters;
+    cxt->numTaps = numTaps;
+    cxt->flags = flags;
+
+    // the filters are padded with zero taps to a multiple of the kernel width, and the history buffers
+    // get the same amount of extra room at the end because the padded taps read past the newest sample
+    // (for the ring history, the extra room is the mirrored guard region covering the whole filter)
+
+    tapMultiple = select_kernel (cxt);
+    cxt->filterTaps = (numTaps + tapMultiple - 1) / tapMultiple * tapMultiple;
+
+    if (flags & RING_HISTORY)
+        cxt->historyFrames = cxt->numSamples + cxt->filterTaps;
+    else
+        cxt->historyFrames = cxt->numSamples + cxt->filterTaps - cxt->numTaps;
+
+    // the interleaved history is a single aligned block with each frame padded out to a multiple of the
+    // vector width (but no wider than needed for the number of channels we actually have)
+
+    if (flags & INTERLEAVED_HISTORY) {
+        while (tapMultiple > 4 && tapMultiple / 2 >= numChannels)
+            tapMultiple /= 2;
+
+        cxt->channelStride = (numChannels + tapMultiple - 1) / tapMultiple * tapMultiple;
+    }
+    else
+        cxt->channelStride = 1;
+
+    return 1;
+}
+
+// Lay out the memory of an instance at "base" (with a NULL base, just add up the size): the Resample
+// itself, the mix filter, the frame and the history, and for an in-place instance, its private bank with
+// the scratch used to generate it. Each block starts on a FILTER_ALIGNMENT boundary, and these are all
+// in one allocation (or arena), except for the shared banks. Returns the total size in bytes.
+
+#define LAYOUT_BYTES(bytes) (((bytes) + FILTER_ALIGNMENT - 1) & ~(size_t) (FILTER_ALIGNMENT - 1))
+#define LAYOUT_BLOCK(ptr,bytes) do { if (base) (ptr) = (void *) (base + used); used += LAYOUT_BYTES (bytes); } while (0)
+
+static size_t layout_instance (Resample *cxt, unsigned char *base, int private_bank, float **scratch)
+{
+    size_t used = LAYOUT_BYTES (sizeof (Resample));
+    ResampleFilterBank *bank = NULL;
+    int i;
+
+    LAYOUT_BLOCK (cxt->mixFilter, (size_t) (cxt->filterTaps + PAIR_BLOCK) * sizeof (float));
+    LAYOUT_BLOCK (cxt->writerFrames, (size_t) RESAMPLE_WRITER_FRAMES * cxt->numChannels * sizeof (float));
+
+    if (cxt->flags & INTERLEAVED_HISTORY) {
+        LAYOUT_BLOCK (cxt->frame, (size_t) cxt->channelStride * sizeof (float));
+        LAYOUT_BLOCK (cxt->history, (size_t) cxt->historyFrames * cxt->channelStride * sizeof (float));
+    }
+    else {
+        LAYOUT_BLOCK (cxt->frame, (size_t) cxt->numChannels * sizeof (float));
+        LAYOUT_BLOCK (cxt->buffers, (size_t) cxt->numChannels * sizeof (float*));
+
+        for (i = 0; i < cxt->numChannels; ++i)
+            LAYOUT_BLOCK (cxt->buffers [i], (size_t) cxt->historyFrames * sizeof (float));
+    }
+
+    if (private_bank) {
+        LAYOUT_BLOCK (bank, sizeof (ResampleFilterBank));
+
+        if (cxt->flags & (Q15_FILTERS | FP16_FILTERS))
+            LAYOUT_BLOCK (bank->reducedSlab, bank_slab_bytes (cxt));
+        else {
+            LAYOUT_BLOCK (bank->slab, bank_slab_bytes (cxt));
+
+            if (!(cxt->flags & PAIRED_FILTERS))
+                LAYOUT_BLOCK (bank->filters, (size_t) bank_stored_filters (cxt) * sizeof (float*));
+        }
+
+        LAYOUT_BLOCK (cxt->tempFilter, (size_t) cxt->numTaps * sizeof (double));
+        LAYOUT_BLOCK (*scratch, (size_t) filter_stride (cxt->filterTaps, 0) * 2 * sizeof (float));
+
+        if (base)
+            cxt->filterBank = bank;
+    }
+
+    return used;
+}
+
+// Query the size of the arena that resampleInitInPlace() needs for these parameters (on this CPU, because
+// the padding depends on the convolution kernel selected). Returns zero if the parameters are invalid.
+
+size_t resampleGetMemoryRequirement (int numChannels, int numTaps, int numFilters, int flags)
+{
+    Resample setup;
+
+    memset (&setup, 0, sizeof (setup));
+
+    if (!setup_resampler (&setup, numChannels, numTaps, numFilters, flags))
+        return 0;
+
+    return layout_instance (&setup, NULL, 1, NULL);
+}
+
+static Resample *init_resampler (int numChannels, int numTaps, int numFilters, double lowpassRatio, int flags,
+    const ResampleBankHeader *image, void *arena, size_t arenaSize)
+{
+    Resample setup, *cxt;
+    float *scratch = NULL;
+    unsigned char *base;
+    size_t size;
+
+    if (lowpassRatio > 0.0 && lowpassRatio < 1.0)
+        flags |= INCLUDE_LOWPASS;
+    else {
+        flags &= ~INCLUDE_LOWPASS;
+        lowpassRatio = 1.0;
+    }
+
+    if (flags & MINIMUM_PHASE)      // no passthrough (the phase 0 filter isn't an impulse)
+        flags |= INCLUDE_LOWPASS;
+
+    if (arena || image)         // these banks are complete (an in-place bank is generated right away)
+        flags &= ~LAZY_FILTERS;
+
+    if ((flags & MINIMUM_PHASE) && arena) {
+        fprintf (stderr, "minimum-phase filters can't be generated in place (use a bank image)!\n");
+        return NULL;
+    }
+
+    memset (&setup, 0, sizeof (setup));
+
+    if (!setup_resampler (&setup, numChannels, numTaps, numFilters, flags))
+        return NULL;
+
+    size = layout_instance (&setup, NULL, arena != NULL, NULL);
+
+    if (arena) {
+        if ((uintptr_t) arena % FILTER_ALIGNMENT) {
+            fprintf (stderr, "resampler arena must be %d-byte aligned!\n", FILTER_ALIGNMENT);
+            return NULL;
+        }
+
+        if (arenaSize < size) {
+            fprintf (stderr, "resampler arena needs %lu bytes!\n", (unsigned long) size);
+            return NULL;
+        }
+
+        memset (base = arena, 0, size);
+    }
+    else if (!(base = aligned_calloc (size)))
+        return NULL;
+
+    cxt = (Resample *) base;
+    *cxt = setup;
+    layout_instance (cxt, base, arena != NULL, &scratch);
+
+    if (arena) {
+        cxt->inPlace = 1;
+        init_bank_params (cxt, cxt->filterBank, lowpassRatio);
+        cxt->filterBank->external = cxt->filterBank->refCount = 1;
+        generate_filter_bank (cxt, cxt->filterBank, scratch, lowpassRatio);
+        cxt->tempFilter = NULL;
+    }
+    else
+        cxt->filterBank = image ? wrap_filter_bank (cxt, image) : acquire_filter_bank (cxt, lowpassRatio);
+
+    cxt->filters = cxt->filterBank->filters;
+    cxt->numStoredFilters = cxt->filterBank->paired ? cxt->numFilters + 1 : cxt->filterBank->numStored;
+    cxt->filterPairs = cxt->filterBank->paired ? cxt->filterBank->slab : NULL;
+    cxt->reducedFilters = cxt->filterBank->reducedSlab;
+    cxt->filterReady = (cxt->flags & LAZY_FILTERS) ? cxt->filterBank->filterReady : NULL;
+
+    reset_position (cxt);
+
+    return cxt;
+}
+
+// Initialize a resampler for the fixed rational ratio upFactor / downFactor (e.g., 160 / 147 for 44.1k to
+// 48k). Exactly one filter is generated for each of the distinct phases that can occur (i.e., upFactor
+// after reducing the fraction), and the phase is stepped with integer math, so no interpolation is needed
+// and there is no phase error. The "ratio" passed to the processing and query functions is ignored.
+
+Resample *resampleInitRational (int numChannels, int numTaps, int upFactor, int downFactor, double lowpassRatio, int flags)
+{
+    int a = upFactor, b = downFactor;
+    Resample *cxt;
+
+    if (upFactor < 1 || downFactor < 1) {
+        fprintf (stderr, "rational factors must be positive!\n");
+        return NULL;
+    }
+
+    while (b) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+
+    upFactor /= a;
+    downFactor /= a;
+
+    if (upFactor == 1) {        // always need at least 2 filters
+        upFactor = 2;
+        downFactor *= 2;
+    }
+
+    if (upFactor > 1024) {
+        fprintf (stderr, "rational upsampling factor must be 1024 or less!\n");
+        return NULL;
+    }
+
+    cxt = resampleInit (numChannels, numTaps, upFactor, lowpassRatio, (flags & ~SUBSAMPLE_INTERPOLATE) | FIXED_POINT_PHASE | RATIONAL_PHASE);
+
+    if (cxt) {
+        cxt->rationalStep = downFactor / upFactor;
+        cxt->rationalStepPhase = downFactor % upFactor;
+    }
+
+    return cxt;
+}
+
+// Initialize a resampler from a filter bank image previously exported with resampleExportBank() (or
+// compiled in from resampleExportBankSource()). The taps, filters, lowpass, window and bank layout all
+// come from the image (as does the rational ratio, if it was exported from resampleInitRational()), so
+// only the history and phase options in "flags" are used. The image is used in place and must remain
+// valid (and unmodified) until the resampler is freed.
+
+Resample *resampleInitFromBank (int numChannels, const void *bankImage, int flags)
+{
+    const ResampleBankHeader *image = bankImage;
+    const int bank_flags = BLACKMAN_HARRIS | INCLUDE_LOWPASS | PAIRED_FILTERS | COMPACT_FILTERS | Q15_FILTERS | FP16_FILTERS | MINIMUM_PHASE;
+    Resample *cxt;
+
+    if (image->magic != RESAMPLE_BANK_MAGIC || image->version != RESAMPLE_BANK_VERSION) {
+        fprintf (stderr, "not a valid filter bank image (or wrong byte order)!\n");
+        return NULL;
+    }
+
+    if (((uintptr_t) bankImage % FILTER_ALIGNMENT) || (image->headerBytes % FILTER_ALIGNMENT)) {
+        fprintf (stderr, "filter bank image must be %d-byte aligned!\n", FILTER_ALIGNMENT);
+        return NULL;
+    }
+
+    if ((image->filterStride % FILTER_STRIDE_FLOATS) || image->filterStride < image->numTaps ||
+        image->numStored < 2 || image->numStored > image->numFilters + 1) {
+        fprintf (stderr, "invalid filter bank image!\n");
+        return NULL;
+    }
+
+    flags = (flags & ~(bank_flags | RATIONAL_PHASE)) | (image->flags & bank_flags);
+
+    if (image->flags & PAIRED_FILTERS)
+        flags |= SUBSAMPLE_INTERPOLATE;
+
+    if (image->rationalDown)
+        flags = (flags & ~SUBSAMPLE_INTERPOLATE) | FIXED_POINT_PHASE | RATIONAL_PHASE;
+
+    cxt = init_resampler (numChannels, image->numTaps, image->numFilters, image->lowpassRatio, flags, image, NULL, 0);
+
+    if (cxt && image->rationalDown) {
+        cxt->rationalStep = image->rationalDown / cxt->numFilters;
+        cxt->rationalStepPhase = image->rationalDown % cxt->numFilters;
+    }
+
+    return cxt;
+}
+
+static size_t init_bank_header (Resample *cxt, ResampleBankHeader *header)
+{
+    ResampleFilterBank *bank = cxt->filterBank;
+
+    memset (header, 0, sizeof (ResampleBankHeader));
+    header->magic = RESAMPLE_BANK_MAGIC;
+    header->version = RESAMPLE_BANK_VERSION;
+    header->headerBytes = sizeof (ResampleBankHeader);
+    header->dataBytes = (bank->paired ? bank->numFilters * 2 : bank->numStored) * bank->filterStride *
+        (bank->format ? sizeof (int16_t) : sizeof (float));
+    header->numTaps = bank->numTaps;
+    header->numFilters = bank->numFilters;
+    header->numStored = bank->numStored;
+    header->filterStride = bank->filterStride;
+    header->flags = cxt->flags & (BLACKMAN_HARRIS | INCLUDE_LOWPASS | PAIRED_FILTERS | COMPACT_FILTERS | Q15_FILTERS | FP16_FILTERS | MINIMUM_PHASE);
+    header->lowpassRatio = bank->lowpassRatio;
+    header->groupDelay = bank->groupDelay;
+
+    if (cxt->flags & RATIONAL_PHASE)
+        header->rationalDown = cxt->rationalStep * cxt->numFilters + cxt->rationalStepPhase;
+
+    return header->headerBytes + header->dataBytes;
+}
+
+// Export the resampler's filter bank as an image for resampleInitFromBank(), returning its size in bytes.
+// Nothing is written if the buffer is NULL or too small, so this can be called first to get the size.
+
+size_t resampleExportBank (Resample *cxt, void *buffer, size_t bufferSize)
+{
+    ResampleBankHeader header;
+    size_t image_bytes = init_bank_header (cxt, &header);
+
+    if (buffer && bufferSize >= image_bytes) {
+        resampleWarmFilters (cxt);      // a lazy bank is exported complete
+        memcpy (buffer, &header, sizeof (header));
+        memcpy ((char *) buffer + header.headerBytes, cxt->filterBank->format ? cxt->filterBank->reducedSlab :
+            (void *) cxt->filterBank->slab, header.dataBytes);
+    }
+
+    return image_bytes;
+}
+
+// Write the resampler's filter bank as C source for an aligned const image called "name" (exact, using
+// hex floats) that can be passed directly to resampleInitFromBank(). Returns FALSE on a write error.
+
+int resampleExportBankSource (Resample *cxt, FILE *file, const char *name)
+{
+    static const char *formats [] = { "float", "Q15", "FP16" };
+    int format = cxt->filterBank->format == Q15_FILTERS ? 1 : cxt->filterBank->format == FP16_FILTERS ? 2 : 0;
+    size_t num_values, i;
+    ResampleBankHeader header;
+
+    init_bank_header (cxt, &header);
+    num_values = header.dataBytes / (format ? sizeof (int16_t) : sizeof (float));
+    resampleWarmFilters (cxt);
+
+    fprintf (file, "// filter bank: %d taps, %d filters (%d stored), %s window, lowpass %.17g, %s%s\n\n",
+        header.numTaps, header.numFilters, header.numStored, (header.flags & BLACKMAN_HARRIS) ? "Blackman-Harris" : "Hann",
+        header.lowpassRatio, formats [format], (header.flags & MINIMUM_PHASE) ? ", minimum phase" : "");
+
+    // the alignment is a type attribute (spelled for MSVC or GCC/Clang) on the image's anonymous struct
+
+    fprintf (file, "#if defined(_MSC_VER)\nstatic const __declspec (align (%d)) struct {\n#else\nstatic const struct __attribute__ ((aligned (%d))) {\n#endif\n",
+        FILTER_ALIGNMENT, FILTER_ALIGNMENT);
+
+    fprintf (file, "    ResampleBankHeader header;\n    %s data [%lu];\n} %s = {\n",
+        format == 1 ? "int16_t" : format == 2 ? "uint16_t" : "float", (unsigned long) num_values, name);
+
+    fprintf (file, "    { 0x%lx, %lu, %lu, %lu, %d, %d, %d, %d, 0x%x, %d, %a, %a, { 0 } },\n    {",
+        (unsigned long) header.magic, (unsigned long) header.version, (unsigned long) header.headerBytes,
+        (unsigned long) header.dataBytes, header.numTaps, header.numFilters, header.numStored,
+        header.filterStride, header.flags, header.rationalDown, header.lowpassRatio, header.groupDelay);
+
+    for (i = 0; i < num_values; ++i) {
+        fprintf (file, "%s", i % (format ? 12 : 8) ? " " : "\n        ");
+
+        if (format == 1)
+            fprintf (file, "%d", ((const int16_t *) cxt->filterBank->reducedSlab) [i]);
+        else if (format == 2)
+            fprintf (file, "0x%04x", ((const uint16_t *) cxt->filterBank->reducedSlab) [i]);
+        else
+            fprintf (file, "%a", cxt->filterBank->slab [i]);
+
+        if (i + 1 < num_values)
+            fputc (',', file);
+    }
+
+    return fprintf (file, "\n    }\n};\n") > 0 && !ferror (file);
+}
+
+// Copy the counters accumulated since the resampler was initialized (they are not cleared by resampleReset()
+// or read by the query functions). Returns FALSE (and zeros) if they were compiled out with RESAMPLER_NO_STATS.
+
+int resampleGetStats (Resample *cxt, ResampleStats *stats)
+{
+#ifdef RESAMPLER_NO_STATS
+    memset (stats, 0, sizeof (ResampleStats));
+    return 0;
+#else
+    *stats = cxt->stats;
+    return 1;
+#endif
+}
+
+void resampleReset (Resample *cxt)
+{
+    int i;
+
+    if (cxt->history)
+        memset (cxt->history, 0, cxt->historyFrames * cxt->channelStride * sizeof (float));
+    else
+        for (i = 0; i < cxt->numChannels; ++i)
+            memset (cxt->buffers [i], 0, cxt->historyFrames * sizeof (float));
+
+    cxt->ringBase = 0;
+    cxt->rampStep = 0.0;
+    reset_position (cxt);
+}
+
+// When the history buffer fills we move the last numTaps frames back to the beginning (this is the
+// only bulk copy on the processing path, and happens once every numSamples - numTaps input frames).
+// With RING_HISTORY nothing is copied; we just rotate the ring's base to match the new indices.
+
+static void shift_history (Resample *cxt)
+{
+    int shift = cxt->numSamples - cxt->numTaps, i;
+
+    STATS_INC (cxt, historyShifts);
+
+    if (cxt->flags & RING_HISTORY)
+        cxt->ringBase = (cxt->ringBase + shift) & (cxt->numSamples - 1);
+    else if (cxt->history)
+        memmove (cxt->history, cxt->history + shift * cxt->channelStride, cxt->numTaps * cxt->channelStride * sizeof (float));
+    else
+        for (i = 0; i < cxt->numChannels; ++i)
+            memmove (cxt->buffers [i], cxt->buffers [i] + shift, cxt->numTaps * sizeof (float));
 
-#if 1   // Version 1 (canonical)
-static double apply_filter (float *A, float *B, int num_taps)
+    shift_position (cxt, shift);
+}
+
+// With RING_HISTORY, any frames just written to the start of the ring are copied into the guard region
+// following the ring (this is at most filterTaps frames per trip around the ring).
+
+static void mirror_history (Resample *cxt, int frame, int count)
 {
-    float sum = 0.0;
+    int i;
 
-    do sum += *A++ * *B++;
-    while (--num_taps);
+    if (!(cxt->flags & RING_HISTORY) || frame >= cxt->filterTaps)
+        return;
 
-    return sum;
+    if (count > cxt->filterTaps - frame)
+        count = cxt->filterTaps - frame;
+
+    if (cxt->history)
+        memcpy (cxt->history + (frame + cxt->numSamples) * cxt->channelStride, cxt->history + frame * cxt->channelStride,
+            count * cxt->channelStride * sizeof (float));
+    else
+        for (i = 0; i < cxt->numChannels; ++i)
+            memcpy (cxt->buffers [i] + frame + cxt->numSamples, cxt->buffers [i] + frame, count * sizeof (float));
 }
-#endif
 
-#if 0   // Version 2 (2x unrolled loop)
-static double apply_filter (float *A, float *B, int num_taps)
+// Return how many of "count" frames can be written contiguously to the history starting at inputIndex
+// (which is all of them unless the ring wraps), and the physical frame to write them at.
+
+static int history_span (Resample *cxt, int count, int *frame)
 {
-    int num_loops = num_taps >> 1;
-    float sum = 0.0;
+    *frame = history_frame (cxt, cxt->inputIndex);
 
-    do {
-        sum += (A[0] * B[0]) + (A[1] * B[1]);
-        A += 2; B += 2;
-    } while (--num_loops);
+    if ((cxt->flags & RING_HISTORY) && count > cxt->numSamples - *frame)
+        count = cxt->numSamples - *frame;
 
-    return sum;
+    return count;
 }
-#endif
 
-#if 0   // Version 3 (4x unrolled loop)
-static double apply_filter (float *A, float *B, int num_taps)
+// Append "count" frames of planar or interleaved input to the history (which the caller guarantees has
+// room for them).
+
+static void append_planar (Resample *cxt, const float *const *input, int offset, int count)
 {
-    int num_loops = num_taps >> 2;
-    float sum = 0.0;
+    int frame, span, i, j;
 
-    do {
-        sum += (A[0] * B[0]) + (A[1] * B[1]) + (A[2] * B[2]) + (A[3] * B[3]);
-        A += 4; B += 4;
-    } while (--num_loops);
+    for (; count; count -= span, offset += span) {
+        span = history_span (cxt, count, &frame);
 
-    return sum;
+        if (cxt->history) {
+            for (i = 0; i < cxt->numChannels; ++i) {
+                float *dst = cxt->history + frame * cxt->channelStride + i;
+                const float *src = input [i] + offset;
+
+                for (j = 0; j < span; ++j, dst += cxt->channelStride)
+                    *dst = *src++;
+            }
+        }
+        else
+            for (i = 0; i < cxt->numChannels; ++i) {
+                memcpy (cxt->buffers [i] + frame, input [i] + offset, span * sizeof (float));
+
+                if (cxt->flags & Q15_FILTERS)
+                    convert_to_q31 (cxt->buffers [i] + frame, span);
+            }
+
+        mirror_history (cxt, frame, span);
+        cxt->inputIndex += span;
+    }
 }
-#endif
 
-#if 0   // Version 4 (outside-in order, may be more accurate)
-static double apply_filter (float *A, float *B, int num_taps)
+static void append_interleaved (Resample *cxt, const float *input, int count)
 {
-    int i = num_taps - 1;
-    float sum = 0.0;
+    int frame, span, i, j;
 
-    do {
-        sum += (A[0] * B[0]) + (A[i] * B[i]);
-        A++; B++;
-    } while ((i -= 2) > 0);
+    for (; count; count -= span, input += span * cxt->numChannels) {
+        span = history_span (cxt, count, &frame);
 
-    return sum;
+        if (cxt->history && cxt->channelStride == cxt->numChannels)
+            memcpy (cxt->history + frame * cxt->channelStride, input, span * cxt->numChannels * sizeof (float));
+        else if (cxt->history)
+            for (j = 0; j < span; ++j)
+                memcpy (cxt->history + (frame + j) * cxt->channelStride, input + j * cxt->numChannels, cxt->numChannels * sizeof (float));
+        else
+            for (i = 0; i < cxt->numChannels; ++i) {
+                const float *src = input + i;
+                float *dst = cxt->buffers [i] + frame;
+
+                for (j = 0; j < span; ++j, src += cxt->numChannels)
+                    *dst++ = *src;
+
+                if (cxt->flags & Q15_FILTERS)
+                    convert_to_q31 (cxt->buffers [i] + frame, span);
+            }
+
+        mirror_history (cxt, frame, span);
+        cxt->inputIndex += span;
+    }
 }
-#endif
 
-static void init_filter (Resample *cxt, float *filter, double fraction, double lowpass_ratio)
+// Return the number of input frames that can be appended in one run right now; this is the number
+// needed before the next output can be generated, limited by what's available and by the room left
+// in the history buffer (which is shifted first if it's full). The caller has already determined that
+// the next output cannot be generated (i.e. outputOffset >= inputIndex - numTaps / 2).
+
+static int input_run_length (Resample *cxt, int numInputFrames)
 {
-    const double a0 = 0.35875;
-    const double a1 = 0.48829;
-    const double a2 = 0.14128;
-    const double a3 = 0.01168;
-    double filter_sum = 0.0;
-    int i;
+    int run;
 
-    // "dist" is the absolute distance from the sinc maximum to the filter tap to be calculated, in radians
-    // "ratio" is that distance divided by half the tap count such that it reaches π at the window extremes
+    if (cxt->inputIndex == cxt->numSamples)
+        shift_history (cxt);
 
-    // Note that with this scaling, the odd terms of the Blackman-Harris calculation appear to be negated
-    // with respect to the reference formula version.
+    run = output_index (cxt) + cxt->numTaps / 2 + 1 - cxt->inputIndex;
 
-    for (i = 0; i < cxt->numTaps; ++i) {
-        double dist = fabs ((cxt->numTaps / 2 - 1) + fraction - i) * M_PI;
-        double ratio = dist / (cxt->numTaps / 2);
-        double value;
+    if (run > cxt->numSamples - cxt->inputIndex)
+        run = cxt->numSamples - cxt->inputIndex;
 
-        if (dist != 0.0) {
-            value = sin (dist * lowpass_ratio) / (dist * lowpass_ratio);
+    if (run > numInputFrames)
+        run = numInputFrames;
 
-            if (cxt->flags & BLACKMAN_HARRIS)
-                value *= a0 + a1 * cos (ratio) + a2 * cos (2 * ratio) + a3 * cos (3 * ratio);
-            else
-                value *= 0.5 * (1.0 + cos (ratio));     // Hann window
+    return run;
+}
+
+// The processing functions alternate between appending runs of input frames to the history and then
+// generating as many output frames as the buffered history allows. The step between outputs is "step",
+// plus "ramp" more for each output (for the ramped versions; zero otherwise), and the last step used is
+// returned in *last_step.
+
+static ResampleResult process_planar (Resample *cxt, const float *const *input, int numInputFrames, float *const *output, int numOutputFrames, double step, double ramp, double *last_step)
+{
+    int i, ramp_fixed = ramp != 0.0 && (cxt->flags & FIXED_POINT_PHASE) && !(cxt->flags & RATIONAL_PHASE);
+    ResampleResult res = { 0, 0 };
+
+    while (numOutputFrames > 0) {
+        if (!output_ready (cxt)) {
+            int run;
+
+            if (!numInputFrames)
+                break;
+
+            run = input_run_length (cxt, numInputFrames);
+            append_planar (cxt, input, res.input_used, run);
+            res.input_used += run;
+            numInputFrames -= run;
         }
-        else
-            value = 1.0;
+        else do {
+            subsample_frame (cxt, cxt->frame);
 
-        filter_sum += cxt->tempFilter [i] = value;
-    }
+            for (i = 0; i < cxt->numChannels; ++i)
+                output [i] [res.output_generated] = cxt->frame [i];
 
-    // filter should have unity DC gain
+            if (ramp != 0.0) {
+                step += ramp;
 
-    double scaler = 1.0 / filter_sum, error = 0.0;
+                if (ramp_fixed)
+                    fixed_phase_step_direct (cxt, step);
+            }
 
-    for (i = cxt->numTaps / 2; i < cxt->numTaps; i = cxt->numTaps - i - (i >= cxt->numTaps / 2)) {
-        filter [i] = (cxt->tempFilter [i] *= scaler) - error;
-        error += filter [i] - cxt->tempFilter [i];
+            output_advance (cxt, step);
+            res.output_generated++;
+        } while (--numOutputFrames && output_ready (cxt));
     }
+
+    STATS_INC (cxt, processCalls);
+    STATS_ADD (cxt, inputFrames, res.input_used);
+    STATS_ADD (cxt, outputFrames, res.output_generated);
+    *last_step = step;
+    return res;
 }
 
-static double subsample_no_interpolate (Resample *cxt, float *source, double offset)
+// With a writer, the interleaved output goes to the writerFrames chunk instead, which is handed to the
+// writer whenever it fills (and at the end).
+
+static ResampleResult process_interleaved (Resample *cxt, const float *input, int numInputFrames, float *output, int numOutputFrames, double step, double ramp, double *last_step,
+    ResampleWriter writer, void *context)
 {
-    source += (int) floor (offset);
-    offset -= floor (offset);
+    int ramp_fixed = ramp != 0.0 && (cxt->flags & FIXED_POINT_PHASE) && !(cxt->flags & RATIONAL_PHASE), pending = 0;
+    ResampleResult res = { 0, 0 };
 
-    if (offset == 0.0 && !(cxt->flags & INCLUDE_LOWPASS))
-        return *source;
+    if (writer)
+        output = cxt->writerFrames;
 
-    return apply_filter (
-        cxt->filters [(int) floor (offset * cxt->numFilters + 0.5)],
-        source - cxt->numTaps / 2 + 1, cxt->numTaps);
-}
+    while (numOutputFrames > 0) {
+        if (!output_ready (cxt)) {
+            int run;
 
-static double subsample_interpolate (Resample *cxt, float *source, double offset)
-{
-    double sum1, sum2;
-    int i;
+            if (!numInputFrames)
+                break;
+
+            run = input_run_length (cxt, numInputFrames);
+            append_interleaved (cxt, input, run);
+            input += run * cxt->numChannels;
+            res.input_used += run;
+            numInputFrames -= run;
+        }
+        else do {
+            if (cxt->history) {
+                subsample_frame (cxt, cxt->frame);
+                memcpy (output, cxt->frame, cxt->numChannels * sizeof (float));
+            }
+            else
+                subsample_frame (cxt, output);
 
-    source += (int) floor (offset);
-    offset -= floor (offset);
+            if (ramp != 0.0) {
+                step += ramp;
 
-     if (offset == 0.0 && !(cxt->flags & INCLUDE_LOWPASS))
-        return *source;
+                if (ramp_fixed)
+                    fixed_phase_step_direct (cxt, step);
+            }
 
-    i = (int) floor (offset *= cxt->numFilters);
-    sum1 = apply_filter (cxt->filters [i], source - cxt->numTaps / 2 + 1, cxt->numTaps);
+            output += cxt->numChannels;
+            output_advance (cxt, step);
+            res.output_generated++;
 
-    if ((offset -= i) == 0.0 && !(cxt->flags & INCLUDE_LOWPASS))
-        return sum1;
+            if (writer && ++pending == RESAMPLE_WRITER_FRAMES) {
+                writer (context, cxt->writerFrames, pending);
+                output = cxt->writerFrames;
+                pending = 0;
+            }
+        } while (--numOutputFrames && output_ready (cxt));
+    }
 
-    sum2 = apply_filter (cxt->filters [i+1], source - cxt->numTaps / 2 + 1, cxt->numTaps);
+    if (pending)
+        writer (context, cxt->writerFrames, pending);
 
-    return sum2 * offset + sum1 * (1.0 - offset);
+    STATS_INC (cxt, processCalls);
+    STATS_ADD (cxt, inputFrames, res.input_used);
+    STATS_ADD (cxt, outputFrames, res.output_generated);
+    *last_step = step;
+    return res;
 }
 
-double subsample (Resample *cxt, float *source, double offset)
+ResampleResult resampleProcess (Resample *cxt, const float *const *input, int numInputFrames, float *const *output, int numOutputFrames, double ratio)
 {
-    if (cxt->flags & SUBSAMPLE_INTERPOLATE)
-        return subsample_interpolate (cxt, source, offset);
-    else
-        return subsample_no_interpolate (cxt, source, offset);
+    double last_step;
+
+    if (cxt->flags & FIXED_POINT_PHASE)
+        fixed_phase_step (cxt, ratio);
+
+    return process_planar (cxt, input, numInputFrames, output, numOutputFrames, 1.0 / ratio, 0.0, &last_step);
 }
 
-Resample *resampleInit (int numChannels, int numTaps, int numFilters, double lowpassRatio, int flags)
+ResampleResult resampleProcessInterleaved (Resample *cxt, const float *input, int numInputFrames, float *output, int numOutputFrames, double ratio)
 {
-    Resample *cxt = calloc (1, sizeof (Resample));
-    int i;
+    double last_step;
 
-    if (lowpassRatio > 0.0 && lowpassRatio < 1.0)
-        flags |= INCLUDE_LOWPASS;
-    else {
-        flags &= ~INCLUDE_LOWPASS;
-        lowpassRatio = 1.0;
-    }
+    if (cxt->flags & FIXED_POINT_PHASE)
+        fixed_phase_step (cxt, ratio);
 
-    if ((numTaps & 3) || numTaps <= 0 || numTaps > 1024) {
-        fprintf (stderr, "must 4-1024 filter taps, and a multiple of 4!\n");
-        return NULL;
-    }
+    return process_interleaved (cxt, input, numInputFrames, output, numOutputFrames, 1.0 / ratio, 0.0, &last_step, NULL, NULL);
+}
 
-    if (numFilters < 2 || numFilters > 1024) {
-        fprintf (stderr, "must be 2-1024 filters!\n");
-        return NULL;
-    }
+// Like resampleProcessInterleaved(), but instead of storing the output this passes it to "writer" in runs
+// of up to RESAMPLE_WRITER_FRAMES as it's generated (so the next stages see it while it's still in the
+// cache, rather than in another pass over a whole buffer). The result is the same, frame for frame.
 
-    cxt->numChannels = numChannels;
-    cxt->numSamples = numTaps * 16;
-    cxt->numFilters = numFilters;
-    cxt->numTaps = numTaps;
-    cxt->flags = flags;
+ResampleResult resampleProcessInterleavedWriter (Resample *cxt, const float *input, int numInputFrames, ResampleWriter writer, void *context, int numOutputFrames, double ratio)
+{
+    double last_step;
 
-    // note that we actually have one more than the specified number of filters
+    if (cxt->flags & FIXED_POINT_PHASE)
+        fixed_phase_step (cxt, ratio);
 
-    cxt->filters = calloc (cxt->numFilters + 1, sizeof (float*));
-    cxt->tempFilter = malloc (numTaps * sizeof (double));
+    return process_interleaved (cxt, input, numInputFrames, NULL, numOutputFrames, 1.0 / ratio, 0.0, &last_step, writer, context);
+}
 
-    for (i = 0; i <= cxt->numFilters; ++i) {
-        cxt->filters [i] = calloc (cxt->numTaps, sizeof (float));
-        init_filter (cxt, cxt->filters [i], (double) i / cxt->numFilters, lowpassRatio);
-    }
+// The ramped processing functions are for ASRC use (e.g., in a pull-mode audio callback): they generate
+// numOutputFrames of output (unless the input runs out first, which is an underrun) and consume only the
+// input needed for that (see resampleGetRequiredSamplesRamped()), and the ratio is ramped linearly from
+// where the last ramped call left it (or targetRatio the first time) to targetRatio across the outputs,
+// which avoids the steps in the phase slope that changing the ratio per call would cause. The work per
+// call is bounded by numOutputFrames convolutions, and with RING_HISTORY there's no periodic history copy.
+// With RATIONAL_PHASE the ratio is fixed, so this is the same as the regular functions.
 
-    free (cxt->tempFilter); cxt->tempFilter = NULL;
-    cxt->buffers = calloc (numChannels, sizeof (float*));
+static double ramp_start (Resample *cxt, double targetRatio, int numOutputFrames, double *ramp)
+{
+    double start = cxt->rampStep > 0.0 ? cxt->rampStep : 1.0 / targetRatio;
 
-    for (i = 0; i < numChannels; ++i)
-        cxt->buffers [i] = calloc (cxt->numSamples, sizeof (float));
+    *ramp = numOutputFrames > 0 && !(cxt->flags & RATIONAL_PHASE) ? (1.0 / targetRatio - start) / numOutputFrames : 0.0;
 
-    cxt->outputOffset = numTaps / 2;
-    cxt->inputIndex = numTaps;
+    if ((cxt->flags & FIXED_POINT_PHASE) && !(cxt->flags & RATIONAL_PHASE))
+        fixed_phase_step_direct (cxt, start);
 
-    return cxt;
+    return start;
 }
 
-void resampleReset (Resample *cxt)
+// After a complete block the ramp lands exactly on the target (otherwise it stays where it got to).
+
+static void ramp_finish (Resample *cxt, double targetRatio, int numOutputFrames, ResampleResult res, double last_step)
 {
-    int i;
+    cxt->rampStep = (int) res.output_generated == numOutputFrames ? 1.0 / targetRatio : last_step;
+}
 
-    for (i = 0; i < cxt->numChannels; ++i)
-        memset (cxt->buffers [i], 0,  cxt->numSamples * sizeof (float));
+ResampleResult resampleProcessRamped (Resample *cxt, const float *const *input, int numInputFrames, float *const *output, int numOutputFrames, double targetRatio)
+{
+    double ramp, step = ramp_start (cxt, targetRatio, numOutputFrames, &ramp), last_step;
+    ResampleResult res = process_planar (cxt, input, numInputFrames, output, numOutputFrames, step, ramp, &last_step);
 
-    cxt->outputOffset = cxt->numTaps / 2;
-    cxt->inputIndex = cxt->numTaps;
+    ramp_finish (cxt, targetRatio, numOutputFrames, res, last_step);
+    return res;
 }
 
-ResampleResult resampleProcess (Resample *cxt, const float *const *input, int numInputFrames, float *const *output, int numOutputFrames, double ratio)
+ResampleResult resampleProcessInterleavedRamped (Resample *cxt, const float *input, int numInputFrames, float *output, int numOutputFrames, double targetRatio)
 {
-    int half_taps = cxt->numTaps / 2, i;
-    ResampleResult res = { 0, 0 };
+    double ramp, step = ramp_start (cxt, targetRatio, numOutputFrames, &ramp), last_step;
+    ResampleResult res = process_interleaved (cxt, input, numInputFrames, output, numOutputFrames, step, ramp, &last_step, NULL, NULL);
 
-    while (numOutputFrames > 0) {
-        if (cxt->outputOffset >= cxt->inputIndex - half_taps) {
-            if (numInputFrames > 0) {
-                if (cxt->inputIndex == cxt->numSamples) {
-                    for (i = 0; i < cxt->numChannels; ++i)
-                        memmove (cxt->buffers [i], cxt->buffers [i] + cxt->numSamples - cxt->numTaps, cxt->numTaps * sizeof (float));
+    ramp_finish (cxt, targetRatio, numOutputFrames, res, last_step);
+    return res;
+}
 
-                    cxt->outputOffset -= cxt->numSamples - cxt->numTaps;
-                    cxt->inputIndex -= cxt->numSamples - cxt->numTaps;
-                }
+// Return the number of input frames that a ramped processing call for "numOutputFrames" would need now.
+// Unlike the other queries this steps through the output positions (without doing any of the work), so it
+// is proportional to numOutputFrames, but that's negligible compared to generating them.
 
-                for (i = 0; i < cxt->numChannels; ++i)
-                    cxt->buffers [i] [cxt->inputIndex] = input [i] [res.input_used];
+unsigned int resampleGetRequiredSamplesRamped (Resample *cxt, int numOutputFrames, double targetRatio)
+{
+    Resample sim = *cxt;
+    double ramp, step = ramp_start (&sim, targetRatio, numOutputFrames, &ramp);
+    int ramp_fixed = ramp != 0.0 && (sim.flags & FIXED_POINT_PHASE) && !(sim.flags & RATIONAL_PHASE);
+    unsigned int input_used = 0;
 
-                cxt->inputIndex++;
-                res.input_used++;
-                numInputFrames--;
-            }
-            else
-                break;
+    while (numOutputFrames > 0) {
+        if (!output_ready (&sim)) {
+            if (sim.inputIndex == sim.numSamples)
+                shift_position (&sim, sim.numSamples - sim.numTaps);
+
+            sim.inputIndex++;
+            input_used++;
         }
         else {
-            for (i = 0; i < cxt->numChannels; ++i)
-                output [i] [res.output_generated] = subsample (cxt, cxt->buffers [i], cxt->outputOffset);
+            if (ramp != 0.0) {
+                step += ramp;
 
-            cxt->outputOffset += (1.0 / ratio);
-            res.output_generated++;
+                if (ramp_fixed)
+                    fixed_phase_step_direct (&sim, step);
+            }
+
+            output_advance (&sim, step);
             numOutputFrames--;
         }
     }
 
-    return res;
+    return input_used;
 }
 
-ResampleResult resampleProcessInterleaved (Resample *cxt, const float *input, int numInputFrames, float *output, int numOutputFrames, double ratio)
-{
-    int half_taps = cxt->numTaps / 2, i;
-    ResampleResult res = { 0, 0 };
+// The query functions normally work out their answers directly from the position. Outputs are generated
+// while the whole part of the position is less than inputIndex - numTaps / 2, and shifting the history
+// moves both the position and inputIndex by the same whole number of frames, so only the position after
+// a given number of output steps is needed (the shifts can be ignored). That's exact integer math with
+// FIXED_POINT_PHASE or RATIONAL_PHASE. The double position, however, is the sum of the steps rounded one
+// at a time (in whatever range the shifts leave it), so its whole part is only certain when the straight
+// calculation isn't within the accumulated rounding error of an integer. When it is (or the numbers get
+// too big for the integer math) the query falls back to running the same state machine as the processing
+// functions (without doing any of the work) on a copy of the context, so it's always exact.
 
-    while (numOutputFrames > 0) {
-        if (cxt->outputOffset >= cxt->inputIndex - half_taps) {
-            if (numInputFrames > 0) {
-                if (cxt->inputIndex == cxt->numSamples) {
-                    for (i = 0; i < cxt->numChannels; ++i)
-                        memmove (cxt->buffers [i], cxt->buffers [i] + cxt->numSamples - cxt->numTaps, cxt->numTaps * sizeof (float));
+#define QUERY_MAX_ADJUST 16
 
-                    cxt->outputOffset -= cxt->numSamples - cxt->numTaps;
-                    cxt->inputIndex -= cxt->numSamples - cxt->numTaps;
-                }
+// Find the whole part of the position after "steps" output steps from the current one (the context's
+// fixed-point step must already be set up). Returns FALSE if it can't be determined exactly.
 
-                for (i = 0; i < cxt->numChannels; ++i)
-                    cxt->buffers [i] [cxt->inputIndex] = *input++;
+static int query_position (Resample *cxt, double step, int64_t steps, int64_t *whole)
+{
+    if (steps < 0 || steps > 0x7fffffff)
+        return 0;
 
-                cxt->inputIndex++;
-                res.input_used++;
-                numInputFrames--;
-            }
-            else
-                break;
-        }
-        else {
-            for (i = 0; i < cxt->numChannels; ++i)
-                *output++ = subsample (cxt, cxt->buffers [i], cxt->outputOffset);
+    if (cxt->flags & RATIONAL_PHASE) {
+        *whole = (cxt->outputPhase >> 32) + steps * cxt->rationalStep + (cxt->rationalPhase + steps * cxt->rationalStepPhase) / cxt->numFilters;
+        return 1;
+    }
+    else if (cxt->flags & FIXED_POINT_PHASE) {
+        uint64_t carries = (cxt->phaseExtra + (uint64_t) steps * cxt->phaseStepExtra) >> 32;
 
-            cxt->outputOffset += (1.0 / ratio);
-            res.output_generated++;
-            numOutputFrames--;
+        if (cxt->phaseStep < 0 || (cxt->phaseStep && steps > INT64_MAX / 4 / cxt->phaseStep))
+            return 0;
+
+        *whole = (cxt->outputPhase + steps * cxt->phaseStep + (int64_t) carries) >> 32;
+        return 1;
+    }
+    else {
+        double position = cxt->outputOffset + steps * step, error, low, high;
+        double range = fabs (cxt->outputOffset) + cxt->numSamples + fabs (step);
+        double scaled_offset = ldexp (cxt->outputOffset, 32), scaled_step = ldexp (step, 32);
+        int exponent;
+
+        // if the position and the step have no more than 32 fractional bits (e.g., integer or power-of-two
+        // ratios) and stay small enough, the steps are never rounded and this can be done in fixed-point
+
+        if (range < 1048576.0 && scaled_offset == floor (scaled_offset) && scaled_step == floor (scaled_step) &&
+            scaled_step > 0.0 && steps <= INT64_MAX / 4 / (int64_t) scaled_step) {
+                *whole = ((int64_t) scaled_offset + steps * (int64_t) scaled_step) >> 32;
+                return 1;
         }
+
+        // each rounded step can be off by half a unit in the last place of the largest position it could
+        // reach (bounded generously here), and the straight calculation itself is rounded (twice)
+
+        frexp (range, &exponent);
+        error = steps * ldexp (1.0, exponent - 53) + (fabs (steps * step) + fabs (position)) * ldexp (1.0, -51);
+        low = floor (position - error);
+        high = floor (position + error);
+
+        if (low != high || fabs (position) > 1e15)
+            return 0;
+
+        *whole = (int64_t) low;
+        return 1;
     }
+}
 
-    return res;
+// Return the exact position step "steps" as a double (for the estimate in query_expected()).
+
+static double query_step (Resample *cxt, double step)
+{
+    if (cxt->flags & RATIONAL_PHASE)
+        return cxt->rationalStep + (double) cxt->rationalStepPhase / cxt->numFilters;
+    else if (cxt->flags & FIXED_POINT_PHASE)
+        return (cxt->phaseStep + cxt->phaseStepExtra / 4294967296.0) / 4294967296.0;
+    else
+        return step;
 }
 
-unsigned int resampleGetRequiredSamples (Resample *cxt, int numOutputFrames, double ratio)
+static double query_start (Resample *cxt)
 {
-    int half_taps = cxt->numTaps / 2;
-    int input_index = cxt->inputIndex;
-    double offset = cxt->outputOffset;
-    ResampleResult res = { 0, 0 };
+    if (cxt->flags & RATIONAL_PHASE)
+        return (double) (cxt->outputPhase >> 32) + (double) cxt->rationalPhase / cxt->numFilters;
+    else if (cxt->flags & FIXED_POINT_PHASE)
+        return (cxt->outputPhase + cxt->phaseExtra / 4294967296.0) / 4294967296.0;
+    else
+        return cxt->outputOffset;
+}
+
+// The number of input frames needed for "numOutputFrames" more outputs, which is whatever brings inputIndex
+// past the last one's position (plus half the filter). Returns FALSE if that couldn't be worked out.
+
+static int query_required (Resample *cxt, double step, int numOutputFrames, unsigned int *required)
+{
+    int64_t whole, needed;
+
+    if (numOutputFrames <= 0) {
+        *required = 0;
+        return 1;
+    }
+
+    if (!query_position (cxt, step, numOutputFrames - 1, &whole))
+        return 0;
+
+    needed = whole + cxt->numTaps / 2 + 1 - cxt->inputIndex;
+    *required = needed > 0 ? (unsigned int) needed : 0;
+    return 1;
+}
+
+// The number of outputs that "numInputFrames" more input frames allow, which is the number of output
+// steps before the position reaches the final inputIndex - numTaps / 2. This is estimated and then moved
+// to the exact answer. Returns FALSE if that couldn't be worked out.
+
+static int query_expected (Resample *cxt, double step, int numInputFrames, unsigned int *expected)
+{
+    int64_t limit = (int64_t) cxt->inputIndex + (numInputFrames > 0 ? numInputFrames : 0) - cxt->numTaps / 2, whole;
+    double estimate = ceil ((limit - query_start (cxt)) / query_step (cxt, step));
+    int64_t count = estimate > 0.0 ? (estimate < 2147483647.0 ? (int64_t) estimate : 0x7fffffff) : 0;
+    int adjust = 0;
+
+    // move down while the step before "count" already reaches the limit, then up while "count" doesn't
+
+    while (count > 0) {
+        if (adjust++ == QUERY_MAX_ADJUST || !query_position (cxt, step, count - 1, &whole))
+            return 0;
+
+        if (whole < limit)
+            break;
+
+        count--;
+    }
+
+    while (1) {
+        if (adjust++ == QUERY_MAX_ADJUST || !query_position (cxt, step, count, &whole))
+            return 0;
+
+        if (whole >= limit)
+            break;
+
+        count++;
+    }
+
+    *expected = (unsigned int) count;
+    return 1;
+}
+
+static unsigned int simulate_required (Resample *sim, double step, int numOutputFrames)
+{
+    unsigned int input_used = 0;
 
     while (numOutputFrames > 0) {
-        if (offset >= input_index - half_taps) {
-            if (input_index == cxt->numSamples) {
-                offset -= cxt->numSamples - cxt->numTaps;
-                input_index -= cxt->numSamples - cxt->numTaps;
-            }
+        if (!output_ready (sim)) {
+            if (sim->inputIndex == sim->numSamples)
+                shift_position (sim, sim->numSamples - sim->numTaps);
 
-            input_index++;
-            res.input_used++;
+            sim->inputIndex++;
+            input_used++;
         }
         else {
-            offset += (1.0 / ratio);
+            output_advance (sim, step);
             numOutputFrames--;
         }
     }
 
-    return res.input_used;
+    return input_used;
 }
 
-unsigned int resampleGetExpectedOutput (Resample *cxt, int numInputFrames, double ratio)
+static unsigned int simulate_expected (Resample *sim, double step, int numInputFrames)
 {
-    int half_taps = cxt->numTaps / 2;
-    int input_index = cxt->inputIndex;
-    double offset = cxt->outputOffset;
-    ResampleResult res = { 0, 0 };
+    unsigned int output_generated = 0;
 
     while (1) {
-        if (offset >= input_index - half_taps) {
+        if (!output_ready (sim)) {
             if (numInputFrames > 0) {
-                if (input_index == cxt->numSamples) {
-                    offset -= cxt->numSamples - cxt->numTaps;
-                    input_index -= cxt->numSamples - cxt->numTaps;
-                }
+                if (sim->inputIndex == sim->numSamples)
+                    shift_position (sim, sim->numSamples - sim->numTaps);
 
-                input_index++;
+                sim->inputIndex++;
                 numInputFrames--;
             }
             else
                 break;
         }
         else {
-            offset += (1.0 / ratio);
-            res.output_generated++;
+            output_advance (sim, step);
+            output_generated++;
         }
     }
 
-    return res.output_generated;
+    return output_generated;
+}
+
+// Return the number of input frames needed to generate "numOutputFrames" more outputs at this ratio.
+
+unsigned int resampleGetRequiredSamples (Resample *cxt, int numOutputFrames, double ratio)
+{
+    Resample sim = *cxt;
+    double step = 1.0 / ratio;
+    unsigned int required;
+
+    if (sim.flags & FIXED_POINT_PHASE)
+        fixed_phase_step (&sim, ratio);
+
+    if (query_required (&sim, step, numOutputFrames, &required))
+        return required;
+
+    return simulate_required (&sim, step, numOutputFrames);
+}
+
+// Return the number of outputs that "numInputFrames" more input frames will generate at this ratio.
+
+unsigned int resampleGetExpectedOutput (Resample *cxt, int numInputFrames, double ratio)
+{
+    Resample sim = *cxt;
+    double step = 1.0 / ratio;
+    unsigned int expected;
+
+    if (sim.flags & FIXED_POINT_PHASE)
+        fixed_phase_step (&sim, ratio);
+
+    if (query_expected (&sim, step, numInputFrames, &expected))
+        return expected;
+
+    return simulate_expected (&sim, step, numInputFrames);
+}
+
+// Return exactly what resampleProcess() or resampleProcessInterleaved() would return if called now with
+// these buffer sizes: if the input makes more outputs than there is room for, only the input that's needed
+// for the outputs that fit is used, otherwise all of the input is used.
+
+ResampleResult resampleGetProcessResult (Resample *cxt, int numInputFrames, int numOutputFrames, double ratio)
+{
+    ResampleResult res = { 0, 0 };
+    unsigned int expected;
+
+    if (numOutputFrames <= 0)
+        return res;
+
+    if ((expected = resampleGetExpectedOutput (cxt, numInputFrames, ratio)) >= (unsigned int) numOutputFrames) {
+        res.output_generated = numOutputFrames;
+        res.input_used = resampleGetRequiredSamples (cxt, numOutputFrames, ratio);
+    }
+    else {
+        res.output_generated = expected;
+        res.input_used = numInputFrames > 0 ? numInputFrames : 0;
+    }
+
+    return res;
+}
+
+// Return the delay of the filters in input frames, which is what the position would normally be advanced
+// by (with resampleAdvancePosition()) to align the output with the input. This is numTaps / 2 for the
+// linear-phase filters; for MINIMUM_PHASE it's the group delay at low frequencies (a few frames for most
+// lowpass settings), which rises toward the cutoff.
+
+double resampleGetGroupDelay (Resample *cxt)
+{
+    return cxt->filterBank->groupDelay;
 }
 
 void resampleAdvancePosition (Resample *cxt, double delta)
 {
     if (delta < 0.0)
         fprintf (stderr, "resampleAdvancePosition() can only advance forward!\n");
+    else if (cxt->flags & RATIONAL_PHASE) {
+        double whole = floor (delta);
+        int phase = (int) floor ((delta - whole) * cxt->numFilters + 0.5);
+
+        cxt->outputPhase += (int64_t) whole << 32;
+
+        if ((cxt->rationalPhase += phase) >= cxt->numFilters) {
+            cxt->rationalPhase -= cxt->numFilters;
+            cxt->outputPhase += (int64_t) 1 << 32;
+        }
+    }
+    else if (cxt->flags & FIXED_POINT_PHASE)
+        cxt->outputPhase += (int64_t) floor (delta * 4294967296.0 + 0.5);
     else
         cxt->outputOffset += delta;
 }
 
 double resampleGetPosition (Resample *cxt)
 {
+    if (cxt->flags & RATIONAL_PHASE)
+        return (cxt->outputPhase >> 32) + (double) cxt->rationalPhase / cxt->numFilters + (cxt->numTaps / 2.0) - cxt->inputIndex;
+
+    if (cxt->flags & FIXED_POINT_PHASE)
+        return (cxt->outputPhase + cxt->phaseExtra / 4294967296.0) / 4294967296.0 + (cxt->numTaps / 2.0) - cxt->inputIndex;
+
     return cxt->outputOffset + (cxt->numTaps / 2.0) - cxt->inputIndex;
 }
 
-void resampleFree (Resample *cxt)
+// The servo starts at the nominal ratio with no integrated error.
+
+void resampleServoInit (ResampleServo *servo, double nominalRatio, double targetFill, double kp, double ki, double maxDeviation)
 {
-    int i;
+    memset (servo, 0, sizeof (ResampleServo));
+    servo->nominalRatio = servo->ratio = nominalRatio;
+    servo->targetFill = targetFill;
+    servo->kp = kp;
+    servo->ki = ki;
+    servo->maxDeviation = maxDeviation;
+}
 
-    for (i = 0; i <= cxt->numFilters; ++i)
-        free (cxt->filters [i]);
+// Update the servo with the current number of frames in the caller's input FIFO (i.e., not yet passed to
+// the resampler) and return the ratio to use for the next block. A fuller FIFO gives a lower ratio (more
+// input consumed per output frame).
 
-    free (cxt->filters);
+double resampleServoUpdate (ResampleServo *servo, Resample *cxt, double fifoFrames)
+{
+    double fill = cxt ? fifoFrames - resampleGetPosition (cxt) : fifoFrames, deviation;
+
+    servo->error = fill - servo->targetFill;
+    deviation = servo->kp * servo->error + servo->ki * (servo->integral + servo->error);
+
+    if (deviation > servo->maxDeviation)
+        deviation = servo->maxDeviation;
+    else if (deviation < -servo->maxDeviation)
+        deviation = -servo->maxDeviation;
+    else
+        servo->integral += servo->error;
 
-    for (i = 0; i < cxt->numChannels; ++i)
-        free (cxt->buffers [i]);
+    servo->ratio = servo->nominalRatio * (1.0 - deviation);
+    return servo->ratio;
+}
+
+void resampleFree (Resample *cxt)
+{
+    if (cxt->inPlace)       // everything is in the caller's arena
+        return;
 
-    free (cxt->buffers);
-    free (cxt);
+    release_filter_bank (cxt->filterBank);
+    aligned_free (cxt);     // the buffers are all in the same block
 }
@@ -17,30 +17,166 @@
 #define SUBSAMPLE_INTERPOLATE   0x1
 #define BLACKMAN_HARRIS         0x2
 #define INCLUDE_LOWPASS         0x4
+#define INTERLEAVED_HISTORY     0x8     // single frame-interleaved history block (best for many channels)
+#define RING_HISTORY            0x10    // power-of-two ring history (no periodic memmove of the history)
+#define FIXED_POINT_PHASE       0x20    // track position in 32.32 fixed-point (exact, integer-only phase math)
+#define RATIONAL_PHASE          0x40    // set internally by resampleInitRational()
+#define PAIRED_FILTERS          0x80    // store adjacent filters interleaved for SUBSAMPLE_INTERPOLATE (2x memory)
+#define COMPACT_FILTERS         0x100   // store only half the phases and mirror the rest (1/2 memory)
+#define Q15_FILTERS             0x200   // Q15 filters x Q31 history with 64-bit accumulation (1/2 memory)
+#define FP16_FILTERS            0x400   // half-precision filters with float accumulation (1/2 memory)
+#define MINIMUM_PHASE           0x800   // minimum-phase filters (low delay, see resampleGetGroupDelay())
+#define LAZY_FILTERS            0x1000  // generate each filter the first time it's used (see resampleWarmFilters())
+
+// The history length is normally 16 times the number of filter taps; another multiplier (2-127) can be
+// requested by OR'ing HISTORY_MULTIPLIER(n) into the flags (rounded up to a power of two for RING_HISTORY).
+
+#define HISTORY_MULTIPLIER_SHIFT    24
+#define HISTORY_MULTIPLIER_MASK     (0x7f << HISTORY_MULTIPLIER_SHIFT)
+#define HISTORY_MULTIPLIER(n)       (((n) & 0x7f) << HISTORY_MULTIPLIER_SHIFT)
+
+// convolution kernel (selected at runtime in resampleInit() based on the CPU's SIMD support, unless a
+// specific variant has been forced with resampleSetKernel())
+
+#define RESAMPLE_KERNEL_AUTO    0
+#define RESAMPLE_KERNEL_SCALAR  1
+#define RESAMPLE_KERNEL_SSE2    2       // x86
+#define RESAMPLE_KERNEL_AVX2    3       // x86, AVX2 + FMA
+#define RESAMPLE_KERNEL_AVX512  4       // x86, AVX-512F
+#define RESAMPLE_KERNEL_NEON    5       // ARM
+#define RESAMPLE_NUM_KERNELS    6
+
+typedef double (*ResampleKernel) (const float *filter, const float *source, int num_taps);
+typedef void (*ResampleKernelX4) (const float *filter, float *const *buffers, int start, int num_taps, float *results);
+typedef void (*ResampleKernelInterleaved) (const float *filter, const float *history, int stride, int num_taps, float *results);
+typedef int64_t (*ResampleKernelQ15) (const int16_t *filter, const int32_t *source, int num_taps);
+typedef double (*ResampleKernelHalf) (const uint16_t *filter, const float *source, int num_taps);
+
+// The filters themselves depend only on the taps, filters, lowpass and window (and the padded kernel
+// width), so they are kept in reference-counted banks that are shared (read-only) by every Resample
+// instance initialized with the same parameters. Each bank is a single aligned slab with the filters
+// filterStride floats apart. With PAIRED_FILTERS the slab instead holds numFilters pairs, each being
+// filter i and the difference to filter i+1 interleaved in cache-line blocks (and "filters" is NULL).
+// With COMPACT_FILTERS only filters 0 to numFilters / 2 are stored because the filter for phase 1 - f is
+// the filter for phase f reversed (numStored is the number of filters actually in the slab). The Q15 and
+// FP16 formats store 16-bit filters in reducedSlab instead (with filterStride counting 16-bit values).
+// The groupDelay is in input frames (numTaps / 2 except for minimum-phase banks). A bank made for a
+// LAZY_FILTERS instance starts out empty, with a flag in filterReady for each stored filter that is set
+// once the filter has been generated (filterReady is NULL for banks generated in full), and lazyLock is
+// that bank's own mutex for generating them. A bank is in the shared list while it's generating, so
+// instances that find it then must wait for it to be finished.
+
+typedef struct ResampleFilterBank {
+    int numTaps, numFilters, numStored, filterTaps, filterStride, window, paired, compact, format, minPhase, external, refCount, generating;
+    double lowpassRatio, groupDelay;
+    float **filters, *slab;
+    void *reducedSlab, *filterReady, *lazyLock;
+    double *lazyTemp;
+    struct ResampleFilterBank *next;
+} ResampleFilterBank;
+
+// A bank can also be exported as an image (with resampleExportBank() or, as C source for a const array,
+// resampleExportBankSource()) and later used by resampleInitFromBank() right where it is (e.g., in flash,
+// ROM, or an mmap'd file) without generating or copying the filters. An image is this 64-byte header
+// followed by the slab. It must be 64-byte aligned and is in native byte order.
+
+#define RESAMPLE_BANK_MAGIC     0x42465352      // "RSFB" when stored little-endian
+#define RESAMPLE_BANK_VERSION   1
+
+typedef struct {
+    uint32_t magic, version, headerBytes, dataBytes;
+    int32_t numTaps, numFilters, numStored, filterStride, flags, rationalDown;
+    double lowpassRatio, groupDelay;   // groupDelay is zero in images from before MINIMUM_PHASE (meaning numTaps / 2)
+    uint32_t reserved [2];
+} ResampleBankHeader;
+
+// Counters for a resampler's work (from resampleGetStats()). Every output frame is one of the four kinds:
+// passthrough (exactly on an input sample with no lowpass, so it's just copied), exact phase (on one of the
+// filters, so interpolation is skipped), nearest (without SUBSAMPLE_INTERPOLATE), or interpolated. The
+// history shifts count the memmove of the history (or the ring rotations with RING_HISTORY), and the lazy
+// filters are the ones this instance generated on demand (with LAZY_FILTERS).
 
 typedef struct {
-    int numChannels, numSamples, numFilters, numTaps, inputIndex, flags;
-    double *tempFilter, outputOffset;
-    float **buffers, **filters;
+    uint64_t processCalls, inputFrames, outputFrames, historyShifts;
+    uint64_t passthroughOutputs, exactPhaseOutputs, nearestOutputs, interpolatedOutputs;
+    uint64_t lazyFilters;
+} ResampleStats;
+
+typedef struct {
+    int numChannels, numSamples, numFilters, numStoredFilters, numTaps, filterTaps, channelStride, historyFrames, ringBase, inputIndex, flags;
+    double *tempFilter, outputOffset, phaseRatio, rampStep;
+    int64_t outputPhase, phaseStep;
+    uint32_t phaseExtra, phaseStepExtra;
+    int rationalPhase, rationalStep, rationalStepPhase, inPlace, kernel;
+    float **buffers, **filters, *history, *mixFilter, *frame, *writerFrames;
+    const float *filterPairs;
+    const void *reducedFilters;
+    void *filterReady;
+    ResampleFilterBank *filterBank;
+    ResampleKernel applyFilter;
+    ResampleKernelX4 applyFilterX4;
+    ResampleKernelInterleaved applyFilterInterleaved;
+    ResampleKernelQ15 applyFilterQ15;
+    ResampleKernelHalf applyFilterHalf;
+    ResampleStats stats;
 } Resample;
 
 typedef struct {
     unsigned int input_used, output_generated;
 } ResampleResult;
 
+// An output stage for resampleProcessInterleavedWriter(), which is passed each run of numFrames output
+// frames (interleaved) as soon as they've been generated, to process further and store wherever it wants
+// (e.g., filter, dither and pack them into the final format). The frames may be modified in place.
+
+#define RESAMPLE_WRITER_FRAMES  64
+
+typedef void (*ResampleWriter) (void *context, float *frames, int numFrames);
+
+// A PI controller for ASRC use, which steers the ratio passed to the ramped processing functions so that
+// the fill level of the caller's input FIFO (plus the input buffered inside the resampler, from
+// resampleGetPosition(), so the measurement has sub-sample resolution) settles on targetFill. The gains
+// are per update, in ratio deviation per frame of error (e.g., kp = 1e-6 and ki = 1e-8 with updates once
+// per block of a few hundred frames), and the deviation from nominalRatio is limited to +/-maxDeviation
+// (e.g., 0.001 for 1000 ppm), with the integrator held while the output is limited.
+
+typedef struct {
+    double nominalRatio, targetFill, kp, ki, maxDeviation;
+    double integral, error, ratio;
+} ResampleServo;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 Resample *resampleInit (int numChannels, int numTaps, int numFilters, double lowpassRatio, int flags);
+Resample *resampleInitRational (int numChannels, int numTaps, int upFactor, int downFactor, double lowpassRatio, int flags);
+Resample *resampleInitFromBank (int numChannels, const void *bankImage, int flags);
+size_t resampleGetMemoryRequirement (int numChannels, int numTaps, int numFilters, int flags);
+Resample *resampleInitInPlace (void *arena, size_t arenaSize, int numChannels, int numTaps, int numFilters, double lowpassRatio, int flags);
+size_t resampleExportBank (Resample *cxt, void *buffer, size_t bufferSize);
+int resampleExportBankSource (Resample *cxt, FILE *file, const char *name);
+int resampleWarmFilters (Resample *cxt);
 ResampleResult resampleProcess (Resample *cxt, const float *const *input, int numInputFrames, float *const *output, int numOutputFrames, double ratio);
 ResampleResult resampleProcessInterleaved (Resample *cxt, const float *input, int numInputFrames, float *output, int numOutputFrames, double ratio);
+ResampleResult resampleProcessInterleavedWriter (Resample *cxt, const float *input, int numInputFrames, ResampleWriter writer, void *context, int numOutputFrames, double ratio);
 unsigned int resampleGetRequiredSamples (Resample *cxt, int numOutputFrames, double ratio);
 unsigned int resampleGetExpectedOutput (Resample *cxt, int numInputFrames, double ratio);
+ResampleResult resampleGetProcessResult (Resample *cxt, int numInputFrames, int numOutputFrames, double ratio);
+ResampleResult resampleProcessRamped (Resample *cxt, const float *const *input, int numInputFrames, float *const *output, int numOutputFrames, double targetRatio);
+ResampleResult resampleProcessInterleavedRamped (Resample *cxt, const float *input, int numInputFrames, float *output, int numOutputFrames, double targetRatio);
+unsigned int resampleGetRequiredSamplesRamped (Resample *cxt, int numOutputFrames, double targetRatio);
+void resampleServoInit (ResampleServo *servo, double nominalRatio, double targetFill, double kp, double ki, double maxDeviation);
+double resampleServoUpdate (ResampleServo *servo, Resample *cxt, double fifoFrames);
 void resampleAdvancePosition (Resample *cxt, double delta);
 double resampleGetPosition (Resample *cxt);
+double resampleGetGroupDelay (Resample *cxt);
+int resampleGetStats (Resample *cxt, ResampleStats *stats);
 void resampleReset (Resample *cxt);
 void resampleFree (Resample *cxt);
+int resampleSetKernel (int kernel);
+int resampleKernelAvailable (int kernel);
+const char *resampleGetKernelName (int kernel);
 
 #ifdef __cplusplus
 }